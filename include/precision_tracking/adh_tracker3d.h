@@ -16,12 +16,15 @@
 #define __PRECISION_TRACKING__ADH_TRACKER_3D_H_
 
 #include <utility>
+#include <vector>
 
 #include <pcl/point_types.h>
 #include <pcl/point_cloud.h>
 
 #include <precision_tracking/alignment_evaluator.h>
+#include <precision_tracking/cycle_timer.h>
 #include <precision_tracking/motion_model.h>
+#include <precision_tracking/perf_counters.h>
 #include <precision_tracking/scored_transform.h>
 #include <precision_tracking/params.h>
 
@@ -33,7 +36,9 @@ public:
   virtual ~ADHTracker3d();
 
   // Estimate the posterior distribution over alignments sampled from the
-  // proposed range in xRange, yRange, zRange.
+  // proposed range in xRange, yRange, zRange.  If coarse_alignment_evaluator
+  // is set, it scores the levels with an xy sampling resolution coarser than
+  // params->kCascadeResolution, and alignment_evaluator scores the rest.
 	void track(
       const double initial_xy_sampling_resolution,
       const double initial_z_sampling_resolution,
@@ -47,18 +52,49 @@ public:
       const double xy_sensor_resolution,
       const double z_sensor_resolution,
       boost::shared_ptr<AlignmentEvaluator> alignment_evaluator,
+      boost::shared_ptr<AlignmentEvaluator> coarse_alignment_evaluator,
       ScoredTransforms<ScoredTransformXYZ>* scored_transforms) const;
 
+  // Time spent scoring the candidate transforms at each annealing level,
+  // accumulated over all calls to track().
+  const std::vector<CycleTimer>& getLevelScoringTimers() const {
+    return level_scoring_timers_;
+  }
+
+  void resetTimers() { level_scoring_timers_.clear(); }
+
+  // Profile the scoring of the candidate transforms in scoring_profile, with
+  // the given counters (which may be NULL).  The profile is not owned; set
+  // it to NULL to stop profiling.
+  void setScoringProfile(StageProfile* scoring_profile,
+                         const PerfCounters* perf_counters) {
+    scoring_profile_ = scoring_profile;
+    perf_counters_ = perf_counters;
+  }
+
+  size_t memoryUsage() const {
+    return sizeof(*this) +
+        level_scoring_timers_.capacity() * sizeof(CycleTimer);
+  }
+
 private:
   const Params *params_;
 
+  // Per-level scoring time; these are cheap enough to always leave enabled.
+  mutable std::vector<CycleTimer> level_scoring_timers_;
+
+  StageProfile* scoring_profile_;
+  const PerfCounters* perf_counters_;
+
   // Compute the joint probability of each cell and the region, given
   // the prior region probability.
 	void recomputeProbs(
       const double prior_region_prob,
       ScoredTransforms<ScoredTransformXYZ>* scored_transforms) const;
 
-  // Sample more finely in all regions above a certain threshold probability.
+  // Sample more finely in all regions above a certain threshold probability,
+  // or, if params->kMaxTransformsPerLevel is set, in the regions chosen by
+  // chooseBudgetedRefinements.
   void makeNewTransforms3D(
       const double new_xy_resolution, const double new_z_resolution,
       const double old_xy_sampling_resolution,
@@ -67,6 +103,19 @@ private:
       std::vector<XYZTransform>* new_xyz_transforms,
       double* total_recomputing_prob) const;
 
+  // Split params->kMaxTransformsPerLevel transforms between the cells of
+  // the previous level in proportion to their probabilities.  Each cell to
+  // subdivide is returned in to_refine (in increasing order) with the number
+  // of subdivisions along each dimension in factors; less likely cells are
+  // subdivided more coarsely, or not at all.
+  void chooseBudgetedRefinements(
+      const double old_xy_sampling_resolution,
+      const double old_z_sampling_resolution,
+      const ScoredTransforms<ScoredTransformXYZ>& scored_transforms,
+      const std::vector<double>& probs,
+      std::vector<size_t>* to_refine,
+      std::vector<int>* factors) const;
+
   // Create a list of candidate xyz transforms.
   void createCandidateXYZTransforms(
       const double xy_sampling_resolution,
@@ -15,6 +15,7 @@
 #include <pcl/point_types.h>
 #include <pcl/point_cloud.h>
 
+#include <precision_tracking/memory_usage.h>
 #include <precision_tracking/motion_model.h>
 #include <precision_tracking/scored_transform.h>
 #include <precision_tracking/params.h>
@@ -27,6 +28,9 @@ public:
   explicit AlignmentEvaluator(const Params *params);
   virtual ~AlignmentEvaluator();
 
+  // Set the points to align to.  If these are the points that the evaluator
+  // already holds, any index built for them (e.g. a search tree) is kept,
+  // so the points must not be modified while the evaluator holds them.
   virtual void setPrevPoints(
       const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr prev_points);
 
@@ -43,6 +47,21 @@ public:
       const MotionModel& motion_model,
       ScoredTransforms<ScoredTransformXYZ>* scored_transforms);
 
+  // Approximate number of bytes held by this evaluator, including the
+  // previous points that it keeps alive.
+  virtual size_t memoryUsage() const;
+
+  // The standard deviation of the measurement model in the xy directions
+  // (sigma_xy_ after init).
+  static double computeSigmaXY(const Params* params,
+                               const double xy_sampling_resolution,
+                               const double xy_sensor_resolution);
+
+  // How much to discount the measurement model for the given number of
+  // current points (measurement_discount_factor_ after init).
+  static double computeMeasurementDiscountFactor(
+      const Params* params, const size_t num_current_points);
+
 protected:
   virtual void init(const double xy_sampling_resolution,
             const double z_sampling_resolution,
@@ -62,6 +81,7 @@ protected:
 
   // Previous points for alignment.
   pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr prev_points_;
+  TrackedMemory prev_points_memory_;
 
   // Sampling resolution in our particle space.
   double xy_sampling_resolution_;
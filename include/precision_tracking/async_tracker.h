@@ -0,0 +1,167 @@
+/*
+ * async_tracker.h
+ *
+ *      Author: davheld
+ *
+ * Runs Tracker::addPoints on a pool of worker threads, so that the caller
+ * can do other work while objects are being aligned.  Each call returns a
+ * TrackingFuture, and can also take a callback that is called as soon as
+ * the velocity of that object is known.  Calls for the same tracker run one
+ * at a time in the order in which they were made, so each track sees its
+ * frames in order.  Calls for different trackers run in parallel: trackers
+ * start in the order of their first queued call, so objects that are needed
+ * first (e.g. nearby objects) should be added first, and a tracker with more
+ * queued calls then goes to the back of the queue after each call, so
+ * trackers take turns rather than running in the order of all calls.
+ *
+ */
+
+#ifndef __PRECISION_TRACKING__ASYNC_TRACKER_H
+#define __PRECISION_TRACKING__ASYNC_TRACKER_H
+
+#include <deque>
+#include <map>
+#include <vector>
+
+#include <pthread.h>
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include <precision_tracking/params.h>
+#include <precision_tracking/precision_tracker.h>
+#include <precision_tracking/tracker.h>
+
+namespace precision_tracking {
+
+// The result of a call to AsyncTracker::addPoints.
+class TrackingFuture {
+public:
+  TrackingFuture();
+  ~TrackingFuture();
+
+  // Whether the velocity has been estimated.
+  bool isReady() const;
+
+  // Wait until the velocity has been estimated.
+  void wait() const;
+
+  // The values returned by Tracker::addPoints; these wait until the velocity
+  // has been estimated.
+  Eigen::Vector3f getEstimatedVelocity() const;
+  double getAlignmentProbability() const;
+
+  // Set the result and wake up the threads that are waiting for it.
+  void set(const Eigen::Vector3f& estimated_velocity,
+           const double alignment_probability);
+
+private:
+  // Not copyable, since the mutex cannot be copied.
+  TrackingFuture(const TrackingFuture&);
+  TrackingFuture& operator=(const TrackingFuture&);
+
+  mutable pthread_mutex_t mutex_;
+  mutable pthread_cond_t ready_cond_;
+  bool ready_;
+  Eigen::Vector3f estimated_velocity_;
+  double alignment_probability_;
+};
+
+class AsyncTracker {
+public:
+  // Called on a worker thread with the estimated velocity and the alignment
+  // probability, as soon as they are known.
+  typedef boost::function<void (const Eigen::Vector3f&, double)> Callback;
+
+  // Starts num_threads worker threads.  As in SegmentedTracker, each worker
+  // has its own precision tracker if use_precision_tracker is set, which it
+  // sets as the precision tracker of each tracker that it runs.  Otherwise
+  // the workers clear the precision tracker of each tracker that they run,
+  // so the trackers only use their motion models (a precision tracker set
+  // by the caller could be shared by trackers on different threads).
+  AsyncTracker(const Params* params, const bool use_precision_tracker,
+               const int num_threads);
+
+  // Waits for all calls to finish.
+  ~AsyncTracker();
+
+  // Queue a call to tracker->addPoints.  The tracker must not be used in
+  // any other way, and the points must not be modified, until the returned
+  // future is ready.  If callback is set, it is called on the worker thread
+  // before the future becomes ready.
+  boost::shared_ptr<TrackingFuture> addPoints(
+      Tracker* tracker,
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+      const double current_timestamp,
+      const double sensor_horizontal_resolution,
+      const double sensor_vertical_resolution,
+      const Callback& callback = Callback());
+
+  // Wait until every queued call has finished.
+  void waitAll();
+
+  const std::vector<boost::shared_ptr<PrecisionTracker> >&
+      get_precision_trackers() const {
+    return precision_trackers_;
+  }
+
+private:
+  // Not copyable, since the worker threads point to this object.
+  AsyncTracker(const AsyncTracker&);
+  AsyncTracker& operator=(const AsyncTracker&);
+
+  // A queued call to Tracker::addPoints.
+  struct Job {
+    pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr points;
+    double timestamp;
+    double sensor_horizontal_resolution;
+    double sensor_vertical_resolution;
+    Callback callback;
+    boost::shared_ptr<TrackingFuture> future;
+  };
+
+  struct WorkerArgs {
+    AsyncTracker* async_tracker;
+    int worker_index;
+  };
+
+  static void* runWorker(void* args);
+
+  // Run jobs until the tracker is destroyed.
+  void work(const int worker_index);
+
+  const Params* params_;
+
+  std::vector<boost::shared_ptr<PrecisionTracker> > precision_trackers_;
+  std::vector<pthread_t> threads_;
+  std::vector<WorkerArgs> worker_args_;
+
+  // Guards everything below.
+  pthread_mutex_t mutex_;
+
+  // Signaled when a tracker becomes ready, or when the workers should stop.
+  pthread_cond_t work_cond_;
+
+  // Signaled when the last queued job finishes.
+  pthread_cond_t idle_cond_;
+
+  // The jobs of each tracker that has any, in order.  The job at the front
+  // is running if the tracker is not in ready_trackers_.
+  std::map<Tracker*, std::deque<Job> > jobs_;
+
+  // Trackers whose first job can run, in the order in which they became
+  // ready.  A tracker is in here at most once.
+  std::deque<Tracker*> ready_trackers_;
+
+  // Number of jobs that were queued but have not finished.
+  int num_unfinished_jobs_;
+
+  bool stopping_;
+};
+
+} // namespace precision_tracking
+
+#endif // __PRECISION_TRACKING__ASYNC_TRACKER_H
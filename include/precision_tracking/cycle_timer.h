@@ -0,0 +1,127 @@
+/*
+ * cycle_timer.h
+ *
+ *      Author: davheld
+ *
+ * A low-overhead timer for instrumenting hot loops.  On x86 processors with
+ * an invariant time stamp counter, each reading is a single rdtsc / rdtscp
+ * instruction; otherwise we fall back to CLOCK_MONOTONIC, which is serviced
+ * by the vDSO without a system call.  Ticks are only accumulated while
+ * timing - they are converted to seconds (using a one-time calibration
+ * against CLOCK_MONOTONIC) when the results are reported.
+ *
+ */
+
+#ifndef __PRECISION_TRACKING__CYCLE_TIMER_H
+#define __PRECISION_TRACKING__CYCLE_TIMER_H
+
+#include <time.h>
+#include <stdint.h>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PRECISION_TRACKING_HAS_TSC 1
+#endif
+
+namespace precision_tracking {
+
+// Returns true if the time stamp counter runs at a constant rate on all
+// cores and can be used for timing.
+bool tscIsUsable();
+
+// Number of ticks per second returned by readCycleCounter().
+double getCycleCounterFrequency();
+
+// Read the cycle counter (or the monotonic clock, in nanoseconds, if the
+// cycle counter is not usable).
+inline uint64_t readCycleCounter()
+{
+#ifdef PRECISION_TRACKING_HAS_TSC
+  static const bool use_tsc = tscIsUsable();
+  if (use_tsc) {
+    return __rdtsc();
+  }
+#endif
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+// Same as above, but waits for all previous instructions to finish before
+// reading the counter, so that the timed code is not cut short.
+inline uint64_t readCycleCounterSerialized()
+{
+#ifdef PRECISION_TRACKING_HAS_TSC
+  static const bool use_tsc = tscIsUsable();
+  if (use_tsc) {
+    unsigned int aux;
+    return __rdtscp(&aux);
+  }
+#endif
+  return readCycleCounter();
+}
+
+// Accumulates the time spent in repeated calls between start() and stop().
+// Timers are not thread-safe; give each thread its own timer and combine
+// them with add() for reporting.
+class CycleTimer {
+public:
+  explicit CycleTimer(const std::string& description = "CycleTimer");
+
+  void start() { start_ = readCycleCounter(); }
+
+  void stop() {
+    total_ticks_ += readCycleCounterSerialized() - start_;
+    ++num_intervals_;
+  }
+
+  // Add the time accumulated by another timer to this one.
+  void add(const CycleTimer& other) {
+    total_ticks_ += other.total_ticks_;
+    num_intervals_ += other.num_intervals_;
+  }
+
+  void reset(const std::string& description);
+  void reset();
+
+  uint64_t getTicks() const { return total_ticks_; }
+  uint64_t getNumIntervals() const { return num_intervals_; }
+
+  double getMicroseconds() const;
+  double getMilliseconds() const;
+  double getSeconds() const;
+
+  // Mean time per start() / stop() interval.
+  double getMeanMicroseconds() const;
+
+  std::string report() const;
+  void print() const;
+
+  std::string description_;
+
+private:
+  uint64_t total_ticks_;
+  uint64_t num_intervals_;
+  uint64_t start_;
+};
+
+// Times the enclosing scope, accumulating into an existing timer.
+class ScopedCycleTimer
+{
+public:
+  explicit ScopedCycleTimer(CycleTimer* timer)
+    : timer_(timer)
+  {
+    timer_->start();
+  }
+
+  ~ScopedCycleTimer() { timer_->stop(); }
+
+private:
+  CycleTimer* timer_;
+};
+
+} // namespace precision_tracking
+
+#endif // __PRECISION_TRACKING__CYCLE_TIMER_H
@@ -0,0 +1,97 @@
+/*
+ * density_grid_25d_evaluator.h
+ *
+ *      Author: davheld
+ *
+ * Compute the probability of a given set of alignments using a 2.5D density
+ * grid: for each xy cell, we store the log density of the 2D projection of
+ * the previous points, as in DensityGrid2dEvaluator, together with a bitmask
+ * of the heights at which there are previous points near the cell.  A point
+ * is scored with a 2D lookup and a bit test, so points that project onto the
+ * object but are at the wrong height (e.g. under the trailer of a truck) are
+ * not rewarded, at close to the memory and speed of the 2D grid.  This
+ * evaluator handles translations only (no rotations).
+ *
+ */
+
+#ifndef __PRECISION_TRACKING__DENSITY_GRID_25D_EVALUATOR_H_
+#define __PRECISION_TRACKING__DENSITY_GRID_25D_EVALUATOR_H_
+
+#include <stdint.h>
+#include <vector>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include <precision_tracking/scored_transform.h>
+#include <precision_tracking/alignment_evaluator.h>
+
+namespace precision_tracking {
+
+class DensityGrid25dEvaluator : public AlignmentEvaluator {
+public:
+  explicit DensityGrid25dEvaluator(const Params *params);
+  virtual ~DensityGrid25dEvaluator();
+
+  size_t memoryUsage() const;
+
+private:
+  void init(const double xy_sampling_resolution,
+            const double z_sampling_resolution,
+            const double sensor_horizontal_resolution,
+            const double sensor_vertical_resolution,
+            const size_t num_current_points);
+
+  // Get the probability of this transform.
+  double getLogProbability(
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+      const Eigen::Vector3f& current_points_centroid,
+      const MotionModel& motion_model,
+      const double delta_x, const double delta_y, const double delta_z);
+
+  void computeDensityGridParameters(
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& prev_points,
+      const double xy_sampling_resolution,
+      const double z_sampling_resolution,
+      const double xy_sensor_resolution,
+      const double z_sensor_resolution);
+
+  // Pre-cache probability values and height masks in a density grid for
+  // fast lookups.
+  void computeDensityGrid(
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& prev_points);
+
+  // Number of bytes allocated for the density grid.
+  size_t getGridMemoryUsage() const;
+
+  // The number of height bins in each mask.
+  static const int kNumHeightBins = 64;
+
+  // The log density of each xy cell, indexed by x * ySize_ + y.
+  std::vector<float> density_grid_;
+
+  // For each xy cell, bit k is set if a previous point whose density spills
+  // into this cell is within num_spillover_steps_z_ height bins of bin k.
+  std::vector<uint64_t> height_masks_;
+  TrackedMemory grid_memory_;
+
+  // The size of the resulting grid.
+  int xSize_;
+  int ySize_;
+
+  // The step size of the density grid.
+  double xy_grid_step_;
+  double z_grid_step_;
+
+  // The minimum point of the previous set of points used for tracking.
+  pcl::PointXYZRGB min_pt_;
+
+  // Number of grid cells away from each point that we spill its
+  // probability (or its height) into.
+  int num_spillover_steps_xy_;
+  int num_spillover_steps_z_;
+};
+
+} // namespace precision_tracking
+
+#endif /* __PRECISION_TRACKING__DENSITY_GRID_25D_EVALUATOR_H_ */
@@ -36,6 +36,8 @@ public:
   DensityGrid3dEvaluator(const Params *params);
   virtual ~DensityGrid3dEvaluator();
 
+  size_t memoryUsage() const;
+
 private:
   void init(const double xy_sampling_resolution,
             const double z_sampling_resolution,
@@ -61,8 +63,12 @@ private:
   void computeDensityGrid(
       const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& prev_points);
 
+  // Number of bytes allocated for the density grid.
+  size_t getGridMemoryUsage() const;
+
   // A grid used to pre-cache probability values for fast lookups.
   std::vector<std::vector<std::vector<double> >  > density_grid_;
+  TrackedMemory grid_memory_;
 
   // The size of the resulting grid.
   int xSize_;
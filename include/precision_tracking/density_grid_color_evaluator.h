@@ -0,0 +1,125 @@
+/*
+ * density_grid_color_evaluator.h
+ *
+ *      Author: davheld
+ *
+ * Compute the probability of a given set of alignments using both the
+ * shape and the color of the points, at the speed of a density grid.  As in
+ * DensityGrid2dEvaluator, the spatial probability is pre-cached in a 2D
+ * grid; each cell also stores the mean and the spread of the colors of the
+ * previous points that it was spilled from.  The color model is the same
+ * as in LF_RGBD_6D_Evaluator, with the color of the nearest neighbor
+ * replaced by the mean color of the cell, so scoring a point is a single
+ * grid lookup instead of a nearest neighbor search.  This evaluator handles
+ * translations only (no rotations).
+ *
+ */
+
+#ifndef __PRECISION_TRACKING__DENSITY_GRID_COLOR_EVALUATOR_H_
+#define __PRECISION_TRACKING__DENSITY_GRID_COLOR_EVALUATOR_H_
+
+#include <vector>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include <precision_tracking/scored_transform.h>
+#include <precision_tracking/alignment_evaluator.h>
+
+namespace precision_tracking {
+
+class DensityGridColorEvaluator : public AlignmentEvaluator {
+public:
+  explicit DensityGridColorEvaluator(const Params *params);
+  virtual ~DensityGridColorEvaluator();
+
+  size_t memoryUsage() const;
+
+private:
+  // A cell of the density grid.
+  struct ColorCell {
+    // Probability of a point in this cell under the spatial model, before
+    // smoothing, or 0 if no previous point spills into this cell.
+    float spatial_prob;
+
+    // Mean and mean absolute deviation of the colors of the previous points
+    // in the cell that this cell was spilled from.
+    float color1;
+    float color2;
+    float spread1;
+    float spread2;
+  };
+
+  // Color sums of the previous points in a cell.
+  struct ColorSums {
+    int num_points;
+    float color1;
+    float color2;
+    float abs_deviation1;
+    float abs_deviation2;
+  };
+
+  void init(const double xy_sampling_resolution,
+            const double z_sampling_resolution,
+            const double sensor_horizontal_resolution,
+            const double sensor_vertical_resolution,
+            const size_t num_current_points);
+
+  // Get the probability of this transform.
+  double getLogProbability(
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+      const Eigen::Vector3f& current_points_centroid,
+      const MotionModel& motion_model,
+      const double delta_x, const double delta_y, const double delta_z);
+
+  void computeDensityGridParameters(
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& prev_points,
+      const double xy_sampling_resolution);
+
+  // Pre-cache probability values and colors in a density grid for fast
+  // lookups.
+  void computeDensityGrid(
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& prev_points);
+
+  // Get the colors of a point that are compared, based on kColorSpace.
+  void getColors(const pcl::PointXYZRGB& point, float* color1,
+                 float* color2) const;
+
+  // Get the index of the cell containing a previous point, or -1 if the
+  // point is outside the interior of the grid.
+  int getCellIndex(const pcl::PointXYZRGB& point) const;
+
+  // Number of bytes allocated for the density grid.
+  size_t getGridMemoryUsage() const;
+
+  // The density grid, indexed by x * ySize_ + y.
+  std::vector<ColorCell> density_grid_;
+  TrackedMemory grid_memory_;
+
+  // Scratch space for building the grid: the color sums of each cell and
+  // the cells that contain previous points.
+  std::vector<ColorSums> color_sums_;
+  std::vector<int> occupied_cells_;
+
+  // The size of the resulting grid.
+  int xSize_;
+  int ySize_;
+
+  // The step size of the density grid.
+  double xy_grid_step_;
+
+  // The minimum point of the previous set of points used for tracking.
+  pcl::PointXYZRGB min_pt_;
+
+  // Number of grid cells away from each point that we spill its
+  // probability into.
+  int num_spillover_steps_xy_;
+
+  // How much we expect the colors to match at the current sampling
+  // resolution.
+  double prob_color_match_;
+};
+
+} // namespace precision_tracking
+
+#endif /* __PRECISION_TRACKING__DENSITY_GRID_COLOR_EVALUATOR_H_ */
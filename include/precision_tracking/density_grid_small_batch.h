@@ -0,0 +1,102 @@
+/*
+ * density_grid_small_batch.h
+ *
+ *      Author: davheld
+ *
+ * Score the 2D alignments of many small objects at once.  TrackAssociator
+ * uses this to score its (track, segment) candidates at the coarsest
+ * sampling resolution; PrecisionTracker aligns one object at a time and
+ * uses DensityGridSmallEvaluator instead.  A small object has too few points
+ * to fill the SIMD lanes when its points are scored one transform at a
+ * time, so the objects are scored in blocks of kBlockSize objects, one
+ * object per lane: the density grids of a block (as in
+ * DensityGridSmallEvaluator) are packed into one arena, and the current
+ * points of the objects are interleaved, so that the lookups of a point of
+ * every object in the block are computed together in a loop that the
+ * compiler vectorizes across objects.
+ *
+ */
+
+#ifndef __PRECISION_TRACKING__DENSITY_GRID_SMALL_BATCH_H
+#define __PRECISION_TRACKING__DENSITY_GRID_SMALL_BATCH_H
+
+#include <vector>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include <precision_tracking/memory_usage.h>
+#include <precision_tracking/motion_model.h>
+#include <precision_tracking/params.h>
+#include <precision_tracking/scored_transform.h>
+
+namespace precision_tracking {
+
+// The alignment of one object, to be scored by DensityGridSmallBatch.
+struct SmallAlignmentProblem {
+  SmallAlignmentProblem()
+    : motion_model(NULL),
+      transforms(NULL),
+      xy_sensor_resolution(0)
+  {
+  }
+
+  // Align the current points to the previous points.  Both must fit in a
+  // small density grid (see DensityGridSmallEvaluator::fits).
+  pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr current_points;
+  pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr prev_points;
+
+  const MotionModel* motion_model;
+
+  // The transforms to score.
+  const std::vector<XYZTransform>* transforms;
+
+  // The effective horizontal resolution of the sensor.
+  double xy_sensor_resolution;
+};
+
+class DensityGridSmallBatch {
+public:
+  explicit DensityGridSmallBatch(const Params* params);
+
+  // Number of objects that are scored together.
+  static const int kBlockSize = 8;
+
+  // Score the transforms of each problem at the given xy sampling
+  // resolution, as DensityGridSmallEvaluator::score3DTransforms does for
+  // one object.  (*scored_transforms)[i] is set to the scores of the
+  // transforms of problems[i].
+  void score3DTransforms(
+      const std::vector<SmallAlignmentProblem>& problems,
+      const double xy_sampling_resolution,
+      std::vector<ScoredTransforms<ScoredTransformXYZ> >* scored_transforms);
+
+  // Number of bytes held by the batch.
+  size_t memoryUsage() const;
+
+private:
+  // Score the problems from begin to end (at most kBlockSize).
+  void scoreBlock(
+      const std::vector<SmallAlignmentProblem>& problems,
+      const size_t begin, const size_t end,
+      const double xy_sampling_resolution,
+      std::vector<ScoredTransforms<ScoredTransformXYZ> >* scored_transforms);
+
+  const Params* params_;
+
+  // The density grids of the objects in a block, one after the other.
+  std::vector<float> grid_arena_;
+  TrackedMemory grid_memory_;
+
+  // The current points of the objects in a block, in grid units relative to
+  // the minimum corner of the grid of each object.  Point i of lane l is at
+  // i * kBlockSize + l; lanes with fewer points are padded with points of
+  // weight 0.
+  std::vector<float> x_;
+  std::vector<float> y_;
+  std::vector<float> weights_;
+};
+
+} // namespace precision_tracking
+
+#endif // __PRECISION_TRACKING__DENSITY_GRID_SMALL_BATCH_H
@@ -0,0 +1,115 @@
+/*
+ * density_grid_small_evaluator.h
+ *
+ *      Author: davheld
+ *
+ * A version of DensityGrid2dEvaluator for small objects (e.g. pedestrians
+ * and cyclists), whose cost is dominated by per-object overhead rather than
+ * by the number of points.  The density grid is a fixed-size array inside
+ * the evaluator, so building it only resets the cells that the object
+ * covers, and the current points are copied once per annealing level into
+ * fixed-capacity arrays in grid units, so that scoring each transform is an
+ * unrolled loop of additions and lookups.  Use fits() to check whether an
+ * object can be tracked with this evaluator.
+ *
+ */
+
+#ifndef __PRECISION_TRACKING__DENSITY_GRID_SMALL_EVALUATOR_H_
+#define __PRECISION_TRACKING__DENSITY_GRID_SMALL_EVALUATOR_H_
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include <precision_tracking/scored_transform.h>
+#include <precision_tracking/alignment_evaluator.h>
+
+namespace precision_tracking {
+
+class DensityGridSmallEvaluator : public AlignmentEvaluator {
+public:
+  explicit DensityGridSmallEvaluator(const Params *params);
+  virtual ~DensityGridSmallEvaluator();
+
+  // The number of cells along each side of the density grid.
+  static const int kGridSize = 64;
+
+  // The maximum number of current points.
+  static const int kMaxPoints = 256;
+
+  // Whether the previous points fit in the density grid at the given
+  // xy sampling resolution, and the current points fit in the point arrays.
+  static bool fits(
+      const pcl::PointCloud<pcl::PointXYZRGB>& current_points,
+      const pcl::PointCloud<pcl::PointXYZRGB>& prev_points,
+      const double xy_sampling_resolution);
+
+  // Build the density grid of prev_points at the given grid step into
+  // cells (kGridSize * kGridSize values, indexed by x * kGridSize + y), and
+  // set the minimum corner of the grid and the size of the part of the grid
+  // that covers the object.  Objects that do not fit (see fits()) are
+  // cropped.
+  static void buildGrid(
+      const pcl::PointCloud<pcl::PointXYZRGB>& prev_points,
+      const double xy_grid_step, const double sigma_xy, const Params* params,
+      float* cells, double* min_x, double* min_y, int* x_size, int* y_size);
+
+  void score3DTransforms(
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+      const Eigen::Vector3f& current_points_centroid,
+      const double xy_sampling_resolution,
+      const double z_sampling_resolution,
+      const double sensor_horizontal_resolution,
+      const double sensor_vertical_resolution,
+      const std::vector<XYZTransform>& transforms,
+      const MotionModel& motion_model,
+      ScoredTransforms<ScoredTransformXYZ>* scored_transforms);
+
+  size_t memoryUsage() const;
+
+private:
+  void init(const double xy_sampling_resolution,
+            const double z_sampling_resolution,
+            const double sensor_horizontal_resolution,
+            const double sensor_vertical_resolution,
+            const size_t num_current_points);
+
+  // Get the probability of this transform.
+  double getLogProbability(
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+      const Eigen::Vector3f& current_points_centroid,
+      const MotionModel& motion_model,
+      const double delta_x, const double delta_y, const double delta_z);
+
+  // Copy the current points into the point arrays, in grid units relative to
+  // the minimum corner of the grid.
+  void setCurrentPoints(
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points);
+
+  // Sum the log densities of the current points shifted by the given
+  // number of grid cells.
+  double computeLogDensity(const float x_shift, const float y_shift) const;
+
+  // The log density of each cell, indexed by x * kGridSize + y.
+  float density_grid_[kGridSize * kGridSize];
+  TrackedMemory grid_memory_;
+
+  // The size of the part of the grid that covers the object.
+  int xSize_;
+  int ySize_;
+
+  // The step size of the density grid.
+  double xy_grid_step_;
+
+  // The minimum corner of the grid.
+  double min_x_;
+  double min_y_;
+
+  // The current points, in grid units relative to the minimum corner.
+  float x_[kMaxPoints];
+  float y_[kMaxPoints];
+  int num_points_;
+};
+
+} // namespace precision_tracking
+
+#endif /* __PRECISION_TRACKING__DENSITY_GRID_SMALL_EVALUATOR_H_ */
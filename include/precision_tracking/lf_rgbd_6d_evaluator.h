@@ -20,11 +20,11 @@
 
 #include <pcl/point_types.h>
 #include <pcl/point_cloud.h>
-#include <pcl/kdtree/kdtree_flann.h>
 
 #include <precision_tracking/motion_model.h>
 #include <precision_tracking/scored_transform.h>
 #include <precision_tracking/alignment_evaluator.h>
+#include <precision_tracking/static_kd_tree.h>
 
 namespace precision_tracking {
 
@@ -60,6 +60,8 @@ public:
 
   void setPrevPoints(const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr prev_points);
 
+  size_t memoryUsage() const;
+
   double getPointProbability(
       const pcl::PointXYZRGB& point);
 
@@ -101,7 +103,23 @@ private:
             const double sensor_vertical_resolution,
             const size_t num_current_points);
 
-  double get_log_prob(const pcl::PointXYZRGB& current_pt);
+  // Get the log probability of a current point.  If point_index is not
+  // negative, the nearest neighbor search starts from the nearest neighbor
+  // that was found for the point with this index for the previous transform.
+  double get_log_prob(const pcl::PointXYZRGB& current_pt,
+                      const int point_index);
+
+  // Find the nearest previous point, returning its index and setting the
+  // squared distance to it.
+  int findNearestNeighbor(const pcl::PointXYZRGB& current_pt,
+                          const int point_index, float* sq_dist);
+
+  // Build the graph of the nearest neighbors of each previous point.  This
+  // is done when the graph is first needed for the current previous points.
+  void computeNeighborGraph();
+
+  // Estimated number of bytes held by the search tree.
+  size_t getSearchTreeMemoryUsage() const;
 
   double computeColorProb(const pcl::PointXYZRGB& prev_pt,
       const pcl::PointXYZRGB& pt, const double point_match_prob_spatial_i) const;
@@ -117,14 +135,23 @@ private:
       Eigen::Affine3f* transform) const;
 
   // Search tree from the previous points.
-  pcl::KdTreeFLANN<pcl::PointXYZRGB> searchTree_;
-
-  // The number of nearest neighbors to find.
-  const int max_nn_;
-
-  // Vector to store the result of the nearest neighbor search.
-  std::vector<int> nn_indices_;
-  std::vector<float> nn_sq_dists_;
+  StaticKdTree searchTree_;
+  TrackedMemory search_tree_memory_;
+
+  // The num_graph_neighbors_ exact nearest neighbors of each previous point,
+  // stored consecutively, and the squared distance to the farthest of them.
+  // All previous points that are closer to a previous point than this
+  // distance are among its neighbors.
+  std::vector<int> neighbor_graph_;
+  std::vector<float> neighbor_radius_sq_;
+  int num_graph_neighbors_;
+
+  // The nearest neighbor found for each current point for the previous
+  // transform, or -1.
+  std::vector<int> warm_start_indices_;
+
+  // Whether to walk the neighbor graph at the current sampling resolution.
+  bool use_warm_start_;
 
   // Whether to use color in the measurement model.
   bool use_color_;
@@ -0,0 +1,87 @@
+/*
+ * memory_usage.h
+ *
+ *      Author: davheld
+ *
+ * Process-wide accounting of the memory held by the tracker, by category,
+ * with high-water marks.  Classes which hold large allocations keep a
+ * TrackedMemory member that adds their allocation to the totals for as long
+ * as they are alive.
+ *
+ */
+
+#ifndef __PRECISION_TRACKING__MEMORY_USAGE_H
+#define __PRECISION_TRACKING__MEMORY_USAGE_H
+
+#include <cstddef>
+#include <string>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+namespace precision_tracking {
+
+enum MemoryCategory {
+  // Density grids of the density grid evaluators.
+  kDensityGridMemory,
+  // Nearest-neighbor search trees.
+  kSearchTreeMemory,
+  // Point clouds stored between frames.
+  kPointCloudMemory,
+  // Motion models.
+  kMotionModelMemory,
+  kNumMemoryCategories
+};
+
+struct MemoryUsage {
+  MemoryUsage()
+    : current(0), peak(0)
+  {
+  }
+
+  // Bytes currently held.
+  size_t current;
+
+  // Maximum number of bytes held at any one time since the last call
+  // to resetPeakMemoryUsage().
+  size_t peak;
+};
+
+// Get the memory currently held by the tracker in a given category, or in
+// total, across all threads.
+MemoryUsage getMemoryUsage(const MemoryCategory category);
+MemoryUsage getTotalMemoryUsage();
+
+// Reset the high-water marks to the current usage.
+void resetPeakMemoryUsage();
+
+// Peak resident set size of the whole process, in bytes.
+size_t getPeakResidentMemory();
+
+std::string reportMemoryUsage();
+
+// Approximate number of bytes held by a point cloud.
+size_t getCloudMemoryUsage(const pcl::PointCloud<pcl::PointXYZRGB>& cloud);
+
+// Adds a number of bytes to the process-wide accounting for as long as
+// this object is alive.  Copies add their own bytes.
+class TrackedMemory {
+public:
+  explicit TrackedMemory(const MemoryCategory category, const size_t bytes = 0);
+  TrackedMemory(const TrackedMemory& other);
+  TrackedMemory& operator=(const TrackedMemory& other);
+  ~TrackedMemory();
+
+  // Change the number of bytes held.
+  void set(const size_t bytes);
+
+  size_t get() const { return bytes_; }
+
+private:
+  MemoryCategory category_;
+  size_t bytes_;
+};
+
+} // namespace precision_tracking
+
+#endif // __PRECISION_TRACKING__MEMORY_USAGE_H
@@ -12,10 +12,12 @@
 #ifndef __PRECISION_TRACKING__MOTION_MODEL_H_
 #define __PRECISION_TRACKING__MOTION_MODEL_H_
 
+#include <iostream>
 #include <vector>
 
 #include <Eigen/Eigen>
 
+#include <precision_tracking/memory_usage.h>
 #include <precision_tracking/scored_transform.h>
 #include <precision_tracking/params.h>
 
@@ -78,6 +80,19 @@ public:
 
   void setFlip(const bool flip) { if (flip) { flip_ = -1; } else { flip_ = 1; } }
 
+  bool get_flip() const { return flip_ < 0; }
+
+  // The motion model does not allocate any memory beyond its own size.
+  size_t memoryUsage() const { return sizeof(*this); }
+
+  // Write the state of the motion model in a compact binary format, so that
+  // it can be restored after a restart.
+  void serialize(std::ostream& out) const;
+
+  // Restore a state written by serialize.  Returns false (leaving the motion
+  // model unchanged) if the stream does not contain a valid state.
+  bool deserialize(std::istream& istrm);
+
 private:
   Eigen::Vector3d computeMeanVelocity(
       const ScoredTransforms<ScoredTransformXYZ>& transforms,
@@ -107,6 +122,8 @@ private:
 
     // Whether to flip the output of the motion model (-1 to flip, 1 not to flip).
     int flip_;
+
+  TrackedMemory memory_;
 };
 
 } // namespace precision_tracking
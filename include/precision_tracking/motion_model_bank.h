@@ -0,0 +1,136 @@
+/*
+ * motion_model_bank.h
+ *
+ *      Author: davheld
+ *
+ * Centroid-based Kalman filters for many tracks at once.  This computes the
+ * same estimates as a Tracker without a precision tracker, but the states of
+ * the tracks are stored in blocks of kBlockSize tracks, with each block
+ * storing each component of the state as an array.  The propagation, matrix
+ * inversions and Kalman updates of the tracks in a block are then computed
+ * together in loops that the compiler vectorizes across tracks.  Use this
+ * instead of one Tracker per object when tracking a large number of objects
+ * with the Kalman filter only.
+ *
+ * Each track is identified by its row in the bank.  Call addCentroid for
+ * each track that was observed, then call update once to apply all of the
+ * observations.
+ *
+ */
+
+#ifndef __PRECISION_TRACKING__MOTION_MODEL_BANK_H
+#define __PRECISION_TRACKING__MOTION_MODEL_BANK_H
+
+#include <vector>
+
+#include <Eigen/Eigen>
+
+#include <precision_tracking/memory_usage.h>
+#include <precision_tracking/params.h>
+
+namespace precision_tracking {
+
+class MotionModelBank {
+public:
+  explicit MotionModelBank(const Params *params);
+
+  // Add a new track and return its row.
+  int addTrack();
+
+  // Reset the row to start tracking a new object.
+  void clear(const int row);
+
+  size_t size() const { return num_rows_; }
+
+  // Record the centroid of the object observed at the given time.  The
+  // observation is applied by the next call to update; each row can only
+  // be observed once per update.
+  void addCentroid(const int row, const Eigen::Vector4f& centroid,
+                   const double timestamp);
+
+  // Apply all observations recorded since the last update.  For each
+  // observed row, this propagates the motion model to the time of the
+  // observation and then updates it with the displacement of the centroid,
+  // as MotionModel::propagate and MotionModel::addCentroidDiff do.
+  void update();
+
+  Eigen::Vector3f get_mean_velocity(const int row) const;
+
+  Eigen::Matrix3d get_covariance_velocity(const int row) const;
+
+  Eigen::Matrix3d get_covariance_delta_position(const int row) const;
+
+  // Whether the row has been updated with at least one centroid displacement.
+  bool valid(const int row) const;
+
+  // The probability of a displacement, as in MotionModel::computeScore.
+  double computeScore(const int row, const double x, const double y,
+                      const double z) const;
+
+  // Number of bytes held by the bank.
+  size_t memoryUsage() const;
+
+  // Number of tracks whose states are stored together.  Two or four tracks
+  // fit into a SIMD register, depending on the instruction set.
+  static const int kBlockSize = 4;
+
+private:
+  // The unique entries of a symmetric 3x3 matrix for each track in a block.
+  struct SymmetricMatrices {
+    void set(const int lane, const double diagonal);
+    Eigen::Matrix3d get(const int lane) const;
+
+    double xx[kBlockSize], xy[kBlockSize], xz[kBlockSize];
+    double yy[kBlockSize], yz[kBlockSize], zz[kBlockSize];
+  };
+
+  // The states of kBlockSize tracks.  Flags are stored as doubles (0 or 1)
+  // rather than bools so that they can be used as masks when vectorizing.
+  struct Block {
+    // Motion model state.
+    double mean_velocity_x[kBlockSize];
+    double mean_velocity_y[kBlockSize];
+    double mean_velocity_z[kBlockSize];
+    SymmetricMatrices covariance_velocity;
+
+    double mean_delta_position_x[kBlockSize];
+    double mean_delta_position_y[kBlockSize];
+    double mean_delta_position_z[kBlockSize];
+    SymmetricMatrices covariance_delta_position;
+    SymmetricMatrices covariance_delta_position_inv;
+
+    // The normalization constant of the motion model is computed from the
+    // determinant when needed, to keep the square root out of the
+    // vectorized loop.
+    double covariance_delta_position_determinant[kBlockSize];
+
+    double valid[kBlockSize];
+
+    // The previous observation of each track.
+    double has_prev_centroid[kBlockSize];
+    double prev_centroid_x[kBlockSize];
+    double prev_centroid_y[kBlockSize];
+    double prev_centroid_z[kBlockSize];
+    double prev_timestamp[kBlockSize];
+
+    // Observations waiting for the next update.
+    double observed[kBlockSize];
+    double centroid_x[kBlockSize];
+    double centroid_y[kBlockSize];
+    double centroid_z[kBlockSize];
+    double timestamp[kBlockSize];
+  };
+
+  void updateBlock(Block* block) const;
+
+  const Params *params_;
+
+  std::vector<Block> blocks_;
+  size_t num_rows_;
+
+  TrackedMemory memory_;
+};
+
+} // namespace precision_tracking
+
+#endif // __PRECISION_TRACKING__MOTION_MODEL_BANK_H
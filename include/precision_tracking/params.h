@@ -27,6 +27,13 @@ struct Params
   /// than our sampling resolution.
   bool useMean;
 
+  /// After this many consecutive frames in which an object was not observed
+  /// (see Tracker::addMissedFrame), its tracker becomes dormant: the previous
+  /// points are down-sampled to kPrevFrameDownsample points and the state is
+  /// packed until the object is observed again.  Set to 0 to keep the full
+  /// state of occluded objects.
+  int kDormantMissedFrames;
+
   /// @}
 
 
@@ -52,6 +59,32 @@ struct Params
   /// Only divide cells whose probabilities are greater than kMinProb.
   double kMinProb;
 
+  /// Set this to limit the number of transforms that we evaluate at each
+  /// iteration beyond the first (0 for no limit).  The transforms are split
+  /// between the cells above kMinProb in proportion to their probabilities,
+  /// so unlikely cells are divided more coarsely or not at all, and the cost
+  /// of each iteration stays bounded when there are several likely
+  /// alignments.
+  size_t kMaxTransformsPerLevel;
+
+  /// @}
+
+
+  /// @{ Particle tracker section
+
+  /// Whether to align with ParticleTracker3d instead of ADHTracker3d.  The
+  /// particle tracker scores a fixed number of transforms, so its cost does
+  /// not depend on how many cells exceed kMinProb.
+  bool useParticleTracker;
+
+  /// Number of transforms to score in each round.
+  int kNumParticles;
+
+  /// Number of rounds; each round after the first resamples the transforms
+  /// of the previous round at a finer sampling resolution.  An alignment
+  /// scores kNumParticles * kNumParticleRounds transforms.
+  int kNumParticleRounds;
+
   /// @}
 
 
@@ -119,6 +152,24 @@ struct Params
   /// For a reasonable speedup, set to 2.
   double kSearchTreeEpsilon;
 
+  /// Whether to start the nearest neighbor search for each point from its
+  /// nearest neighbor for the previous transform, walking a graph of the
+  /// kNeighborGraphSize nearest neighbors of each previous point.  The
+  /// result of the walk is only used if it is guaranteed to be the exact
+  /// nearest neighbor; otherwise the search tree is used.  With the
+  /// built-in search tree, building the graph costs more than it saves for
+  /// clouds of kPrevFrameDownsample points, so this is off by default.
+  bool kCoherentNNSearch;
+
+  /// Number of neighbors of each previous point in the neighbor graph.
+  /// Larger graphs cost more to build but let more walks be verified.
+  int kNeighborGraphSize;
+
+  /// The walks are only tried once the sampling resolution is at most this
+  /// (in meters).  At coarser resolutions, the translations are too far
+  /// apart for the previous nearest neighbor to be a useful start.
+  double kCoherentNNMaxResolution;
+
   /// Whether to use two colors in our measurement model.
   bool kTwoColors;
 
@@ -173,11 +224,38 @@ struct Params
   /// very slow!
   bool useColor;
 
+  /// When using color, whether to store the colors of the previous points in
+  /// a density grid (mean and spread per cell) instead of searching for the
+  /// nearest neighbor of each point.  This is much faster but only handles
+  /// translations in x and y, and blurs colors within each grid cell.
+  bool kUseColorGrid;
+
   // Whether to track the full 3D point cloud or a 2D projection.  Tracking with
   // the full 3D point cloud is more accurate but uses much more memory,
   // due to our caching scheme.
   bool use3D;
 
+  /// If use3D is not set, whether to also store the heights of the points in
+  /// each cell of the 2D projection (2.5D).  This is nearly as fast and as
+  /// small as tracking the 2D projection, but does not match points that
+  /// are at the wrong height, e.g. under the trailer of a truck.
+  bool use25D;
+
+  /// If positive and a richer evaluator than the 2D density grid is used
+  /// (color, 3D or 2.5D), the annealing levels with an xy sampling
+  /// resolution coarser than this (in meters) are scored with the 2D density
+  /// grid.  At these levels sigma is inflated and color matches are
+  /// downweighted, so the richer evaluators add little.  Set to 0 to use the
+  /// same evaluator at every level.
+  double kCascadeResolution;
+
+  /// If positive and the 2D density grid is used, objects whose down-sampled
+  /// previous frame has at most this many points, and that fit in a
+  /// DensityGridSmallEvaluator grid at the finest sampling resolution, are
+  /// scored with DensityGridSmallEvaluator, which has less overhead per
+  /// object.
+  int kSmallObjectMaxPoints;
+
   /// We downsample the current frame of the tracked object to have this many
   /// points.
   int kCurrFrameDownsample;
@@ -199,6 +277,52 @@ struct Params
   /// Do not sample in the z-direction - assume minimal vertical motion.
   double kInitialZSamplingResolution;
 
+  /// Set this to choose the initial xy sampling resolution for each object
+  /// (instead of kInitialXYSamplingResolution) so that the first level of
+  /// the search samples about this many xy positions.  The resolution is
+  /// chosen to be kInitialXYSamplingResolution times a power of
+  /// kReductionFactor, so the levels are at the same resolutions as without
+  /// this setting and the last level is just as fine.
+  /// kInitialZSamplingResolution is scaled by the same factor.
+  int kTargetInitialCandidates;
+
+  /// Whether to profile each stage of the precision tracker with hardware
+  /// performance counters (Linux only).  Each stage is timed either way
+  /// when this is enabled; the counters are skipped if the kernel does not
+  /// allow access to them.
+  bool profileStages;
+
+  /// @}
+
+
+
+  /// @{ Segmented tracker section
+
+  /// Number of frames in each segment when splitting a long recorded track
+  /// to track it in parallel.
+  int kSegmentLength;
+
+  /// Number of frames before each segment that are tracked only to
+  /// initialize the motion model; their estimates are discarded.  At least
+  /// one frame is used, since the first frame of a segment has no estimate.
+  int kSegmentBurnIn;
+
+  /// @}
+
+
+
+  /// @{ Association section
+
+  /// Segments whose centroid is farther than this from the predicted
+  /// centroid of a track (in meters, in the xy plane) are not considered
+  /// for association with that track.
+  double kAssociationGateRadius;
+
+  /// Each candidate pair is scored with translations of up to this distance
+  /// (in meters) from the alignment of the centroids, sampled at
+  /// kInitialXYSamplingResolution.
+  double kAssociationSearchRadius;
+
   /// @}
 
 
@@ -208,6 +332,7 @@ struct Params
   {
     // Tracker section
     useMean = true;
+    kDormantMissedFrames = 10;
 
     // ADH tracker section
     kMinResFactor = 1;
@@ -215,6 +340,12 @@ struct Params
     kReductionFactor = 3;
     kMaxNumTransforms = 0;
     kMinProb = 0.0001;
+    kMaxTransformsPerLevel = 0;
+
+    // Particle tracker section
+    useParticleTracker = false;
+    kNumParticles = 200;
+    kNumParticleRounds = 4;
 
     // Alignment evaluator section
     kSigmaFactor = 0.5;
@@ -235,6 +366,9 @@ struct Params
 
     // lg rgbd 6d evaluator section
     kSearchTreeEpsilon = 2;
+    kCoherentNNSearch = false;
+    kNeighborGraphSize = 16;
+    kCoherentNNMaxResolution = 0.2;
     kTwoColors = false;
     kValueSigma1 = 13.9;
     kValueSigma2 = 15.2;
@@ -251,7 +385,11 @@ struct Params
 
     // Precision tracker section
     useColor = false;
+    kUseColorGrid = false;
     use3D = false;
+    use25D = false;
+    kCascadeResolution = 0;
+    kSmallObjectMaxPoints = 0;
     kCurrFrameDownsample = 150;
     kPrevFrameDownsample = 2000;
     stochastic_downsample = false;
@@ -259,6 +397,16 @@ struct Params
                 // in urban settings, the vertical motion is small).
     kInitialXYSamplingResolution = 1;
     kInitialZSamplingResolution = 0;
+    kTargetInitialCandidates = 0;
+    profileStages = false;
+
+    // Segmented tracker section
+    kSegmentLength = 40;
+    kSegmentBurnIn = 5;
+
+    // Association section
+    kAssociationGateRadius = 3;
+    kAssociationSearchRadius = 1;
   }
 };
 
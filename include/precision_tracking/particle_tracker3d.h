@@ -0,0 +1,115 @@
+/*
+ * particle_tracker3d.h
+ *
+ *      Author: davheld
+ *
+ * An alternative to the annealed dynamic histogram tracker with a fixed
+ * cost.  ADHTracker3d subdivides every cell whose probability exceeds
+ * kMinProb, so its cost depends on how ambiguous the alignment is.  This
+ * tracker instead scores kNumParticles candidate transforms in each of
+ * kNumParticleRounds rounds: the first round is drawn from the motion model
+ * (and uniformly from the search range), and each later round resamples the
+ * previous one in proportion to its probability and jitters the samples at
+ * a finer sampling resolution.  The transforms of the last round are
+ * returned with importance weights, in the same form as the output of
+ * ADHTracker3d, so that the motion model can use them unchanged.
+ *
+ */
+
+#ifndef __PRECISION_TRACKING__PARTICLE_TRACKER3D_H
+#define __PRECISION_TRACKING__PARTICLE_TRACKER3D_H
+
+#include <vector>
+
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include <precision_tracking/alignment_evaluator.h>
+#include <precision_tracking/motion_model.h>
+#include <precision_tracking/perf_counters.h>
+#include <precision_tracking/scored_transform.h>
+#include <precision_tracking/params.h>
+
+namespace precision_tracking {
+
+class ParticleTracker3d {
+public:
+  explicit ParticleTracker3d(const Params *params);
+
+  // Estimate the posterior distribution over alignments in the range
+  // xRange, yRange, zRange, with the same arguments as ADHTracker3d::track.
+  // The sampling resolution goes from initial_xy_sampling_resolution to the
+  // minimum sampling resolution of ADHTracker3d over the rounds.
+  void track(
+      const double initial_xy_sampling_resolution,
+      const double initial_z_sampling_resolution,
+      const std::pair <double, double>& xRange,
+      const std::pair <double, double>& yRange,
+      const std::pair <double, double>& zRange,
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& prev_points,
+      const Eigen::Vector3f& current_points_centroid,
+      const MotionModel& motion_model,
+      const double xy_sensor_resolution,
+      const double z_sensor_resolution,
+      boost::shared_ptr<AlignmentEvaluator> alignment_evaluator,
+      boost::shared_ptr<AlignmentEvaluator> coarse_alignment_evaluator,
+      ScoredTransforms<ScoredTransformXYZ>* scored_transforms);
+
+  // Profile the scoring of the particles in scoring_profile, as in
+  // ADHTracker3d::setScoringProfile.
+  void setScoringProfile(StageProfile* scoring_profile,
+                         const PerfCounters* perf_counters) {
+    scoring_profile_ = scoring_profile;
+    perf_counters_ = perf_counters;
+  }
+
+  size_t memoryUsage() const {
+    return sizeof(*this) +
+        (particles_.capacity() + parents_.capacity()) * sizeof(XYZTransform) +
+        log_proposal_probs_.capacity() * sizeof(double) +
+        parent_counts_.capacity() * sizeof(int);
+  }
+
+private:
+  // Draw the first round of particles from a mixture of the motion model
+  // and a uniform distribution over the search range, setting the log
+  // probability density of the mixture at each particle.
+  void sampleInitialParticles(
+      const std::pair <double, double>& xRange,
+      const std::pair <double, double>& yRange,
+      const std::pair <double, double>& zRange,
+      const bool sample_z,
+      const MotionModel& motion_model);
+
+  // Resample the particles in proportion to their probabilities and jitter
+  // them by a Gaussian with the given standard deviations, setting the log
+  // probability density of the proposal at each new particle.
+  void resampleParticles(
+      const ScoredTransforms<ScoredTransformXYZ>& scored_particles,
+      const double xy_jitter, const double z_jitter, const bool sample_z);
+
+  const Params *params_;
+
+  boost::mt19937 rng_;
+
+  StageProfile* scoring_profile_;
+  const PerfCounters* perf_counters_;
+
+  // The particles of the current round, and the log probability density of
+  // the distribution that each was drawn from.
+  std::vector<XYZTransform> particles_;
+  std::vector<double> log_proposal_probs_;
+
+  // Scratch space for resampling: the distinct particles that were drawn
+  // and the number of times that each was drawn.
+  std::vector<XYZTransform> parents_;
+  std::vector<int> parent_counts_;
+};
+
+} // namespace precision_tracking
+
+#endif // __PRECISION_TRACKING__PARTICLE_TRACKER3D_H
@@ -0,0 +1,107 @@
+/*
+ * perf_counters.h
+ *
+ *      Author: davheld
+ *
+ * Hardware performance counters (cycles, instructions, last-level cache
+ * misses and branch misses) for profiling the stages of the tracker, using
+ * the Linux perf_event_open interface.  On other platforms, or if the
+ * kernel does not allow access to the counters, the counters are reported
+ * as unavailable and only the elapsed time of each stage is recorded.
+ *
+ */
+
+#ifndef __PRECISION_TRACKING__PERF_COUNTERS_H
+#define __PRECISION_TRACKING__PERF_COUNTERS_H
+
+#include <stdint.h>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <precision_tracking/cycle_timer.h>
+
+namespace precision_tracking {
+
+// Hardware event counts for a piece of code.
+struct PerfCounts {
+  PerfCounts()
+    : cycles(0), instructions(0), cache_misses(0), branch_misses(0)
+  {
+  }
+
+  void add(const PerfCounts& other) {
+    cycles += other.cycles;
+    instructions += other.instructions;
+    cache_misses += other.cache_misses;
+    branch_misses += other.branch_misses;
+  }
+
+  uint64_t cycles;
+  uint64_t instructions;
+  uint64_t cache_misses;
+  uint64_t branch_misses;
+};
+
+// A group of hardware counters which count events in the thread that
+// created them.
+class PerfCounters : private boost::noncopyable {
+public:
+  PerfCounters();
+  ~PerfCounters();
+
+  // Whether the counters could be opened.
+  bool valid() const { return group_fd_ >= 0; }
+
+  // Read the total counts since the counters were opened.  Returns false
+  // if the counters are not valid.
+  bool read(PerfCounts* counts) const;
+
+private:
+  enum { kNumEvents = 4 };
+
+  // The first counter is the group leader; all counters are read at once
+  // through the leader.
+  int group_fd_;
+  int fds_[kNumEvents];
+};
+
+// The time and hardware events spent in one stage of the tracker,
+// accumulated over many calls.
+class StageProfile {
+public:
+  explicit StageProfile(const std::string& name);
+
+  // Start and stop timing this stage.  The counters may be NULL (or
+  // invalid), in which case only the elapsed time is recorded.
+  void start(const PerfCounters* counters);
+  void stop(const PerfCounters* counters);
+
+  // Add the results of another profile of the same stage, e.g. from a
+  // different thread.
+  void add(const StageProfile& other);
+
+  void reset();
+
+  const std::string& getName() const { return name_; }
+  const CycleTimer& getTimer() const { return timer_; }
+  const PerfCounts& getCounts() const { return counts_; }
+
+  // Whether the hardware counts are valid.
+  bool hasCounts() const { return has_counts_; }
+
+  std::string report() const;
+  void print() const;
+
+private:
+  std::string name_;
+  CycleTimer timer_;
+  PerfCounts counts_;
+  PerfCounts start_counts_;
+  bool has_counts_;
+  bool counting_;
+};
+
+} // namespace precision_tracking
+
+#endif // __PRECISION_TRACKING__PERF_COUNTERS_H
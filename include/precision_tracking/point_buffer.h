@@ -0,0 +1,77 @@
+/*
+ * point_buffer.h
+ *
+ *      Author: davheld
+ *
+ * A view of points that are stored by the caller rather than in a
+ * pcl::PointCloud, e.g. in one array per coordinate (structure of arrays)
+ * or in an array of the caller's own point structs.  The points are read
+ * through strided pointers, so that they can be passed to
+ * Tracker::addPoints without first being copied into a cloud.
+ *
+ */
+
+#ifndef __PRECISION_TRACKING__POINT_BUFFER_H
+#define __PRECISION_TRACKING__POINT_BUFFER_H
+
+#include <cstddef>
+
+#include <stdint.h>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+namespace precision_tracking {
+
+struct PointBuffer {
+  // Points with coordinates x[i * xyz_stride], y[i * xyz_stride] and
+  // z[i * xyz_stride], where the stride is in bytes, e.g. sizeof(float) for
+  // separate arrays of coordinates.  The points have no color.
+  PointBuffer(const float* x, const float* y, const float* z,
+              const size_t xyz_stride, const size_t num_points)
+    : x(x), y(y), z(z), xyz_stride(xyz_stride),
+      r(NULL), g(NULL), b(NULL), color_stride(0),
+      num_points(num_points)
+  {
+  }
+
+  // Set the colors of the points to r[i * color_stride], g[i * color_stride]
+  // and b[i * color_stride], where the stride is in bytes.
+  void setColors(const uint8_t* r, const uint8_t* g, const uint8_t* b,
+                 const size_t color_stride) {
+    this->r = r;
+    this->g = g;
+    this->b = b;
+    this->color_stride = color_stride;
+  }
+
+  bool hasColors() const { return r != NULL; }
+
+  size_t size() const { return num_points; }
+
+  // Copy the points into a cloud, reusing its allocation.  Points without
+  // color are black.
+  void copyTo(pcl::PointCloud<pcl::PointXYZRGB>* cloud) const;
+
+  // Copy the points into separate arrays of size() values each.  Points
+  // without color are black.
+  void copyTo(float* x_out, float* y_out, float* z_out,
+              uint8_t* r_out, uint8_t* g_out, uint8_t* b_out) const;
+
+  const float* x;
+  const float* y;
+  const float* z;
+  size_t xyz_stride;
+
+  // NULL if the points have no color.
+  const uint8_t* r;
+  const uint8_t* g;
+  const uint8_t* b;
+  size_t color_stride;
+
+  size_t num_points;
+};
+
+} // namespace precision_tracking
+
+#endif // __PRECISION_TRACKING__POINT_BUFFER_H
@@ -11,6 +11,8 @@
 #ifndef __PRECISION_TRACKING__PRECISION_TRACKER_H_
 #define __PRECISION_TRACKING__PRECISION_TRACKER_H_
 
+#include <vector>
+
 #include <pcl/point_types.h>
 #include <pcl/point_cloud.h>
 
@@ -18,10 +20,34 @@
 #include <precision_tracking/motion_model.h>
 #include <precision_tracking/adh_tracker3d.h>
 #include <precision_tracking/down_sampler.h>
+#include <precision_tracking/particle_tracker3d.h>
+#include <precision_tracking/perf_counters.h>
 #include <precision_tracking/params.h>
 
 namespace precision_tracking {
 
+// Identifies a frame of a tracked object.  Each alignment down-samples the
+// larger of its two frames as the model, and when the number of points
+// fluctuates the same frame can be the model of two alignments in a row
+// (first as the current frame, then as the previous frame).  Frames with a
+// negative track_id are never reused, since the frames of different objects
+// could not be told apart.
+struct FrameKey {
+  FrameKey(const int track_id, const double timestamp, const size_t num_points)
+    : track_id(track_id), timestamp(timestamp), num_points(num_points)
+  {
+  }
+
+  bool operator==(const FrameKey& other) const {
+    return track_id == other.track_id && timestamp == other.timestamp &&
+        num_points == other.num_points;
+  }
+
+  int track_id;
+  double timestamp;
+  size_t num_points;
+};
+
 class PrecisionTracker {
 public:
   explicit PrecisionTracker(const Params *params);
@@ -36,7 +62,66 @@ public:
       const MotionModel& motion_model,
       ScoredTransforms<ScoredTransformXYZ>* scored_transforms);
 
+  // As above, but previousModel is the frame identified by model_key.  The
+  // down-sampled model and the index that the alignment evaluator builds
+  // for it (e.g. the search tree) are kept until the next call, and are
+  // reused if the next call has the same model_key.  The frame had
+  // model_key.num_points points when it was observed, which sets the
+  // effective sensor resolution; previousModel may hold fewer if it was
+  // already down-sampled (e.g. by a dormant tracker).
+  void track(
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& previousModel,
+      const FrameKey& model_key,
+      const double sensor_horizontal_resolution,
+      const double sensor_vertical_resolution,
+      const MotionModel& motion_model,
+      ScoredTransforms<ScoredTransformXYZ>* scored_transforms);
+
+  const ADHTracker3d& get_adh_tracker3d() const {
+    return adh_tracker3d_;
+  }
+
+  // The stages of track() that are profiled if params->profileStages is set.
+  // Scoring is the part of the alignment spent scoring candidate transforms
+  // with the alignment evaluators; the rest of the alignment is spent
+  // generating and refining the candidates.
+  enum Stage {
+    kRangeEstimation,
+    kDownSampling,
+    kAlignment,
+    kScoring,
+    kNumStages
+  };
+
+  // Profiles of each stage, indexed by Stage, accumulated over all calls
+  // to track().
+  const std::vector<StageProfile>& get_stage_profiles() const {
+    return stage_profiles_;
+  }
+
+  // Approximate number of bytes held by this tracker, including the
+  // alignment evaluator.
+  size_t memoryUsage() const;
+
 private:  
+  void startStage(const Stage stage);
+  void stopStage(const Stage stage);
+
+  // Track, reusing the down-sampled model if model_key matches the cached
+  // model (model_key may be NULL).  prev_num_points is the number of points
+  // of the previous frame before any down-sampling.
+  void trackModel(
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& prev_points,
+      const size_t prev_num_points,
+      const FrameKey* model_key,
+      const double sensor_horizontal_resolution_actual,
+      const double sensor_vertical_resolution_actual,
+      const MotionModel& motion_model,
+      ScoredTransforms<ScoredTransformXYZ>* scored_transforms);
+
+
   void estimateRange(
       const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
       const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& prev_points,
@@ -44,6 +129,19 @@ private:
       std::pair <double, double>* yRange,
       std::pair <double, double>* zRange) const;
 
+  // The minimum xy sampling resolution of the search (see ADHTracker3d).
+  double computeMinXYSamplingResolution(
+      const double xy_sensor_resolution) const;
+
+  // Choose the initial sampling resolution for the search range, which is
+  // params->kInitialXYSamplingResolution unless
+  // params->kTargetInitialCandidates is set.
+  void computeInitialSamplingResolution(
+      const std::pair <double, double>& xRange,
+      const std::pair <double, double>& yRange,
+      double* initial_xy_sampling_resolution,
+      double* initial_z_sampling_resolution) const;
+
   Eigen::Matrix4f estimateAlignmentCentroidDiff(
       const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& curr_points,
       const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& prev_points) const;
@@ -51,8 +149,28 @@ private:
   const Params *params_;
 
   ADHTracker3d adh_tracker3d_;
+  ParticleTracker3d particle_tracker3d_;
   boost::shared_ptr<AlignmentEvaluator> alignment_evaluator_;
+
+  // Scores the coarse annealing levels if params->kCascadeResolution is set.
+  boost::shared_ptr<AlignmentEvaluator> coarse_alignment_evaluator_;
+
+  // Scores small objects if params->kSmallObjectMaxPoints is set.
+  boost::shared_ptr<AlignmentEvaluator> small_alignment_evaluator_;
   DownSampler down_sampler_;
+
+  // The down-sampled model of the last call to track() with a FrameKey.
+  // The alignment evaluator stays bound to these points, so passing them
+  // again does not rebuild its index.
+  pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr cached_model_;
+  FrameKey cached_model_key_;
+
+  std::vector<StageProfile> stage_profiles_;
+
+  // Hardware counters for the thread that is running the tracker; these are
+  // opened on the first call to track() so that they count the thread that
+  // actually does the tracking.
+  boost::shared_ptr<PerfCounters> perf_counters_;
 };
 
 } // namespace precision_tracking
@@ -0,0 +1,76 @@
+/*
+ * segmented_tracker.h
+ *
+ *      Author: davheld
+ *
+ * Offline tracking of recorded tracks, for processing logs.  A long track is
+ * split into segments which are tracked in parallel; each segment starts a
+ * few frames early to let the motion model converge (the burn-in), and the
+ * estimates for the burn-in frames are discarded when the segments are
+ * stitched back together.  This only applies when all frames of a track are
+ * available in advance; use Tracker to track objects online.
+ *
+ */
+
+#ifndef __PRECISION_TRACKING__SEGMENTED_TRACKER_H
+#define __PRECISION_TRACKING__SEGMENTED_TRACKER_H
+
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include <precision_tracking/params.h>
+#include <precision_tracking/precision_tracker.h>
+
+namespace precision_tracking {
+
+// A single recorded observation of a tracked object.
+struct TrackedFrame {
+  pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr cloud;
+  double timestamp;
+  double sensor_horizontal_resolution;
+  double sensor_vertical_resolution;
+};
+
+class SegmentedTracker {
+public:
+  // Creates one precision tracker per thread if use_precision_tracker is set;
+  // otherwise only the motion model (centroid-based Kalman filter) is used.
+  SegmentedTracker(const Params* params, const bool use_precision_tracker,
+                   const int num_threads);
+
+  // Estimates the velocity of the object in each frame of a recorded track.
+  // As with Tracker::addPoints, the velocity for the first frame is 0.
+  void track(const std::vector<TrackedFrame>& frames, const int track_id,
+             std::vector<Eigen::Vector3f>* estimated_velocities);
+
+  // The number of segments that a track with this many frames is split into.
+  int getNumSegments(const size_t num_frames) const;
+
+  const std::vector<boost::shared_ptr<PrecisionTracker> >&
+      get_precision_trackers() const {
+    return precision_trackers_;
+  }
+
+private:
+  // Track frames [begin, end) and save the estimates for the frames after
+  // the burn-in, starting at first_output.
+  void trackSegment(const std::vector<TrackedFrame>& frames,
+                    const size_t begin, const size_t first_output,
+                    const size_t end, const int track_id,
+                    const boost::shared_ptr<PrecisionTracker>& precision_tracker,
+                    std::vector<Eigen::Vector3f>* estimated_velocities) const;
+
+  const Params* params_;
+  int num_threads_;
+
+  // One precision tracker per thread.
+  std::vector<boost::shared_ptr<PrecisionTracker> > precision_trackers_;
+};
+
+} // namespace precision_tracking
+
+#endif // __PRECISION_TRACKING__SEGMENTED_TRACKER_H
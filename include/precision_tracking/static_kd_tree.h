@@ -0,0 +1,88 @@
+/*
+ * static_kd_tree.h
+ *
+ *      Author: davheld
+ *
+ * A k-d tree for nearest neighbor searches in the small clouds that we
+ * align (a few thousand points).  The tree is implicit: node i has children
+ * 2i + 1 and 2i + 2, so only the split of each node is stored, and the
+ * points of each leaf are stored in a fixed-size bucket as separate x, y and
+ * z arrays, which the compiler can scan with SIMD instructions.  Rebuilding
+ * the tree reuses its memory, so that no memory is allocated once the tree
+ * has been built for the largest cloud.
+ *
+ */
+
+#ifndef __PRECISION_TRACKING__STATIC_KD_TREE_H
+#define __PRECISION_TRACKING__STATIC_KD_TREE_H
+
+#include <vector>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+namespace precision_tracking {
+
+class StaticKdTree {
+public:
+  StaticKdTree();
+
+  // Build the tree over the xyz coordinates of the points, in O(n log n).
+  void build(const pcl::PointCloud<pcl::PointXYZRGB>& points);
+
+  // Find the nearest point, returning its index in the cloud (or -1 if the
+  // tree is empty) and setting the squared distance to it.  If epsilon is
+  // greater than 0, the search is approximate: the distance to the returned
+  // point is at most (1 + epsilon) times the distance to the nearest point.
+  int nearestSearch(const pcl::PointXYZRGB& point, const float epsilon,
+                    float* sq_dist) const;
+
+  // Find the k nearest points exactly, sorted by increasing distance.
+  void nearestKSearch(const pcl::PointXYZRGB& point, const int k,
+                      std::vector<int>* indices,
+                      std::vector<float>* sq_dists) const;
+
+  size_t size() const { return num_points_; }
+
+  // Approximate number of bytes held by the tree.
+  size_t memoryUsage() const;
+
+private:
+  // Maximum number of points in each leaf.
+  static const int kBucketSize = 16;
+
+  // Recursively split the points [begin, end) of the permutation.
+  void buildNode(const pcl::PointCloud<pcl::PointXYZRGB>& points,
+                 const int node, const int begin, const int end);
+
+  // Compute the squared distances from (x, y, z) to the points in a leaf,
+  // returning the position of the nearest point in the leaf.
+  int scanLeaf(const int leaf, const float x, const float y, const float z,
+               float* sq_dists) const;
+
+  size_t num_points_;
+
+  // The number of leaves is a power of 2, so the first num_leaves_ - 1
+  // nodes are internal nodes and the rest are leaves.
+  int num_leaves_;
+
+  // The dimension and value at which each internal node is split.  Points
+  // on the split go to either side.
+  std::vector<unsigned char> split_dims_;
+  std::vector<float> split_values_;
+
+  // The coordinates and cloud indices of the points, in buckets of
+  // kBucketSize per leaf.  Unused slots hold points far away from any
+  // query, with an index of -1.
+  std::vector<float> xs_;
+  std::vector<float> ys_;
+  std::vector<float> zs_;
+  std::vector<int> indices_;
+
+  // Scratch space for building the tree.
+  std::vector<int> permutation_;
+};
+
+} // namespace precision_tracking
+
+#endif // __PRECISION_TRACKING__STATIC_KD_TREE_H
@@ -0,0 +1,136 @@
+/*
+ * sweep_ring.h
+ *
+ *      Author: davheld
+ *
+ * A ring buffer in POSIX shared memory (see shm_open) for passing the
+ * segmented objects of each sweep from a segmentation process to the
+ * tracking process without serializing them.  The tracking process creates
+ * the ring with SweepRingConsumer, and the segmentation process opens it by
+ * name with SweepRingProducer.  Each slot of the ring holds one sweep; the
+ * producer writes the points of each object into the slot as separate
+ * arrays of coordinates, and the consumer reads them in place as
+ * PointBuffers, which can be passed directly to Tracker::addPoints.
+ *
+ * There is exactly one producer and one consumer, so the ring needs no
+ * locks: the producer only advances the count of written sweeps, and the
+ * consumer only advances the count of released sweeps.
+ *
+ */
+
+#ifndef __PRECISION_TRACKING__SWEEP_RING_H
+#define __PRECISION_TRACKING__SWEEP_RING_H
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+#include <precision_tracking/point_buffer.h>
+
+namespace precision_tracking {
+
+struct SweepRingHeader;
+
+// An object of a sweep, as read from the ring.  The points stay valid until
+// the sweep is released.
+struct RingObject {
+  explicit RingObject(const PointBuffer& points)
+    : track_id(-1),
+      timestamp(0),
+      sensor_horizontal_resolution(0),
+      sensor_vertical_resolution(0),
+      points(points)
+  {
+  }
+
+  int track_id;
+  double timestamp;
+  double sensor_horizontal_resolution;
+  double sensor_vertical_resolution;
+  PointBuffer points;
+};
+
+// A sweep, as read from the ring.
+struct RingSweep {
+  // The time at which the sweep started.
+  double timestamp;
+  std::vector<RingObject> objects;
+};
+
+class SweepRingConsumer {
+public:
+  // Create a ring with num_slots slots of slot_size bytes each, replacing
+  // any ring with the same name.  The name is removed again when the
+  // consumer is destroyed.
+  SweepRingConsumer(const std::string& name, const size_t num_slots,
+                    const size_t slot_size);
+  ~SweepRingConsumer();
+
+  // Read the oldest sweep that has not been released, or return false if
+  // the producer has not written a new sweep.  The sweep must be released
+  // with releaseSweep before the next one is read.
+  bool readSweep(RingSweep* sweep);
+
+  // Return the slot of the sweep that was read to the producer.
+  void releaseSweep();
+
+  // Whether the producer has closed the ring.  Sweeps that were written
+  // before the ring was closed can still be read, so check this before
+  // calling readSweep.
+  bool isClosed() const;
+
+private:
+  // Not copyable, since the mapping is released by the destructor.
+  SweepRingConsumer(const SweepRingConsumer&);
+  SweepRingConsumer& operator=(const SweepRingConsumer&);
+
+  std::string name_;
+  SweepRingHeader* header_;
+  size_t mapped_size_;
+  bool reading_;
+};
+
+class SweepRingProducer {
+public:
+  // Open the ring that a SweepRingConsumer created with the given name.
+  explicit SweepRingProducer(const std::string& name);
+  ~SweepRingProducer();
+
+  // Start writing a sweep that started at the given time into the next
+  // free slot.  Returns false if every slot holds a sweep that the consumer
+  // has not released yet, in which case the sweep can be dropped or retried
+  // later.
+  bool beginSweep(const double timestamp);
+
+  // Add an object that was observed at the given time to the sweep.
+  // Returns false (without adding the object) if the rest of the slot is
+  // too small for its points.
+  bool addObject(const int track_id,
+                 const double timestamp,
+                 const double sensor_horizontal_resolution,
+                 const double sensor_vertical_resolution,
+                 const PointBuffer& points);
+
+  // Make the sweep visible to the consumer.
+  void commitSweep();
+
+  // Tell the consumer that no more sweeps will be written.
+  void close();
+
+private:
+  // Not copyable, since the mapping is released by the destructor.
+  SweepRingProducer(const SweepRingProducer&);
+  SweepRingProducer& operator=(const SweepRingProducer&);
+
+  SweepRingHeader* header_;
+  size_t mapped_size_;
+
+  // The slot of the sweep that is being written, or NULL.
+  char* slot_;
+  size_t slot_bytes_used_;
+};
+
+} // namespace precision_tracking
+
+#endif // __PRECISION_TRACKING__SWEEP_RING_H
@@ -0,0 +1,89 @@
+/*
+ * trace_recorder.h
+ *
+ *      Author: davheld
+ *
+ * Records begin / end events of the stages of the tracker and exports them
+ * in the Chrome trace event JSON format, which can be loaded into
+ * chrome://tracing or the Perfetto UI (ui.perfetto.dev) to view the
+ * timeline of each thread.
+ *
+ * Each thread records into its own buffer without locking; a lock is only
+ * taken the first time a thread records an event, to register its buffer.
+ * When recording is disabled (the default), each event costs a single
+ * check of a flag.
+ *
+ */
+
+#ifndef __PRECISION_TRACKING__TRACE_RECORDER_H
+#define __PRECISION_TRACKING__TRACE_RECORDER_H
+
+#include <string>
+
+namespace precision_tracking {
+
+class TraceRecorder {
+public:
+  // Start recording events.  Previously recorded events are kept.
+  static void enable();
+
+  // Stop recording events.
+  static void disable();
+
+  static bool isEnabled() { return enabled_; }
+
+  // Record a begin ('B') or end ('E') event for the calling thread.  The name
+  // must point to a string that outlives the recorder (e.g. a literal).
+  // Negative ids, levels and counts are omitted from the output.
+  static void record(const char* name, const char phase, const int track_id,
+                     const int level, const int num_candidates);
+
+  // Write all recorded events to a file in the Chrome trace event format.
+  // This must not be called while other threads are recording events.
+  static bool writeChromeTrace(const std::string& filename);
+
+  // Discard all recorded events.  This must not be called while other
+  // threads are recording events.
+  static void clear();
+
+private:
+  static bool enabled_;
+};
+
+// Records a begin event on construction and the matching end event on
+// destruction.  Nested events inherit the track id and annealing level of
+// the enclosing event if they are not given.
+class ScopedTraceEvent {
+public:
+  explicit ScopedTraceEvent(const char* name, const int track_id = -1,
+                            const int level = -1,
+                            const int num_candidates = -1)
+    : name_(name),
+      active_(TraceRecorder::isEnabled())
+  {
+    if (active_) {
+      begin(track_id, level, num_candidates);
+    }
+  }
+
+  ~ScopedTraceEvent() {
+    if (active_) {
+      end();
+    }
+  }
+
+private:
+  void begin(const int track_id, const int level, const int num_candidates);
+  void end();
+
+  const char* name_;
+  bool active_;
+
+  // The context of the enclosing event, restored when this event ends.
+  int prev_track_id_;
+  int prev_level_;
+};
+
+} // namespace precision_tracking
+
+#endif // __PRECISION_TRACKING__TRACE_RECORDER_H
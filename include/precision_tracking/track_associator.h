@@ -0,0 +1,81 @@
+/*
+ * track_associator.h
+ *
+ *      Author: davheld
+ *
+ * Helps to associate the segments observed in a frame with existing tracks
+ * without running a full alignment for every (track, segment) pair.  The
+ * predicted positions of the tracks are stored in a spatial hash to find the
+ * segments that are close enough to each track (gating), and each remaining
+ * pair is scored with a cheap alignment at the coarsest sampling resolution
+ * (several pairs at a time, with DensityGridSmallBatch).  The full alignment
+ * (Tracker::addPoints) then only needs to run for the chosen pairs.
+ *
+ */
+
+#ifndef __PRECISION_TRACKING__TRACK_ASSOCIATOR_H
+#define __PRECISION_TRACKING__TRACK_ASSOCIATOR_H
+
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+#include <precision_tracking/density_grid_2d_evaluator.h>
+#include <precision_tracking/density_grid_small_batch.h>
+#include <precision_tracking/params.h>
+#include <precision_tracking/segmented_tracker.h>
+#include <precision_tracking/tracker.h>
+
+namespace precision_tracking {
+
+// A (track, segment) pair that passed the gating.
+struct AssociationCandidate {
+  int track_index;
+  int segment_index;
+
+  // Log-likelihood of the coarse alignment of the segment to the previous
+  // points of the track, including the motion model, averaged over the
+  // (down-sampled) points of the segment so that segments of different sizes
+  // can be compared.  Higher is better.
+  double score;
+};
+
+class TrackAssociator {
+public:
+  explicit TrackAssociator(const Params* params);
+
+  // Find the segments within kAssociationGateRadius of the predicted centroid
+  // of each track at the time of the segment, and score each such pair.
+  // Tracks that have not been observed yet are never candidates.  Each track
+  // is scored from its state as of its last alignment: dormant trackers stay
+  // dormant and deferred frames are not aligned.
+  void scoreCandidates(
+      const std::vector<boost::shared_ptr<Tracker> >& trackers,
+      const std::vector<TrackedFrame>& segments,
+      std::vector<AssociationCandidate>* candidates);
+
+  // Assign each segment to at most one track and each track to at most one
+  // segment, greedily in descending order of score.  On return,
+  // (*track_indices)[i] is the index of the track for segment i, or -1 if no
+  // track passed the gating (e.g. for a new object).
+  void associate(
+      const std::vector<boost::shared_ptr<Tracker> >& trackers,
+      const std::vector<TrackedFrame>& segments,
+      std::vector<int>* track_indices);
+
+  // Approximate number of bytes held by the associator.
+  size_t memoryUsage() const;
+
+private:
+  const Params* params_;
+
+  DensityGrid2dEvaluator alignment_evaluator_;
+
+  // Scores the pairs whose points fit in a small density grid (almost all
+  // of them, at the coarsest sampling resolution) several at a time.
+  DensityGridSmallBatch batch_;
+};
+
+} // namespace precision_tracking
+
+#endif // __PRECISION_TRACKING__TRACK_ASSOCIATOR_H
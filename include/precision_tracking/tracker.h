@@ -12,10 +12,14 @@
 #ifndef __PRECISION_TRACKING__TRACKER_H_
 #define __PRECISION_TRACKING__TRACKER_H_
 
+#include <iostream>
+#include <string>
+
 #include <pcl/point_types.h>
 #include <pcl/point_cloud.h>
 
 #include <precision_tracking/motion_model.h>
+#include <precision_tracking/point_buffer.h>
 #include <precision_tracking/precision_tracker.h>
 #include <precision_tracking/params.h>
 
@@ -47,30 +51,213 @@ public:
       Eigen::Vector3f* estimated_velocity,
       double* alignment_probability);
 
+  // Same as above, but the points are read from the caller's buffers.  The
+  // points are copied once into a cloud that the tracker keeps from frame to
+  // frame, which becomes the previous points after the alignment, so no
+  // cloud needs to be allocated for each frame.  The buffers can be reused
+  // as soon as this function returns, even if the alignment is deferred.
+  void addPoints(
+      const PointBuffer& current_points,
+      const double current_timestamp,
+      const double sensor_horizontal_resolution,
+      const double sensor_vertical_resolution,
+      Eigen::Vector3f* estimated_velocity);
+
+  void addPoints(
+      const PointBuffer& current_points,
+      const double current_timestamp,
+      const double sensor_horizontal_resolution,
+      const double sensor_vertical_resolution,
+      Eigen::Vector3f* estimated_velocity,
+      double* alignment_probability);
+
   const Eigen::Matrix3d get_covariance_velocity() const {
+    updateState();
     return motion_model_->get_covariance_velocity();
   }
 
     Eigen::Vector3d get_mean_delta_position() const {
+        updateState();
         return motion_model_->get_mean_delta_position();
   }
 
   const Eigen::Matrix3d get_covariance_delta_position() const {
+    updateState();
     return motion_model_->get_covariance_delta_position();
   }
 
   const MotionModel & get_motion_model() const {
+    updateState();
     return *motion_model_;
   }
 
+  // The points of the most recently aligned frame, or no points if the
+  // object has not been observed yet.  These are overwritten by the next
+  // alignment.
+  pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr get_previous_points() const {
+    updateState();
+    return previousModel_;
+  }
+
+  // The time of the most recently aligned frame.
+  double get_prev_timestamp() const {
+    updateState();
+    return prev_timestamp_;
+  }
+
+  // The velocity estimated for the most recent frame, as returned by
+  // addPoints.
+  Eigen::Vector3f getEstimatedVelocity() const {
+    updateState();
+    return estimated_velocity_;
+  }
+
+  // The state as of the last alignment, for code that only inspects the
+  // tracker (e.g. TrackAssociator).  Unlike the functions above, these do
+  // not wake a dormant tracker or align a deferred frame, so they are cheap
+  // and do not change the tracker.  A dormant tracker has no previous points
+  // or motion model here (peek_motion_model returns NULL); use
+  // unpackDormantState to read them.
+  pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr peek_previous_points() const {
+    return previousModel_;
+  }
+  size_t peek_previous_num_points() const { return previous_num_points_; }
+  double peek_prev_timestamp() const { return prev_timestamp_; }
+  const MotionModel* peek_motion_model() const { return motion_model_.get(); }
+
+  // Restore the packed state of a dormant tracker into *tracker, which
+  // shares nothing with this tracker, while this tracker stays dormant.
+  // Returns false if this tracker is not dormant.
+  bool unpackDormantState(Tracker* tracker) const;
+
+  // When deferred alignment is enabled, addPoints only records each frame
+  // and returns the velocity from the last alignment; the alignment of the
+  // most recent frame runs when its velocity or motion model is requested
+  // by one of the functions above, or when alignDeferredFrame is called (for
+  // example in a batch for all objects in parallel).  If more frames are
+  // added before the alignment runs, the frames in between are skipped and
+  // the most recent frame is aligned directly to the last aligned frame.
+  // The points passed to addPoints are not copied until they are aligned,
+  // so they must not be modified in the meantime.
+  void setDeferredAlignment(const bool deferred_alignment);
+
+  bool hasDeferredFrame() const { return deferred_frame_.points.get() != NULL; }
+
+  // Align the deferred frame, if any.  This is not thread-safe, even when
+  // called through the const functions above.
+  void alignDeferredFrame() const;
+
+  // Number of frames that were skipped because a newer frame was added
+  // before they were aligned.
+  int get_num_skipped_frames() const { return num_skipped_frames_; }
+
+  // Call this function for each frame in which the object is not observed
+  // (e.g. while it is occluded).  After params->kDormantMissedFrames
+  // consecutive missed frames, the tracker becomes dormant.
+  void addMissedFrame();
+
+  // Compact the state of the tracker until the object is observed again,
+  // to bound the memory held by occluded objects: the previous points are
+  // down-sampled to the kPrevFrameDownsample points that the alignment
+  // uses, and the points and the motion model are packed in the format of
+  // serialize.  The state is restored on the next call to addPoints or to
+  // a function that reports it, such as get_motion_model.  The number of
+  // points that were observed is kept, so the restored tracker chooses the
+  // same model at the same effective resolution; only objects with more
+  // points than the alignment uses can get slightly different estimates.
+  void makeDormant();
+
+  bool isDormant() const { return !dormant_state_.empty(); }
+
+  // Number of consecutive frames in which the object was not observed.
+  int get_num_missed_frames() const { return num_missed_frames_; }
+
   void setPrecisionTracker(boost::shared_ptr<PrecisionTracker> precision_tracker) {
     precision_tracker_ = precision_tracker;
   }
 
+  // Set the id of the tracked object, which is used to label trace events.
+  void setTrackId(const int track_id) { track_id_ = track_id; }
+
+  // Approximate number of bytes held by this tracker: the previous points
+  // and the motion model.  The precision tracker is not included, since it
+  // is typically shared by many trackers; see PrecisionTracker::memoryUsage.
+  // Points and motion models that are shared with copies of this tracker
+  // are included here, but are only counted once in getMemoryUsage.
+  size_t memoryUsage() const;
+
+  // Write the state of the tracker in a compact binary format, so that it
+  // can be restored after a restart instead of starting again from an
+  // uninitialized motion model.  The previous points are down-sampled to at
+  // most max_num_points points, or omitted if max_num_points is 0, in which
+  // case the next frame after restoring only re-initializes them.  A deferred
+  // frame is not saved.  A dormant tracker is saved without restoring it.
+  // Returns false if the state could not be written, in which case part of
+  // it may have been written.
+  bool serialize(std::ostream& out, const int max_num_points) const;
+
+  // Restore a state written by serialize.  The precision tracker is not part
+  // of the state and is kept.  Returns false (leaving the tracker unchanged)
+  // if the stream does not contain a valid state.
+  bool deserialize(std::istream& istrm);
+
 private:
+  // Restore the state of a dormant tracker and align the deferred frame,
+  // if any, before the state is reported.
+  void updateState() const;
+
+  // Restore the state of a dormant tracker.
+  void wake() const;
+
+  // A frame whose alignment has been deferred.
+  struct DeferredFrame {
+    pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr points;
+    double timestamp;
+    double sensor_horizontal_resolution;
+    double sensor_vertical_resolution;
+  };
+
+  // Estimate the velocity from the current points and save them as the
+  // previous points.
+  void align(
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+      const double current_timestamp,
+      const double sensor_horizontal_resolution,
+      const double sensor_vertical_resolution);
+
   const Params *params_;
   pcl::PointCloud<pcl::PointXYZRGB>::Ptr previousModel_;
+
+  // The accounting of each cloud is shared along with the cloud by copies
+  // of this tracker, so that a shared cloud is only counted once.
+  boost::shared_ptr<TrackedMemory> previous_model_memory_;
+
+  // The number of points of the previous frame when it was observed.  This
+  // is more than previousModel_->size() if the points were down-sampled by
+  // serialize (e.g. while the tracker was dormant), and it is used in their
+  // place to choose the model and its effective resolution, so that waking
+  // a tracker does not change its estimates.
+  size_t previous_num_points_;
+
+  // The points of the last call to addPoints with a PointBuffer.  After the
+  // alignment, this cloud and the previous points are swapped rather than
+  // copied, so both allocations are reused.
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr input_points_;
+  boost::shared_ptr<TrackedMemory> input_points_memory_;
   double prev_timestamp_;
+  int track_id_;
+
+  Eigen::Vector3f estimated_velocity_;
+  double alignment_probability_;
+
+  bool deferred_alignment_;
+  DeferredFrame deferred_frame_;
+  int num_skipped_frames_;
+
+  // The packed state of a dormant tracker, or empty if the tracker is awake.
+  std::string dormant_state_;
+  TrackedMemory dormant_state_memory_;
+  int num_missed_frames_;
 
   boost::shared_ptr<MotionModel> motion_model_;
   boost::shared_ptr<PrecisionTracker> precision_tracker_;
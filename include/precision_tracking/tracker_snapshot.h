@@ -0,0 +1,48 @@
+/*
+ * tracker_snapshot.h
+ *
+ *      Author: davheld
+ *
+ * Save and restore the states of a set of trackers, so that a restarted
+ * process can continue tracking with converged motion models instead of
+ * starting every object from a flat prior.  A snapshot of a few hundred
+ * objects is small enough to be written every sweep.
+ *
+ */
+
+#ifndef __PRECISION_TRACKING__TRACKER_SNAPSHOT_H
+#define __PRECISION_TRACKING__TRACKER_SNAPSHOT_H
+
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+#include <precision_tracking/params.h>
+#include <precision_tracking/tracker.h>
+
+namespace precision_tracking {
+
+// Write the states of the trackers to a file, with the previous points of
+// each tracker down-sampled to at most max_num_points points (see
+// Tracker::serialize).  The snapshot is written to a temporary file which
+// then replaces the given file, so that the previous snapshot is kept if the
+// process stops while writing or if the state of a tracker cannot be saved
+// (in which case false is returned).
+bool saveTrackerSnapshot(
+    const std::string& filename,
+    const std::vector<boost::shared_ptr<Tracker> >& trackers,
+    const int max_num_points);
+
+// Restore the trackers from a snapshot written by saveTrackerSnapshot.  The
+// restored trackers use the given params and do not have a precision
+// tracker; call setPrecisionTracker on each of them.  The track ids are
+// restored and can be used to match the trackers to the tracked objects.
+bool loadTrackerSnapshot(
+    const std::string& filename,
+    const Params* params,
+    std::vector<boost::shared_ptr<Tracker> >* trackers);
+
+} // namespace precision_tracking
+
+#endif // __PRECISION_TRACKING__TRACKER_SNAPSHOT_H
@@ -0,0 +1,440 @@
+/*
+ * replay_tracking.cpp
+ *
+ *      Author: davheld
+ *
+ * Replays a recorded log in real time (or sped up by a constant factor) and
+ * measures whether the tracker keeps up with the sensor.  Objects are grouped
+ * into sweeps of kSweepPeriod seconds based on their timestamps; each sweep
+ * is released to the tracker when it would have arrived from the sensor, and
+ * we record whether tracking finished before the next sweep arrived.
+ *
+ */
+
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <map>
+#include <time.h>
+#include <errno.h>
+
+#include <boost/make_shared.hpp>
+
+#include <pcl/common/centroid.h>
+
+#include <precision_tracking/track_manager_color.h>
+#include <precision_tracking/tracker.h>
+#include <precision_tracking/memory_usage.h>
+#include <precision_tracking/motion_model_bank.h>
+#include <precision_tracking/sensor_specs.h>
+#include <precision_tracking/trace_recorder.h>
+
+using std::string;
+using std::vector;
+
+namespace {
+
+// The Velodyne spins at 10 Hz, so a new sweep arrives every 100 ms.
+const double kSweepPeriod = 0.1;
+
+// A single observation of one object.
+struct Observation {
+  int track_index;
+  int frame_index;
+  double timestamp;
+};
+
+bool compareObservations(const Observation& a, const Observation& b) {
+  return a.timestamp < b.timestamp;
+}
+
+// All of the objects observed within one sweep.
+struct Sweep {
+  // Time (in sensor time) at which this sweep started.
+  double start_time;
+
+  // Observations grouped by track, in timestamp order within each track.
+  vector<vector<Observation> > tracks;
+};
+
+// Timing of a single sweep (all times in seconds of wall time).
+struct SweepTiming {
+  // Delay between the sweep arriving and the tracker starting to process it.
+  double queueing_delay;
+
+  // Delay between the sweep arriving and the tracker finishing it.
+  double latency;
+
+  // Whether the tracker was still busy with this sweep when the next
+  // sweep arrived.
+  bool missed_deadline;
+};
+
+double getMonotonicSeconds() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+// Block until the monotonic clock reaches the given time.
+void sleepUntil(const double wall_time) {
+  const double remaining = wall_time - getMonotonicSeconds();
+  if (remaining <= 0) {
+    return;
+  }
+
+  timespec ts;
+  ts.tv_sec = static_cast<time_t>(remaining);
+  ts.tv_nsec = static_cast<long>((remaining - ts.tv_sec) * 1e9);
+  while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {
+  }
+}
+
+// Group all frames of all tracks into sweeps of kSweepPeriod seconds.
+void makeSweeps(
+    const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
+    vector<Sweep>* sweeps) {
+  const vector< boost::shared_ptr<precision_tracking::track_manager_color::Track> >& tracks =
+      track_manager.tracks_;
+
+  vector<Observation> observations;
+  for (size_t i = 0; i < tracks.size(); ++i) {
+    for (size_t j = 0; j < tracks[i]->frames_.size(); ++j) {
+      Observation observation;
+      observation.track_index = i;
+      observation.frame_index = j;
+      observation.timestamp = tracks[i]->frames_[j]->timestamp_;
+      observations.push_back(observation);
+    }
+  }
+
+  if (observations.empty()) {
+    return;
+  }
+
+  // A stable sort keeps the frames of each track in their recorded order.
+  std::stable_sort(observations.begin(), observations.end(),
+                   compareObservations);
+
+  const double first_timestamp = observations[0].timestamp;
+
+  long current_sweep_num = -1;
+  std::map<int, size_t> track_slots;
+  for (size_t i = 0; i < observations.size(); ++i) {
+    const Observation& observation = observations[i];
+    const long sweep_num = static_cast<long>(
+          floor((observation.timestamp - first_timestamp) / kSweepPeriod));
+
+    if (sweep_num != current_sweep_num) {
+      Sweep sweep;
+      sweep.start_time = first_timestamp + sweep_num * kSweepPeriod;
+      sweeps->push_back(sweep);
+      track_slots.clear();
+      current_sweep_num = sweep_num;
+    }
+
+    Sweep& sweep = sweeps->back();
+    std::map<int, size_t>::const_iterator it =
+        track_slots.find(observation.track_index);
+    if (it == track_slots.end()) {
+      track_slots[observation.track_index] = sweep.tracks.size();
+      sweep.tracks.push_back(vector<Observation>(1, observation));
+    } else {
+      sweep.tracks[it->second].push_back(observation);
+    }
+  }
+}
+
+// Returns the given percentile (between 0 and 1) of the values.
+double getPercentile(vector<double> values, const double percentile) {
+  if (values.empty()) {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  const size_t index = std::min(values.size() - 1, static_cast<size_t>(
+        std::max(0.0, ceil(percentile * values.size()) - 1)));
+  return values[index];
+}
+
+void printStatistics(const string& name, const vector<double>& values_sec) {
+  double sum = 0;
+  for (size_t i = 0; i < values_sec.size(); ++i) {
+    sum += values_sec[i];
+  }
+  const double mean = values_sec.empty() ? 0 : sum / values_sec.size();
+
+  printf("%s (ms): mean %lf, p50 %lf, p90 %lf, p99 %lf, max %lf\n",
+         name.c_str(), 1000 * mean,
+         1000 * getPercentile(values_sec, 0.5),
+         1000 * getPercentile(values_sec, 0.9),
+         1000 * getPercentile(values_sec, 0.99),
+         1000 * getPercentile(values_sec, 1.0));
+}
+
+// Track the objects in a sweep, each with its own tracker.
+void trackSweep(
+    const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
+    const Sweep& sweep,
+    const int num_threads,
+    const vector<boost::shared_ptr<precision_tracking::PrecisionTracker> >&
+      precision_trackers,
+    vector<precision_tracking::Tracker>* trackers) {
+  #pragma omp parallel for num_threads(num_threads) schedule(dynamic)
+  for (int j = 0; j < static_cast<int>(sweep.tracks.size()); ++j) {
+    const vector<Observation>& observations = sweep.tracks[j];
+
+    precision_tracking::Tracker& tracker =
+        (*trackers)[observations[0].track_index];
+    tracker.setPrecisionTracker(precision_trackers[omp_get_thread_num()]);
+
+    for (size_t k = 0; k < observations.size(); ++k) {
+      const Observation& observation = observations[k];
+      const boost::shared_ptr<precision_tracking::track_manager_color::Frame>& frame =
+          track_manager.tracks_[observation.track_index]->frames_[
+            observation.frame_index];
+
+      double sensor_horizontal_resolution;
+      double sensor_vertical_resolution;
+      precision_tracking::getSensorResolution(
+            frame->getCentroid(), &sensor_horizontal_resolution,
+            &sensor_vertical_resolution);
+
+      Eigen::Vector3f estimated_velocity;
+      tracker.addPoints(frame->cloud_, frame->timestamp_,
+                        sensor_horizontal_resolution,
+                        sensor_vertical_resolution,
+                        &estimated_velocity);
+    }
+  }
+
+  // Objects that were not observed in this sweep (e.g. because they are
+  // occluded) eventually have their state compacted.
+  vector<bool> observed(trackers->size(), false);
+  for (size_t j = 0; j < sweep.tracks.size(); ++j) {
+    observed[sweep.tracks[j][0].track_index] = true;
+  }
+  for (size_t i = 0; i < trackers->size(); ++i) {
+    if (!observed[i]) {
+      (*trackers)[i].addMissedFrame();
+    }
+  }
+}
+
+// Track the objects in a sweep with the centroid-based Kalman filter,
+// updating the motion models of all objects together.
+void trackSweepKalman(
+    const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
+    const Sweep& sweep,
+    const int num_threads,
+    precision_tracking::MotionModelBank* motion_model_bank) {
+  // Each row of the bank can only be observed once per update, so objects
+  // observed more than once in this sweep take more than one update.
+  size_t max_observations = 0;
+  for (size_t i = 0; i < sweep.tracks.size(); ++i) {
+    max_observations = std::max(max_observations, sweep.tracks[i].size());
+  }
+
+  vector<Eigen::Vector4f, Eigen::aligned_allocator<Eigen::Vector4f> >
+      centroids(sweep.tracks.size(), Eigen::Vector4f::Zero());
+  for (size_t k = 0; k < max_observations; ++k) {
+    #pragma omp parallel for num_threads(num_threads)
+    for (int j = 0; j < static_cast<int>(sweep.tracks.size()); ++j) {
+      const vector<Observation>& observations = sweep.tracks[j];
+      if (k < observations.size()) {
+        const Observation& observation = observations[k];
+        const boost::shared_ptr<precision_tracking::track_manager_color::Frame>& frame =
+            track_manager.tracks_[observation.track_index]->frames_[
+              observation.frame_index];
+        pcl::compute3DCentroid(*frame->cloud_, centroids[j]);
+      }
+    }
+
+    for (size_t j = 0; j < sweep.tracks.size(); ++j) {
+      const vector<Observation>& observations = sweep.tracks[j];
+      if (k < observations.size()) {
+        const Observation& observation = observations[k];
+        const boost::shared_ptr<precision_tracking::track_manager_color::Frame>& frame =
+            track_manager.tracks_[observation.track_index]->frames_[
+              observation.frame_index];
+
+        // As in Tracker::addPoints, frames without any points are skipped.
+        if (!frame->cloud_->empty()) {
+          motion_model_bank->addCentroid(observation.track_index,
+                                         centroids[j], frame->timestamp_);
+        }
+      }
+    }
+
+    motion_model_bank->update();
+  }
+}
+
+void replay(
+    const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
+    const precision_tracking::Params& params,
+    const bool use_precision_tracker,
+    const double speedup,
+    const int num_threads) {
+  vector<Sweep> sweeps;
+  makeSweeps(track_manager, &sweeps);
+
+  if (sweeps.empty()) {
+    printf("No frames to replay\n");
+    return;
+  }
+
+  // With the precision tracker, each track keeps its own motion model and
+  // previous points, but the (memory-heavy) precision trackers are shared by
+  // all tracks handled by the same thread.  With the Kalman filter only, all
+  // tracks are updated together by a motion model bank, with one row per
+  // track.
+  const size_t num_tracks = track_manager.tracks_.size();
+  vector<precision_tracking::Tracker> trackers;
+  vector<boost::shared_ptr<precision_tracking::PrecisionTracker> >
+      precision_trackers;
+  precision_tracking::MotionModelBank motion_model_bank(&params);
+  if (use_precision_tracker) {
+    trackers.reserve(num_tracks);
+    for (size_t i = 0; i < num_tracks; ++i) {
+      // Construct each tracker separately, since copies of a tracker share
+      // its motion model and previous points.
+      trackers.push_back(precision_tracking::Tracker(&params));
+      trackers.back().setTrackId(track_manager.tracks_[i]->track_num_);
+    }
+
+    for (int i = 0; i < num_threads; ++i) {
+      precision_trackers.push_back(
+            boost::make_shared<precision_tracking::PrecisionTracker>(&params));
+    }
+  } else {
+    for (size_t i = 0; i < num_tracks; ++i) {
+      motion_model_bank.addTrack();
+    }
+  }
+
+  const double first_sweep_time = sweeps[0].start_time;
+  const double wall_period = kSweepPeriod / speedup;
+
+  vector<SweepTiming> timings(sweeps.size());
+
+  const double replay_start = getMonotonicSeconds();
+
+  for (size_t i = 0; i < sweeps.size(); ++i) {
+    const Sweep& sweep = sweeps[i];
+
+    // The sweep is available once the sensor has finished recording it.
+    const double arrival = replay_start +
+        (sweep.start_time - first_sweep_time + kSweepPeriod) / speedup;
+
+    // The next sweep arrives one period later, whether or not it contains
+    // any objects.
+    const double deadline = arrival + wall_period;
+
+    sleepUntil(arrival);
+    const double start = getMonotonicSeconds();
+
+    precision_tracking::ScopedTraceEvent trace_event("Sweep", -1, -1,
+                                                     sweep.tracks.size());
+
+    if (use_precision_tracker) {
+      trackSweep(track_manager, sweep, num_threads, precision_trackers,
+                 &trackers);
+    } else {
+      trackSweepKalman(track_manager, sweep, num_threads, &motion_model_bank);
+    }
+
+    const double finish = getMonotonicSeconds();
+
+    SweepTiming& timing = timings[i];
+    timing.queueing_delay = start - arrival;
+    timing.latency = finish - arrival;
+    timing.missed_deadline = finish > deadline;
+  }
+
+  // Summarize the results.
+  vector<double> queueing_delays;
+  vector<double> latencies;
+  int num_missed = 0;
+  for (size_t i = 0; i < timings.size(); ++i) {
+    queueing_delays.push_back(timings[i].queueing_delay);
+    latencies.push_back(timings[i].latency);
+    if (timings[i].missed_deadline) {
+      num_missed++;
+    }
+  }
+
+  printf("Replayed %zu sweeps at %lfx real time with %d thread(s); "
+         "budget per sweep: %lf ms\n",
+         sweeps.size(), speedup, num_threads, 1000 * wall_period);
+  printf("Deadline misses: %d / %zu (%lf%%)\n", num_missed, sweeps.size(),
+         100.0 * num_missed / sweeps.size());
+  printStatistics("Queueing delay", queueing_delays);
+  printStatistics("Latency", latencies);
+
+  printf("%s\n", precision_tracking::reportMemoryUsage().c_str());
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  if (argc < 2) {
+    printf("Usage: %s tm_file [speedup] [num_threads] [kalman|2d|25d|3d|color|colorgrid] "
+           "[trace_file]\n", argv[0]);
+    return (1);
+  }
+
+  const string color_tm_file = argv[1];
+  const double speedup = argc > 2 ? atof(argv[2]) : 1;
+  const int num_threads = argc > 3 ? atoi(argv[3]) : 1;
+  const string mode = argc > 4 ? argv[4] : "2d";
+  const string trace_file = argc > 5 ? argv[5] : "";
+
+  if (speedup <= 0) {
+    printf("Error - speedup must be > 0\n");
+    return (1);
+  }
+  if (num_threads <= 0) {
+    printf("Error - num_threads must be > 0\n");
+    return (1);
+  }
+
+  precision_tracking::Params params;
+  bool use_precision_tracker = true;
+  if (mode == "kalman") {
+    use_precision_tracker = false;
+  } else if (mode == "3d") {
+    params.use3D = true;
+  } else if (mode == "25d") {
+    params.use25D = true;
+  } else if (mode == "color") {
+    params.useColor = true;
+  } else if (mode == "colorgrid") {
+    params.useColor = true;
+    params.kUseColorGrid = true;
+  } else if (mode != "2d") {
+    printf("Unknown mode: %s\n", mode.c_str());
+    return (1);
+  }
+
+  // Load tracks.
+  printf("Loading file: %s\n", color_tm_file.c_str());
+  precision_tracking::track_manager_color::TrackManagerColor track_manager(color_tm_file);
+  printf("Found %zu tracks\n", track_manager.tracks_.size());
+
+  printf("Replaying tracks in %s mode - please wait...\n", mode.c_str());
+  if (!trace_file.empty()) {
+    precision_tracking::TraceRecorder::enable();
+  }
+
+  replay(track_manager, params, use_precision_tracker, speedup, num_threads);
+
+  if (!trace_file.empty()) {
+    printf("Writing trace to: %s\n", trace_file.c_str());
+    precision_tracking::TraceRecorder::writeChromeTrace(trace_file);
+  }
+
+  return 0;
+}
@@ -9,8 +9,11 @@
 
 #include <vector>
 #include <algorithm>
+#include <functional>
+#include <sstream>
 
 #include <precision_tracking/adh_tracker3d.h>
+#include <precision_tracking/trace_recorder.h>
 
 using std::vector;
 using std::max;
@@ -19,7 +22,9 @@ namespace precision_tracking {
 
 
 ADHTracker3d::ADHTracker3d(const Params *params)
-  : params_(params)
+  : params_(params),
+    scoring_profile_(NULL),
+    perf_counters_(NULL)
 {
 }
 
@@ -40,6 +45,7 @@ void ADHTracker3d::track(
     const double xy_sensor_resolution,
     const double z_sensor_resolution,
     boost::shared_ptr<AlignmentEvaluator> alignment_evaluator,
+    boost::shared_ptr<AlignmentEvaluator> coarse_alignment_evaluator,
     ScoredTransforms<ScoredTransformXYZ>* final_scored_transforms3D) const
 {
   // Compute the minimum sampling resolution based on the sensor
@@ -59,20 +65,67 @@ void ADHTracker3d::track(
         xRange, yRange, zRange, &candidate_transforms);
 
   // Initially track at a coarse resolution and get the probability of
-  // various transforms.
-  alignment_evaluator->setPrevPoints(prev_points);
+  // various transforms.  The evaluator for the finer levels only needs the
+  // previous points once these levels are reached.
+  if (coarse_alignment_evaluator) {
+    coarse_alignment_evaluator->setPrevPoints(prev_points);
+  }
+  bool set_prev_points = false;
 
   // Total probability for the region that we are evaluating.
   double region_prob = 1;
 
+  size_t level = 0;
+
   while(candidate_transforms.size() > 0) {
+    if (level_scoring_timers_.size() <= level) {
+      std::ostringstream description;
+      description << "Scoring level " << level;
+      level_scoring_timers_.push_back(CycleTimer(description.str()));
+    }
+
     // Compute the probability of each of the candidate transforms.
     ScoredTransforms<ScoredTransformXYZ> scored_transforms3D;
-    alignment_evaluator->score3DTransforms(
-          current_points, current_points_centroid,
-          current_xy_sampling_resolution, current_z_sampling_resolution,
-          xy_sensor_resolution, z_sensor_resolution,
-          candidate_transforms, motion_model, &scored_transforms3D);
+    {
+      ScopedTraceEvent trace_event("Score level", -1, level,
+                                   candidate_transforms.size());
+      level_scoring_timers_[level].start();
+      if (scoring_profile_) {
+        scoring_profile_->start(perf_counters_);
+      }
+      boost::shared_ptr<AlignmentEvaluator> level_evaluator;
+      if (coarse_alignment_evaluator &&
+          current_xy_sampling_resolution > params_->kCascadeResolution) {
+        level_evaluator = coarse_alignment_evaluator;
+      } else {
+        level_evaluator = alignment_evaluator;
+        if (!set_prev_points) {
+          alignment_evaluator->setPrevPoints(prev_points);
+          set_prev_points = true;
+        }
+      }
+      level_evaluator->score3DTransforms(
+            current_points, current_points_centroid,
+            current_xy_sampling_resolution, current_z_sampling_resolution,
+            xy_sensor_resolution, z_sensor_resolution,
+            candidate_transforms, motion_model, &scored_transforms3D);
+      if (scoring_profile_) {
+        scoring_profile_->stop(perf_counters_);
+      }
+      level_scoring_timers_[level].stop();
+    }
+
+    // With a budget per level, the cells of a level can have different
+    // volumes, so weight the probability density of each by its volume.
+    if (params_->kMaxTransformsPerLevel > 0) {
+      vector<ScoredTransformXYZ>& level_transforms =
+          scored_transforms3D.getScoredTransforms();
+      for (size_t i = 0; i < level_transforms.size(); ++i) {
+        level_transforms[i].setUnnormalizedLogProb(
+              level_transforms[i].getUnnormalizedLogProb() +
+              log(level_transforms[i].getVolume()));
+      }
+    }
 
     // Normalize the probabilities so they sum to 1.
     recomputeProbs(region_prob, &scored_transforms3D);
@@ -100,6 +153,7 @@ void ADHTracker3d::track(
 
     current_xy_sampling_resolution = new_xy_sampling_resolution;
     current_z_sampling_resolution = new_z_sampling_resolution;
+    ++level;
     }
 }
 
@@ -141,81 +195,177 @@ void ADHTracker3d::makeNewTransforms3D(
   std::vector<ScoredTransformXYZ>& scored_transforms_xyz =
       scored_transforms->getScoredTransforms();
 
-  // Any transforms that we are recomputing at a higher resolution should
-  // be removed from the list of previously scored transforms.
-  vector<size_t> to_remove;
+  const std::vector<double>& probs = scored_transforms->getNormalizedProbs();
+
+  // The number of subdivisions of a cell along each dimension.
+  const int full_factor = static_cast<int>(ceil(params_->kReductionFactor));
 
-  // Compute the sampling volume of each transform.
-  const double volume = z_sampling_resolution > 0 ?
-        pow(xy_sampling_resolution, 2) * z_sampling_resolution :
-        pow(xy_sampling_resolution, 2);
+  // The cells that we are recomputing at a higher resolution, in increasing
+  // order, and the number of subdivisions of each along each dimension.
+  vector<size_t> to_refine;
+  vector<int> factors;
+
+  if (params_->kMaxTransformsPerLevel > 0) {
+    chooseBudgetedRefinements(old_xy_sampling_resolution,
+                              old_z_sampling_resolution,
+                              *scored_transforms, probs, &to_refine, &factors);
+  } else {
+    // For each region with probability greater than the minimum
+    // threshold, sample more finely in that region.
+    const size_t max_num_transforms = params_->kMaxNumTransforms > 0 ?
+          std::min(probs.size(), params_->kMaxNumTransforms) : probs.size();
+    for (size_t i = 0; i < max_num_transforms; ++i) {
+      if (probs[i] > params_->kMinProb) {
+        to_refine.push_back(i);
+        factors.push_back(full_factor);
+      }
+    }
+  }
 
   // Keep track of the total probability of the region that we are recomputing
   // the probability of at a higher resolution.
   *total_recomputing_prob = 0;
 
-  const std::vector<double>& probs = scored_transforms->getNormalizedProbs();
-
   // Allocate space for the new transforms that we will recompute.
-  const size_t max_num_transforms = params_->kMaxNumTransforms > 0 ?
-        std::min(probs.size(), params_->kMaxNumTransforms) : probs.size();
+  size_t num_new_transforms = 0;
+  for (size_t n = 0; n < factors.size(); ++n) {
+    num_new_transforms += z_sampling_resolution > 0 ?
+          factors[n] * factors[n] * factors[n] : factors[n] * factors[n];
+  }
   new_xyz_transforms->clear();
-  new_xyz_transforms->reserve(max_num_transforms);
+  new_xyz_transforms->reserve(num_new_transforms);
 
-  // For each region with probability greater than the minimum
-  // threshold, sample more finely in that region.
-  for (size_t i = 0; i < max_num_transforms; ++i) {
-    const ScoredTransformXYZ& old_scored_transform = scored_transforms_xyz[i];
+  for (size_t n = 0; n < to_refine.size(); ++n) {
+    const size_t index = to_refine[n];
+    const ScoredTransformXYZ& old_scored_transform =
+        scored_transforms_xyz[index];
     const double old_x = old_scored_transform.getX();
     const double old_y = old_scored_transform.getY();
     const double old_z = old_scored_transform.getZ();
 
-    // Only subdivide cells whose probabilities are greater than the minimum
-    // threshold.
-    if (probs[i] > params_->kMinProb) {
-      *total_recomputing_prob += probs[i];
+    *total_recomputing_prob += probs[index];
+
+    // Cells that are subdivided less than fully are sampled at a coarser
+    // resolution than the rest of this level.
+    const int factor = factors[n];
+    const double new_xy_resolution = factor == full_factor ?
+          xy_sampling_resolution : old_xy_sampling_resolution / factor;
+    const double new_z_resolution = factor == full_factor ?
+          z_sampling_resolution : old_z_sampling_resolution / factor;
+
+    // Compute the sampling volume of each transform.
+    const double volume = z_sampling_resolution > 0 ?
+          pow(new_xy_resolution, 2) * new_z_resolution :
+          pow(new_xy_resolution, 2);
 
-      // We are sampling more finely in this region, so we can remove
-      // the previously computed probability for this transform.
-      to_remove.push_back(i);
+    // Get the initial sampling point in this region.
+    const double min_x = old_x - old_xy_sampling_resolution / 2 + new_xy_resolution / 2;
+    const double min_y = old_y - old_xy_sampling_resolution / 2 + new_xy_resolution / 2;
+    const double min_z = old_z - old_z_sampling_resolution / 2 + new_z_resolution / 2;
 
-      // Get the initial sampling point in this region.
-      const double min_x = old_x - old_xy_sampling_resolution / 2 + xy_sampling_resolution / 2;
-      const double min_y = old_y - old_xy_sampling_resolution / 2 + xy_sampling_resolution / 2;
-      const double min_z = old_z - old_z_sampling_resolution / 2 + z_sampling_resolution / 2;
+    // Sample more finely in this region.
+    for (int i = 0; i < factor; ++i) {
+      const double new_x = min_x + new_xy_resolution * i;
 
-      // Sample more finely in this region.
-      for (int i = 0; i < params_->kReductionFactor; ++i) {
-        const double new_x = min_x + xy_sampling_resolution * i;
+      for (int j = 0; j < factor; ++j) {
+        const double new_y = min_y + new_xy_resolution * j;
 
-        for (int j = 0; j < params_->kReductionFactor; ++j) {
-          const double new_y = min_y + xy_sampling_resolution * j;
+        if (z_sampling_resolution == 0) {
+          const double new_z = old_z;
 
-          if (z_sampling_resolution == 0) {
-            const double new_z = old_z;
+          XYZTransform new_transform(new_x, new_y, new_z, volume);
+          new_xyz_transforms->push_back(new_transform);
+        } else {
+          for (int k = 0; k < factor; ++k) {
+            const double new_z = min_z + new_z_resolution * k;
 
             XYZTransform new_transform(new_x, new_y, new_z, volume);
             new_xyz_transforms->push_back(new_transform);
-          } else {
-            for (int k = 0; k < params_->kReductionFactor; ++k) {
-              const double new_z = min_z + z_sampling_resolution * k;
-
-              XYZTransform new_transform(new_x, new_y, new_z, volume);
-              new_xyz_transforms->push_back(new_transform);
-            }
           }
         }
       }
     }
   }
 
-  // Remove regions that we are resampling at a higher resolution.
-  for (int i = static_cast<int>(to_remove.size() - 1); i >= 0; --i) {
-    size_t remove_index = to_remove[i];
+  // We are sampling more finely in these regions, so we can remove
+  // the previously computed probabilities for these transforms.
+  for (int n = static_cast<int>(to_refine.size()) - 1; n >= 0; --n) {
+    size_t remove_index = to_refine[n];
     scored_transforms_xyz.erase(scored_transforms_xyz.begin() + remove_index);
   }
 }
 
+void ADHTracker3d::chooseBudgetedRefinements(
+    const double old_xy_sampling_resolution,
+    const double old_z_sampling_resolution,
+    const ScoredTransforms<ScoredTransformXYZ>& scored_transforms,
+    const std::vector<double>& probs,
+    std::vector<size_t>* to_refine,
+    std::vector<int>* factors) const
+{
+  const std::vector<ScoredTransformXYZ>& scored_transforms_xyz =
+      scored_transforms.getScoredTransforms();
+
+  const int full_factor = static_cast<int>(ceil(params_->kReductionFactor));
+  const int num_dims = old_z_sampling_resolution > 0 ? 3 : 2;
+
+  // Only cells of the previous level can be subdivided; cells of earlier
+  // levels, and cells that were subdivided less than fully, are coarser and
+  // are kept as they are.
+  const double old_volume = old_z_sampling_resolution > 0 ?
+        pow(old_xy_sampling_resolution, 2) * old_z_sampling_resolution :
+        pow(old_xy_sampling_resolution, 2);
+
+  // Find the cells that can be subdivided, and their total probability.
+  vector<std::pair<double, size_t> > candidates;
+  double remaining_prob = 0;
+  for (size_t i = 0; i < probs.size(); ++i) {
+    if (probs[i] > params_->kMinProb &&
+        fabs(scored_transforms_xyz[i].getVolume() - old_volume) <=
+        1e-6 * old_volume) {
+      candidates.push_back(std::make_pair(probs[i], i));
+      remaining_prob += probs[i];
+    }
+  }
+
+  // Give each cell a share of the budget in proportion to its probability,
+  // starting with the most likely cells.  A cell can use at most
+  // full_factor^num_dims transforms, and passes on what it does not use to
+  // the less likely cells.
+  std::sort(candidates.begin(), candidates.end(),
+            std::greater<std::pair<double, size_t> >());
+  double remaining_budget = params_->kMaxTransformsPerLevel;
+  for (size_t n = 0; n < candidates.size() && remaining_budget >= 1; ++n) {
+    const double prob = candidates[n].first;
+    const double budget = remaining_budget * prob / remaining_prob;
+    remaining_prob -= prob;
+
+    // The number of subdivisions along each dimension that fits in this
+    // cell's budget.  Cells that cannot be split at least in half are
+    // kept as they are.
+    const int factor = std::min(full_factor, static_cast<int>(
+        floor(pow(budget, 1.0 / num_dims) + 1e-9)));
+    if (factor < 2) {
+      continue;
+    }
+
+    to_refine->push_back(candidates[n].second);
+    factors->push_back(factor);
+    remaining_budget -= pow(static_cast<double>(factor), num_dims);
+  }
+
+  // Sort the cells by index, so that they can be removed in reverse order.
+  vector<std::pair<size_t, int> > refinements(to_refine->size());
+  for (size_t n = 0; n < to_refine->size(); ++n) {
+    refinements[n] = std::make_pair((*to_refine)[n], (*factors)[n]);
+  }
+  std::sort(refinements.begin(), refinements.end());
+  for (size_t n = 0; n < refinements.size(); ++n) {
+    (*to_refine)[n] = refinements[n].first;
+    (*factors)[n] = refinements[n].second;
+  }
+}
+
 void ADHTracker3d::createCandidateXYZTransforms(
     const double xy_sampling_resolution,
     const double z_sampling_resolution,
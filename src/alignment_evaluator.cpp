@@ -13,6 +13,7 @@ namespace precision_tracking {
 
 AlignmentEvaluator::AlignmentEvaluator(const Params *params)
   : params_(params)
+  , prev_points_memory_(kPointCloudMemory)
   , smoothing_factor_(params_->kSmoothingFactor)
 {
 }
@@ -26,6 +27,45 @@ void AlignmentEvaluator::setPrevPoints(
     const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr prev_points)
 {
   prev_points_ = prev_points;
+  prev_points_memory_.set(getCloudMemoryUsage(*prev_points_));
+}
+
+size_t AlignmentEvaluator::memoryUsage() const
+{
+  size_t bytes = sizeof(*this);
+  if (prev_points_) {
+    bytes += getCloudMemoryUsage(*prev_points_);
+  }
+  return bytes;
+}
+
+double AlignmentEvaluator::computeSigmaXY(
+    const Params* params,
+    const double xy_sampling_resolution,
+    const double xy_sensor_resolution)
+{
+  // Compute the different sources of error in the xy directions.
+  const double sampling_error_xy = params->kSigmaGridFactor * xy_sampling_resolution;
+  const double resolution_error_xy = params->kSigmaFactor * xy_sensor_resolution;
+  const double noise_error_xy = params->kMinMeasurementVariance;
+
+  // The variance is a combination of these 3 sources of error.
+  return sqrt(pow(sampling_error_xy, 2) +
+              pow(resolution_error_xy, 2) +
+              pow(noise_error_xy, 2));
+}
+
+double AlignmentEvaluator::computeMeasurementDiscountFactor(
+    const Params* params, const size_t num_current_points)
+{
+  // Downweight all points in the current frame beyond kMaxDiscountPoints
+  // because they are not all independent.
+  if (num_current_points < params->kMaxDiscountPoints) {
+      return params->kMeasurementDiscountFactor;
+  } else {
+      return params->kMeasurementDiscountFactor *
+          (params->kMaxDiscountPoints / num_current_points);
+  }
 }
 
 void AlignmentEvaluator::init(
@@ -35,27 +75,14 @@ void AlignmentEvaluator::init(
     const double z_sensor_resolution,
     const size_t num_current_points)
 {
-  // Downweight all points in the current frame beyond kMaxDiscountPoints
-  // because they are not all independent.
-  if (num_current_points < params_->kMaxDiscountPoints) {
-      measurement_discount_factor_ = params_->kMeasurementDiscountFactor;
-  } else {
-      measurement_discount_factor_ = params_->kMeasurementDiscountFactor *
-          (params_->kMaxDiscountPoints / num_current_points);
-  }
+  measurement_discount_factor_ =
+      computeMeasurementDiscountFactor(params_, num_current_points);
 
   xy_sampling_resolution_ = xy_sampling_resolution;
   z_sampling_resolution_ = z_sampling_resolution;
 
-  // Compute the different sources of error in the xy directions.
-  const double sampling_error_xy = params_->kSigmaGridFactor * xy_sampling_resolution;
-  const double resolution_error_xy = params_->kSigmaFactor * xy_sensor_resolution;
-  const double noise_error_xy = params_->kMinMeasurementVariance;
-
-  // The variance is a combination of these 3 sources of error.
-  sigma_xy_ = sqrt(pow(sampling_error_xy, 2) +
-                   pow(resolution_error_xy, 2) +
-                   pow(noise_error_xy, 2));
+  sigma_xy_ = computeSigmaXY(params_, xy_sampling_resolution,
+                             xy_sensor_resolution);
 
   // Compute the different sources of error in the z direction.
   const double sampling_error_z = params_->kSigmaGridFactor * z_sampling_resolution;
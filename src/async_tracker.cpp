@@ -0,0 +1,227 @@
+/*
+ * async_tracker.cpp
+ *
+ *      Author: davheld
+ *
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#include <boost/make_shared.hpp>
+
+#include <precision_tracking/async_tracker.h>
+
+namespace precision_tracking {
+
+TrackingFuture::TrackingFuture()
+  : ready_(false),
+    estimated_velocity_(Eigen::Vector3f::Zero()),
+    alignment_probability_(0)
+{
+  pthread_mutex_init(&mutex_, NULL);
+  pthread_cond_init(&ready_cond_, NULL);
+}
+
+TrackingFuture::~TrackingFuture()
+{
+  pthread_cond_destroy(&ready_cond_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+bool TrackingFuture::isReady() const
+{
+  pthread_mutex_lock(&mutex_);
+  const bool ready = ready_;
+  pthread_mutex_unlock(&mutex_);
+  return ready;
+}
+
+void TrackingFuture::wait() const
+{
+  pthread_mutex_lock(&mutex_);
+  while (!ready_) {
+    pthread_cond_wait(&ready_cond_, &mutex_);
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+Eigen::Vector3f TrackingFuture::getEstimatedVelocity() const
+{
+  // The result does not change once it is ready.
+  wait();
+  return estimated_velocity_;
+}
+
+double TrackingFuture::getAlignmentProbability() const
+{
+  wait();
+  return alignment_probability_;
+}
+
+void TrackingFuture::set(const Eigen::Vector3f& estimated_velocity,
+                         const double alignment_probability)
+{
+  pthread_mutex_lock(&mutex_);
+  estimated_velocity_ = estimated_velocity;
+  alignment_probability_ = alignment_probability;
+  ready_ = true;
+  pthread_cond_broadcast(&ready_cond_);
+  pthread_mutex_unlock(&mutex_);
+}
+
+AsyncTracker::AsyncTracker(const Params* params,
+                           const bool use_precision_tracker,
+                           const int num_threads)
+  : params_(params),
+    num_unfinished_jobs_(0),
+    stopping_(false)
+{
+  pthread_mutex_init(&mutex_, NULL);
+  pthread_cond_init(&work_cond_, NULL);
+  pthread_cond_init(&idle_cond_, NULL);
+
+  const int num_workers = std::max(num_threads, 1);
+  if (use_precision_tracker) {
+    for (int i = 0; i < num_workers; ++i) {
+      precision_trackers_.push_back(
+            boost::make_shared<PrecisionTracker>(params_));
+    }
+  }
+
+  // The arguments must not move once the threads have started.
+  worker_args_.resize(num_workers);
+  threads_.resize(num_workers);
+  for (int i = 0; i < num_workers; ++i) {
+    worker_args_[i].async_tracker = this;
+    worker_args_[i].worker_index = i;
+    if (pthread_create(&threads_[i], NULL, &AsyncTracker::runWorker,
+                       &worker_args_[i]) != 0) {
+      printf("Error - could not start tracking thread %d\n", i);
+      exit(1);
+    }
+  }
+}
+
+AsyncTracker::~AsyncTracker()
+{
+  waitAll();
+
+  pthread_mutex_lock(&mutex_);
+  stopping_ = true;
+  pthread_cond_broadcast(&work_cond_);
+  pthread_mutex_unlock(&mutex_);
+
+  for (size_t i = 0; i < threads_.size(); ++i) {
+    pthread_join(threads_[i], NULL);
+  }
+
+  pthread_cond_destroy(&idle_cond_);
+  pthread_cond_destroy(&work_cond_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+boost::shared_ptr<TrackingFuture> AsyncTracker::addPoints(
+    Tracker* tracker,
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+    const double current_timestamp,
+    const double sensor_horizontal_resolution,
+    const double sensor_vertical_resolution,
+    const Callback& callback)
+{
+  Job job;
+  job.points = current_points;
+  job.timestamp = current_timestamp;
+  job.sensor_horizontal_resolution = sensor_horizontal_resolution;
+  job.sensor_vertical_resolution = sensor_vertical_resolution;
+  job.callback = callback;
+  job.future.reset(new TrackingFuture);
+
+  pthread_mutex_lock(&mutex_);
+  std::deque<Job>& tracker_jobs = jobs_[tracker];
+  tracker_jobs.push_back(job);
+
+  // Otherwise the tracker is already waiting or running, and this job runs
+  // after the ones before it.
+  if (tracker_jobs.size() == 1) {
+    ready_trackers_.push_back(tracker);
+    pthread_cond_signal(&work_cond_);
+  }
+  num_unfinished_jobs_++;
+  pthread_mutex_unlock(&mutex_);
+
+  return job.future;
+}
+
+void AsyncTracker::waitAll()
+{
+  pthread_mutex_lock(&mutex_);
+  while (num_unfinished_jobs_ > 0) {
+    pthread_cond_wait(&idle_cond_, &mutex_);
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+void* AsyncTracker::runWorker(void* args)
+{
+  const WorkerArgs* worker_args = static_cast<const WorkerArgs*>(args);
+  worker_args->async_tracker->work(worker_args->worker_index);
+  return NULL;
+}
+
+void AsyncTracker::work(const int worker_index)
+{
+  pthread_mutex_lock(&mutex_);
+  while (true) {
+    while (ready_trackers_.empty() && !stopping_) {
+      pthread_cond_wait(&work_cond_, &mutex_);
+    }
+    if (ready_trackers_.empty()) {
+      break;
+    }
+
+    Tracker* tracker = ready_trackers_.front();
+    ready_trackers_.pop_front();
+    const Job job = jobs_[tracker].front();
+    pthread_mutex_unlock(&mutex_);
+
+    // A precision tracker is not thread-safe, so only the one of this
+    // worker may be used.
+    if (!precision_trackers_.empty()) {
+      tracker->setPrecisionTracker(precision_trackers_[worker_index]);
+    } else {
+      tracker->setPrecisionTracker(boost::shared_ptr<PrecisionTracker>());
+    }
+
+    Eigen::Vector3f estimated_velocity;
+    double alignment_probability = 0;
+    tracker->addPoints(job.points, job.timestamp,
+                       job.sensor_horizontal_resolution,
+                       job.sensor_vertical_resolution, &estimated_velocity,
+                       &alignment_probability);
+
+    if (job.callback) {
+      job.callback(estimated_velocity, alignment_probability);
+    }
+    job.future->set(estimated_velocity, alignment_probability);
+
+    pthread_mutex_lock(&mutex_);
+    std::deque<Job>& tracker_jobs = jobs_[tracker];
+    tracker_jobs.pop_front();
+    if (tracker_jobs.empty()) {
+      jobs_.erase(tracker);
+    } else {
+      ready_trackers_.push_back(tracker);
+      pthread_cond_signal(&work_cond_);
+    }
+
+    num_unfinished_jobs_--;
+    if (num_unfinished_jobs_ == 0) {
+      pthread_cond_broadcast(&idle_cond_);
+    }
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+} // namespace precision_tracking
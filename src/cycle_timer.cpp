@@ -0,0 +1,136 @@
+/*
+ * cycle_timer.cpp
+ *
+ *      Author: davheld
+ *
+ */
+
+#include <cstdio>
+#include <sstream>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include <precision_tracking/cycle_timer.h>
+
+namespace precision_tracking {
+
+namespace {
+
+// How long to spend calibrating the cycle counter against the monotonic clock.
+const double kCalibrationSeconds = 0.02;
+
+double getMonotonicSeconds()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+double calibrateCycleCounter()
+{
+  if (!tscIsUsable()) {
+    // readCycleCounter() returns nanoseconds.
+    return 1e9;
+  }
+
+  // Count the ticks over a short interval of the monotonic clock.
+  const double start_seconds = getMonotonicSeconds();
+  const uint64_t start_ticks = readCycleCounter();
+  double end_seconds = start_seconds;
+  while (end_seconds - start_seconds < kCalibrationSeconds) {
+    end_seconds = getMonotonicSeconds();
+  }
+  const uint64_t end_ticks = readCycleCounterSerialized();
+
+  return (end_ticks - start_ticks) / (end_seconds - start_seconds);
+}
+
+} // namespace
+
+bool tscIsUsable()
+{
+#ifdef PRECISION_TRACKING_HAS_TSC
+  // Check the invariant TSC flag: CPUID leaf 0x80000007, EDX bit 8.  Without
+  // it, the counter rate can change with the CPU frequency.  We also need
+  // rdtscp: CPUID leaf 0x80000001, EDX bit 27.
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) ||
+      !(edx & (1 << 8))) {
+    return false;
+  }
+  if (!__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) ||
+      !(edx & (1 << 27))) {
+    return false;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+double getCycleCounterFrequency()
+{
+  static const double frequency = calibrateCycleCounter();
+  return frequency;
+}
+
+CycleTimer::CycleTimer(const std::string& description)
+  : description_(description),
+    total_ticks_(0),
+    num_intervals_(0),
+    start_(0)
+{
+}
+
+void CycleTimer::reset(const std::string& description)
+{
+  description_ = description;
+  reset();
+}
+
+void CycleTimer::reset()
+{
+  total_ticks_ = 0;
+  num_intervals_ = 0;
+}
+
+double CycleTimer::getSeconds() const
+{
+  return total_ticks_ / getCycleCounterFrequency();
+}
+
+double CycleTimer::getMilliseconds() const
+{
+  return getSeconds() * 1000.;
+}
+
+double CycleTimer::getMicroseconds() const
+{
+  return getSeconds() * 1e6;
+}
+
+double CycleTimer::getMeanMicroseconds() const
+{
+  if (num_intervals_ == 0) {
+    return 0;
+  }
+  return getMicroseconds() / num_intervals_;
+}
+
+std::string CycleTimer::report() const
+{
+  std::ostringstream oss;
+  oss << description_ << ": " << getMilliseconds() << " milliseconds over "
+      << num_intervals_ << " intervals (" << getMeanMicroseconds()
+      << " microseconds each).";
+  return oss.str();
+}
+
+void CycleTimer::print() const
+{
+  printf("[TIMER] %s\n", report().c_str());
+}
+
+} // namespace precision_tracking
@@ -0,0 +1,262 @@
+/*
+ * density_grid_25d_evaluator.cpp
+ *
+ *      Author: davheld
+ *
+ */
+
+#include <stdlib.h>
+
+#include <pcl/common/common.h>
+
+#include <precision_tracking/density_grid_25d_evaluator.h>
+#include <precision_tracking/trace_recorder.h>
+
+namespace precision_tracking {
+
+namespace {
+
+using std::vector;
+using std::max;
+using std::min;
+
+} // namespace
+
+DensityGrid25dEvaluator::DensityGrid25dEvaluator(const Params *params)
+  : AlignmentEvaluator(params),
+    grid_memory_(kDensityGridMemory),
+    xSize_(0),
+    ySize_(0),
+    xy_grid_step_(0),
+    z_grid_step_(0),
+    num_spillover_steps_xy_(0),
+    num_spillover_steps_z_(0)
+{
+}
+
+DensityGrid25dEvaluator::~DensityGrid25dEvaluator()
+{
+}
+
+size_t DensityGrid25dEvaluator::memoryUsage() const
+{
+  return AlignmentEvaluator::memoryUsage() +
+      (sizeof(*this) - sizeof(AlignmentEvaluator)) + getGridMemoryUsage();
+}
+
+size_t DensityGrid25dEvaluator::getGridMemoryUsage() const
+{
+  return density_grid_.capacity() * sizeof(float) +
+      height_masks_.capacity() * sizeof(uint64_t);
+}
+
+void DensityGrid25dEvaluator::init(const double xy_sampling_resolution,
+          const double z_sampling_resolution,
+          const double sensor_horizontal_resolution,
+          const double sensor_vertical_resolution,
+          const size_t num_current_points)
+{
+  AlignmentEvaluator::init(xy_sampling_resolution, z_sampling_resolution,
+                           sensor_horizontal_resolution,
+                           sensor_vertical_resolution, num_current_points);
+
+  ScopedTraceEvent trace_event("Build density grid");
+
+  computeDensityGridParameters(
+        prev_points_, xy_sampling_resolution, z_sampling_resolution,
+        sensor_horizontal_resolution, sensor_vertical_resolution);
+
+  computeDensityGrid(prev_points_);
+
+  grid_memory_.set(getGridMemoryUsage());
+}
+
+void DensityGrid25dEvaluator::computeDensityGridParameters(
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& prev_points,
+    const double xy_sampling_resolution,
+    const double z_sampling_resolution,
+    const double xy_sensor_resolution,
+    const double z_sensor_resolution)
+{
+  xy_grid_step_ = xy_sampling_resolution;
+
+  // As in DensityGrid3dEvaluator, if we are not sampling in the z-direction,
+  // then the height bins have the ratio of the sensor resolution.
+  z_grid_step_ =
+      z_sampling_resolution > 0 ? z_sampling_resolution :
+        xy_sampling_resolution * (z_sensor_resolution / xy_sensor_resolution);
+
+  // Find the min and max of the previous points.
+  pcl::PointXYZRGB max_pt;
+  pcl::getMinMax3D(*prev_points, min_pt_, max_pt);
+
+  // The object and 2 bins of padding on each side must fit in the mask, so
+  // tall objects get coarser height bins.
+  const double z_range = max_pt.z - min_pt_.z;
+  z_grid_step_ = max(z_grid_step_, z_range / (kNumHeightBins - 4));
+  if (z_grid_step_ <= 0) {
+    z_grid_step_ = xy_grid_step_;
+  }
+
+  const double epsilon = 0.0001;
+
+  // As in DensityGrid2dEvaluator, we add padding to allow for inexact
+  // matches.  The outer grid cells are kept empty and are used to represent
+  // the empty space around the tracked object.
+  min_pt_.x -= (2 * xy_grid_step_ + epsilon);
+  min_pt_.y -= (2 * xy_grid_step_ + epsilon);
+  min_pt_.z -= (2 * z_grid_step_ + epsilon);
+  max_pt.x += 2 * xy_grid_step_;
+  max_pt.y += 2 * xy_grid_step_;
+
+  xSize_ = min(params_->kMaxXSize, max(1, static_cast<int>(
+      ceil((max_pt.x - min_pt_.x) / xy_grid_step_))));
+  ySize_ = min(params_->kMaxYSize, max(1, static_cast<int>(
+      ceil((max_pt.y - min_pt_.y) / xy_grid_step_))));
+
+  // Reset the density grid.  The grid is sized to the object, so this only
+  // allocates memory if the grid is larger than any previous one.
+  density_grid_.assign(xSize_ * ySize_, log(smoothing_factor_));
+  height_masks_.assign(xSize_ * ySize_, 0);
+
+  num_spillover_steps_xy_ =
+      ceil(params_->kSpilloverRadius * sigma_xy_ / xy_grid_step_ - 1);
+  // As in DensityGrid3dEvaluator, we spill over at least 1 height bin (and
+  // at most as many as fit in the mask).
+  num_spillover_steps_z_ = min(kNumHeightBins - 2, static_cast<int>(
+      max(1.0, ceil(params_->kSpilloverRadius * sigma_z_ / z_grid_step_ - 1))));
+}
+
+void DensityGrid25dEvaluator::computeDensityGrid(
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& points)
+{
+  // Apply this offset when converting from the point location to the index.
+  const double x_offset = -min_pt_.x / xy_grid_step_;
+  const double y_offset = -min_pt_.y / xy_grid_step_;
+  const double z_offset = -min_pt_.z / z_grid_step_;
+
+  // Convert sigma to a factor such that
+  // exp(-x^2 * grid_size^2 / 2 sigma^2) = exp(x^2 * factor)
+  // where x is the number of grid steps.
+  const double xy_exp_factor =
+      -1.0 * pow(xy_grid_step_, 2) / (2 * pow(sigma_xy_, 2));
+
+  // Pre-compute the density spillover for different cell distances.
+  vector<vector<float> > spillovers(
+        num_spillover_steps_xy_ + 1, vector<float>(
+          num_spillover_steps_xy_ + 1));
+  for (int i = 0; i <= num_spillover_steps_xy_; ++i) {
+    for (int j = 0; j <= num_spillover_steps_xy_; ++j) {
+      const double log_xy_density = (i * i + j * j) * xy_exp_factor;
+      spillovers[i][j] = log(exp(log_xy_density) + smoothing_factor_);
+    }
+  }
+
+  // The height bins within num_spillover_steps_z_ of bin 0.
+  const uint64_t spill_mask =
+      (static_cast<uint64_t>(1) << (num_spillover_steps_z_ + 1)) - 1;
+
+  const size_t num_points = points->size();
+  for (size_t i = 0; i < num_points; ++i) {
+    const pcl::PointXYZRGB& pt = (*points)[i];
+
+    // Find the indices for this point.
+    const int x_index = round(pt.x / xy_grid_step_ + x_offset);
+    const int y_index = round(pt.y / xy_grid_step_ + y_offset);
+    const int z_index = round(pt.z / z_grid_step_ + z_offset);
+
+    // Add limit checks to make sure we don't segfault
+    if (x_index < 1 || x_index > xSize_ - 2) {
+      continue;
+    }
+    if (y_index < 1 || y_index > ySize_ - 2) {
+      continue;
+    }
+
+    // The height bins that this point spills into.
+    const int min_z_index = z_index - num_spillover_steps_z_;
+    const uint64_t point_mask = min_z_index >= 0 ?
+        spill_mask << min_z_index : spill_mask >> -min_z_index;
+
+    // Spill the probability density and the heights into neighboring
+    // regions (but not to the borders, which represent the empty space
+    // around the tracked object).
+    const int max_x_index =
+        max(1, min(xSize_ - 2, x_index + num_spillover_steps_xy_));
+    const int max_y_index =
+        max(1, min(ySize_ - 2, y_index + num_spillover_steps_xy_));
+    const int min_x_index =
+        min(xSize_ - 2, max(1, x_index - num_spillover_steps_xy_));
+    const int min_y_index =
+        min(ySize_ - 2, max(1, y_index - num_spillover_steps_xy_));
+
+    for (int x_spill = min_x_index; x_spill <= max_x_index; ++x_spill) {
+      const int x_diff = abs(x_index - x_spill);
+
+      for (int y_spill = min_y_index; y_spill <= max_y_index; ++y_spill) {
+        const int y_diff = abs(y_index - y_spill);
+
+        const int cell_index = x_spill * ySize_ + y_spill;
+        density_grid_[cell_index] =
+            max(density_grid_[cell_index], spillovers[x_diff][y_diff]);
+        height_masks_[cell_index] |= point_mask;
+      }
+    }
+  }
+}
+
+double DensityGrid25dEvaluator::getLogProbability(
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+    const Eigen::Vector3f& ,
+    const MotionModel& motion_model,
+    const double delta_x, const double delta_y, const double delta_z)
+{
+  // Points at a height with no previous points nearby have the probability
+  // of an empty cell.
+  const float empty_log_density = log(smoothing_factor_);
+
+  // Amount of total log probability density for the given alignment.
+  double total_log_density = 0;
+
+  // Offset to apply to each point to get the new position.
+  const double x_offset = (delta_x - min_pt_.x) / xy_grid_step_;
+  const double y_offset = (delta_y - min_pt_.y) / xy_grid_step_;
+  const double z_offset = (delta_z - min_pt_.z) / z_grid_step_;
+
+  const size_t num_points = current_points->size();
+  for (size_t i = 0; i < num_points; ++i) {
+    const pcl::PointXYZRGB& pt = (*current_points)[i];
+
+    // Shift the point based on the proposed alignment and find its cell.
+    const int x_index_shifted =
+        min(max(0, static_cast<int>(round(pt.x / xy_grid_step_ + x_offset))),
+            xSize_ - 1);
+    const int y_index_shifted =
+        min(max(0, static_cast<int>(round(pt.y / xy_grid_step_ + y_offset))),
+            ySize_ - 1);
+    const int z_index_shifted =
+        min(max(0, static_cast<int>(round(pt.z / z_grid_step_ + z_offset))),
+            kNumHeightBins - 1);
+    const int cell_index = x_index_shifted * ySize_ + y_index_shifted;
+
+    // Look up the log density of this grid cell if there are previous points
+    // near this height.
+    const bool occupied =
+        (height_masks_[cell_index] >> z_index_shifted) & 1;
+    total_log_density +=
+        occupied ? density_grid_[cell_index] : empty_log_density;
+  }
+
+  // Compute the motion model probability.
+  const double motion_model_prob = motion_model.computeScore(
+              delta_x, delta_y, delta_z);
+
+  // Combine the motion model score with the (discounted) measurement score to
+  // get the final log probability.
+  const double log_prob = log(motion_model_prob) +
+      measurement_discount_factor_ * total_log_density;
+
+  return log_prob;
+}
+
+} // namespace precision_tracking
@@ -13,6 +13,7 @@
 #include <pcl/common/common.h>
 
 #include <precision_tracking/density_grid_2d_evaluator.h>
+#include <precision_tracking/trace_recorder.h>
 
 
 namespace precision_tracking {
@@ -32,8 +33,9 @@ DensityGrid2dEvaluator::DensityGrid2dEvaluator(const Params *params)
   : AlignmentEvaluator(params)
   , density_grid_(params_->kMaxXSize, vector<double>(
                     params_->kMaxYSize, log(smoothing_factor_)))
+  , grid_memory_(kDensityGridMemory)
 {
-
+  grid_memory_.set(getGridMemoryUsage());
 }
 
 DensityGrid2dEvaluator::~DensityGrid2dEvaluator()
@@ -41,6 +43,21 @@ DensityGrid2dEvaluator::~DensityGrid2dEvaluator()
 	// TODO Auto-generated destructor stub
 }
 
+size_t DensityGrid2dEvaluator::memoryUsage() const
+{
+  return AlignmentEvaluator::memoryUsage() +
+      (sizeof(*this) - sizeof(AlignmentEvaluator)) + getGridMemoryUsage();
+}
+
+size_t DensityGrid2dEvaluator::getGridMemoryUsage() const
+{
+  size_t bytes = density_grid_.capacity() * sizeof(density_grid_[0]);
+  for (size_t i = 0; i < density_grid_.size(); ++i) {
+    bytes += density_grid_[i].capacity() * sizeof(double);
+  }
+  return bytes;
+}
+
 void DensityGrid2dEvaluator::init(const double xy_sampling_resolution,
           const double z_sampling_resolution,
           const double sensor_horizontal_resolution,
@@ -51,6 +68,8 @@ void DensityGrid2dEvaluator::init(const double xy_sampling_resolution,
                            sensor_horizontal_resolution,
                            sensor_vertical_resolution, num_current_points);
 
+  ScopedTraceEvent trace_event("Build density grid");
+
   computeDensityGridParameters(
         prev_points_, xy_sampling_resolution, sensor_horizontal_resolution);
 
@@ -13,6 +13,7 @@
 #include <pcl/common/common.h>
 
 #include <precision_tracking/density_grid_3d_evaluator.h>
+#include <precision_tracking/trace_recorder.h>
 
 
 namespace precision_tracking {
@@ -33,8 +34,9 @@ DensityGrid3dEvaluator::DensityGrid3dEvaluator(const Params *params)
   , density_grid_(params_->kMaxXSize, vector<vector<double> >(
                     params_->kMaxYSize, vector<double>(
                       params_->kMaxZSize, log(smoothing_factor_))))
+  , grid_memory_(kDensityGridMemory)
 {
-
+  grid_memory_.set(getGridMemoryUsage());
 }
 
 DensityGrid3dEvaluator::~DensityGrid3dEvaluator()
@@ -42,6 +44,24 @@ DensityGrid3dEvaluator::~DensityGrid3dEvaluator()
 	// TODO Auto-generated destructor stub
 }
 
+size_t DensityGrid3dEvaluator::memoryUsage() const
+{
+  return AlignmentEvaluator::memoryUsage() +
+      (sizeof(*this) - sizeof(AlignmentEvaluator)) + getGridMemoryUsage();
+}
+
+size_t DensityGrid3dEvaluator::getGridMemoryUsage() const
+{
+  size_t bytes = density_grid_.capacity() * sizeof(density_grid_[0]);
+  for (size_t i = 0; i < density_grid_.size(); ++i) {
+    bytes += density_grid_[i].capacity() * sizeof(density_grid_[i][0]);
+    for (size_t j = 0; j < density_grid_[i].size(); ++j) {
+      bytes += density_grid_[i][j].capacity() * sizeof(double);
+    }
+  }
+  return bytes;
+}
+
 void DensityGrid3dEvaluator::init(const double xy_sampling_resolution,
           const double z_sampling_resolution,
           const double sensor_horizontal_resolution,
@@ -52,6 +72,8 @@ void DensityGrid3dEvaluator::init(const double xy_sampling_resolution,
                            sensor_horizontal_resolution,
                            sensor_vertical_resolution, num_current_points);
 
+  ScopedTraceEvent trace_event("Build density grid");
+
   computeDensityGridParameters(
         prev_points_, xy_sampling_resolution, z_sampling_resolution,
         sensor_horizontal_resolution, sensor_vertical_resolution);
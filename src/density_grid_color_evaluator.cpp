@@ -0,0 +1,346 @@
+/*
+ * density_grid_color_evaluator.cpp
+ *
+ *      Author: davheld
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <pcl/common/common.h>
+
+#include <precision_tracking/density_grid_color_evaluator.h>
+#include <precision_tracking/trace_recorder.h>
+
+namespace precision_tracking {
+
+namespace {
+
+using std::vector;
+using std::max;
+using std::min;
+
+} // namespace
+
+DensityGridColorEvaluator::DensityGridColorEvaluator(const Params *params)
+  : AlignmentEvaluator(params),
+    grid_memory_(kDensityGridMemory),
+    xSize_(0),
+    ySize_(0),
+    xy_grid_step_(0),
+    num_spillover_steps_xy_(0),
+    prob_color_match_(0)
+{
+}
+
+DensityGridColorEvaluator::~DensityGridColorEvaluator()
+{
+}
+
+size_t DensityGridColorEvaluator::memoryUsage() const
+{
+  return AlignmentEvaluator::memoryUsage() +
+      (sizeof(*this) - sizeof(AlignmentEvaluator)) + getGridMemoryUsage();
+}
+
+size_t DensityGridColorEvaluator::getGridMemoryUsage() const
+{
+  return density_grid_.capacity() * sizeof(ColorCell) +
+      color_sums_.capacity() * sizeof(ColorSums) +
+      occupied_cells_.capacity() * sizeof(int);
+}
+
+void DensityGridColorEvaluator::init(const double xy_sampling_resolution,
+          const double z_sampling_resolution,
+          const double sensor_horizontal_resolution,
+          const double sensor_vertical_resolution,
+          const size_t num_current_points)
+{
+  AlignmentEvaluator::init(xy_sampling_resolution, z_sampling_resolution,
+                           sensor_horizontal_resolution,
+                           sensor_vertical_resolution, num_current_points);
+
+  ScopedTraceEvent trace_event("Build color density grid");
+
+  // Set the probability of seeing a color match, as in LF_RGBD_6D_Evaluator.
+  const double sampling_resolution = sqrt(pow(xy_sampling_resolution, 2) +
+                                          pow(z_sampling_resolution, 2));
+  if (params_->kColorThreshFactor == 0) {
+    prob_color_match_ = params_->kProbColorMatch;
+  } else {
+    prob_color_match_ = params_->kProbColorMatch *
+        exp(-pow(sampling_resolution, 2) /
+            (2 * pow(params_->kColorThreshFactor, 2)));
+  }
+
+  computeDensityGridParameters(prev_points_, xy_sampling_resolution);
+
+  computeDensityGrid(prev_points_);
+
+  grid_memory_.set(getGridMemoryUsage());
+}
+
+void DensityGridColorEvaluator::computeDensityGridParameters(
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& prev_points,
+    const double xy_sampling_resolution)
+{
+  xy_grid_step_ = xy_sampling_resolution;
+
+  // Find the min and max of the previous points.
+  pcl::PointXYZRGB max_pt;
+  pcl::getMinMax3D(*prev_points, min_pt_, max_pt);
+
+  const double epsilon = 0.0001;
+
+  // As in DensityGrid2dEvaluator, we add padding to allow for inexact
+  // matches.  The outer grid cells are kept empty and are used to represent
+  // the empty space around the tracked object.
+  min_pt_.x -= (2 * xy_grid_step_ + epsilon);
+  min_pt_.y -= (2 * xy_grid_step_ + epsilon);
+  max_pt.x += 2 * xy_grid_step_;
+  max_pt.y += 2 * xy_grid_step_;
+
+  xSize_ = min(params_->kMaxXSize, max(1, static_cast<int>(
+      ceil((max_pt.x - min_pt_.x) / xy_grid_step_))));
+  ySize_ = min(params_->kMaxYSize, max(1, static_cast<int>(
+      ceil((max_pt.y - min_pt_.y) / xy_grid_step_))));
+
+  // Reset the grid.  The grid is sized to the object, so this only
+  // allocates memory if the grid is larger than any previous one.
+  ColorCell empty_cell;
+  empty_cell.spatial_prob = 0;
+  empty_cell.color1 = 0;
+  empty_cell.color2 = 0;
+  empty_cell.spread1 = 0;
+  empty_cell.spread2 = 0;
+  density_grid_.assign(xSize_ * ySize_, empty_cell);
+
+  ColorSums empty_sums;
+  empty_sums.num_points = 0;
+  empty_sums.color1 = 0;
+  empty_sums.color2 = 0;
+  empty_sums.abs_deviation1 = 0;
+  empty_sums.abs_deviation2 = 0;
+  color_sums_.assign(xSize_ * ySize_, empty_sums);
+  occupied_cells_.clear();
+
+  num_spillover_steps_xy_ =
+      ceil(params_->kSpilloverRadius * sigma_xy_ / xy_grid_step_ - 1);
+}
+
+void DensityGridColorEvaluator::getColors(const pcl::PointXYZRGB& point,
+                                          float* color1, float* color2) const
+{
+  if (params_->kColorSpace == 0) {
+    // Blue and Green.
+    *color1 = point.b;
+    *color2 = point.g;
+  } else if (params_->kColorSpace == 1) {
+    // Mean of RGB.
+    *color1 = (point.r + point.g + point.b) / 3;
+    *color2 = 0;
+  } else {
+    printf("Unknown color space: %d\n", params_->kColorSpace);
+    exit(1);
+  }
+}
+
+int DensityGridColorEvaluator::getCellIndex(
+    const pcl::PointXYZRGB& point) const
+{
+  const int x_index = round((point.x - min_pt_.x) / xy_grid_step_);
+  const int y_index = round((point.y - min_pt_.y) / xy_grid_step_);
+
+  if (x_index < 1 || x_index > xSize_ - 2 ||
+      y_index < 1 || y_index > ySize_ - 2) {
+    return -1;
+  }
+  return x_index * ySize_ + y_index;
+}
+
+void DensityGridColorEvaluator::computeDensityGrid(
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& points)
+{
+  const size_t num_points = points->size();
+
+  // Compute the mean color of the points in each cell.
+  for (size_t i = 0; i < num_points; ++i) {
+    const pcl::PointXYZRGB& pt = (*points)[i];
+    const int cell_index = getCellIndex(pt);
+    if (cell_index < 0) {
+      continue;
+    }
+
+    float color1, color2;
+    getColors(pt, &color1, &color2);
+
+    ColorSums& sums = color_sums_[cell_index];
+    if (sums.num_points == 0) {
+      occupied_cells_.push_back(cell_index);
+    }
+    sums.num_points++;
+    sums.color1 += color1;
+    sums.color2 += color2;
+  }
+
+  for (size_t i = 0; i < occupied_cells_.size(); ++i) {
+    ColorSums& sums = color_sums_[occupied_cells_[i]];
+    sums.color1 /= sums.num_points;
+    sums.color2 /= sums.num_points;
+  }
+
+  // Compute the mean absolute deviation of the colors in each cell, which
+  // widens the color Laplacian for cells with mixed colors.
+  for (size_t i = 0; i < num_points; ++i) {
+    const pcl::PointXYZRGB& pt = (*points)[i];
+    const int cell_index = getCellIndex(pt);
+    if (cell_index < 0) {
+      continue;
+    }
+
+    float color1, color2;
+    getColors(pt, &color1, &color2);
+
+    ColorSums& sums = color_sums_[cell_index];
+    sums.abs_deviation1 += fabs(color1 - sums.color1) / sums.num_points;
+    sums.abs_deviation2 += fabs(color2 - sums.color2) / sums.num_points;
+  }
+
+  // Convert sigma to a factor such that
+  // exp(-x^2 * grid_size^2 / 2 sigma^2) = exp(x^2 * factor)
+  // where x is the number of grid steps.
+  const double xy_exp_factor =
+      -1.0 * pow(xy_grid_step_, 2) / (2 * pow(sigma_xy_, 2));
+
+  // Pre-compute the density spillover for different cell distances.
+  vector<vector<float> > spillovers(
+        num_spillover_steps_xy_ + 1, vector<float>(
+          num_spillover_steps_xy_ + 1));
+  for (int i = 0; i <= num_spillover_steps_xy_; ++i) {
+    for (int j = 0; j <= num_spillover_steps_xy_; ++j) {
+      spillovers[i][j] = exp((i * i + j * j) * xy_exp_factor);
+    }
+  }
+
+  // Spill the probability of each occupied cell into neighboring cells as a
+  // Gaussian (but not to the borders).  Each cell keeps the maximum
+  // probability, as in DensityGrid2dEvaluator, along with the colors of the
+  // cell that it came from.
+  for (size_t i = 0; i < occupied_cells_.size(); ++i) {
+    const int cell_index = occupied_cells_[i];
+    const ColorSums& sums = color_sums_[cell_index];
+    const int x_index = cell_index / ySize_;
+    const int y_index = cell_index % ySize_;
+
+    const int max_x_index =
+        max(1, min(xSize_ - 2, x_index + num_spillover_steps_xy_));
+    const int max_y_index =
+        max(1, min(ySize_ - 2, y_index + num_spillover_steps_xy_));
+    const int min_x_index =
+        min(xSize_ - 2, max(1, x_index - num_spillover_steps_xy_));
+    const int min_y_index =
+        min(ySize_ - 2, max(1, y_index - num_spillover_steps_xy_));
+
+    for (int x_spill = min_x_index; x_spill <= max_x_index; ++x_spill) {
+      const int x_diff = abs(x_index - x_spill);
+
+      for (int y_spill = min_y_index; y_spill <= max_y_index; ++y_spill) {
+        const int y_diff = abs(y_index - y_spill);
+
+        const float spillover = spillovers[x_diff][y_diff];
+        ColorCell& cell = density_grid_[x_spill * ySize_ + y_spill];
+        if (spillover > cell.spatial_prob) {
+          cell.spatial_prob = spillover;
+          cell.color1 = sums.color1;
+          cell.color2 = sums.color2;
+          cell.spread1 = sums.abs_deviation1;
+          cell.spread2 = sums.abs_deviation2;
+        }
+      }
+    }
+  }
+}
+
+double DensityGridColorEvaluator::getLogProbability(
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+    const Eigen::Vector3f& ,
+    const MotionModel& motion_model,
+    const double delta_x, const double delta_y, const double delta_z)
+{
+  // Because we are using color, we have to modify the smoothing factor, as
+  // in LF_RGBD_6D_Evaluator.
+  const double factor1 = smoothing_factor_ / (smoothing_factor_ + 1);
+  const double color_range =
+      params_->kTwoColors ? pow(255, 2) : 255;
+  const double color_smoothing_factor = factor1 / color_range;
+
+  // Amount of total log probability density for the given alignment.
+  double total_log_density = 0;
+
+  // Offset to apply to each point to get the new position.
+  const double x_offset = (delta_x - min_pt_.x) / xy_grid_step_;
+  const double y_offset = (delta_y - min_pt_.y) / xy_grid_step_;
+
+  const size_t num_points = current_points->size();
+  for (size_t i = 0; i < num_points; ++i) {
+    const pcl::PointXYZRGB& pt = (*current_points)[i];
+
+    // Shift the point based on the proposed alignment and find its cell.
+    const int x_index_shifted =
+        min(max(0, static_cast<int>(round(pt.x / xy_grid_step_ + x_offset))),
+            xSize_ - 1);
+    const int y_index_shifted =
+        min(max(0, static_cast<int>(round(pt.y / xy_grid_step_ + y_offset))),
+            ySize_ - 1);
+    const ColorCell& cell =
+        density_grid_[x_index_shifted * ySize_ + y_index_shifted];
+
+    const double smoothing_factor =
+        color_smoothing_factor * (1 - cell.spatial_prob);
+    if (cell.spatial_prob == 0) {
+      total_log_density += log(smoothing_factor);
+      continue;
+    }
+
+    float color1, color2;
+    getColors(pt, &color1, &color2);
+
+    // Compare the color of the point to the mean color of the cell, with
+    // the Laplacian widened by the spread of the colors in the cell.
+    const double color_exp_factor1 =
+        -1.0 / (params_->kValueSigma1 + cell.spread1);
+    const double color_distance1 = fabs(color1 - cell.color1);
+    double color_prob;
+    if (params_->kTwoColors) {
+      const double color_exp_factor2 =
+          -1.0 / (params_->kValueSigma2 + cell.spread2);
+      const double color_distance2 = fabs(color2 - cell.color2);
+      color_prob =
+          -0.5 * color_exp_factor1 * exp(color_distance1 * color_exp_factor1) *
+          -0.5 * color_exp_factor2 * exp(color_distance2 * color_exp_factor2);
+    } else {
+      color_prob =
+          -1 * color_exp_factor1 * exp(color_distance1 * color_exp_factor1);
+    }
+
+    const double point_prob = cell.spatial_prob *
+        ((1 - prob_color_match_) / color_range +
+         prob_color_match_ * color_prob) + smoothing_factor;
+
+    total_log_density += log(point_prob);
+  }
+
+  // Compute the motion model probability.
+  const double motion_model_prob = motion_model.computeScore(
+              delta_x, delta_y, delta_z);
+
+  // Combine the motion model score with the (discounted) measurement score to
+  // get the final log probability.
+  const double log_prob = log(motion_model_prob) +
+      measurement_discount_factor_ * total_log_density;
+
+  return log_prob;
+}
+
+} // namespace precision_tracking
@@ -0,0 +1,203 @@
+/*
+ * density_grid_small_batch.cpp
+ *
+ *      Author: davheld
+ *
+ */
+
+#include <algorithm>
+
+#include <precision_tracking/alignment_evaluator.h>
+#include <precision_tracking/density_grid_small_batch.h>
+#include <precision_tracking/density_grid_small_evaluator.h>
+#include <precision_tracking/trace_recorder.h>
+
+namespace precision_tracking {
+
+namespace {
+
+using std::max;
+using std::min;
+using std::vector;
+
+const int kGridSize = DensityGridSmallEvaluator::kGridSize;
+const int kGridCells = kGridSize * kGridSize;
+
+// Unlike std::min and std::max, these return values rather than
+// references, which the compiler can vectorize.
+inline float minValue(const float a, const float b)
+{
+  return b < a ? b : a;
+}
+
+inline float maxValue(const float a, const float b)
+{
+  return a < b ? b : a;
+}
+
+} // namespace
+
+DensityGridSmallBatch::DensityGridSmallBatch(const Params* params)
+  : params_(params),
+    grid_arena_(kBlockSize * kGridCells),
+    grid_memory_(kDensityGridMemory, grid_arena_.capacity() * sizeof(float))
+{
+}
+
+size_t DensityGridSmallBatch::memoryUsage() const
+{
+  return sizeof(*this) +
+      (grid_arena_.capacity() + x_.capacity() + y_.capacity() +
+       weights_.capacity()) * sizeof(float);
+}
+
+void DensityGridSmallBatch::score3DTransforms(
+    const vector<SmallAlignmentProblem>& problems,
+    const double xy_sampling_resolution,
+    vector<ScoredTransforms<ScoredTransformXYZ> >* scored_transforms)
+{
+  scored_transforms->resize(problems.size());
+  for (size_t begin = 0; begin < problems.size(); begin += kBlockSize) {
+    const size_t end = min(problems.size(), begin + kBlockSize);
+    scoreBlock(problems, begin, end, xy_sampling_resolution,
+               scored_transforms);
+  }
+}
+
+void DensityGridSmallBatch::scoreBlock(
+    const vector<SmallAlignmentProblem>& problems,
+    const size_t begin, const size_t end,
+    const double xy_sampling_resolution,
+    vector<ScoredTransforms<ScoredTransformXYZ> >* scored_transforms)
+{
+  ScopedTraceEvent trace_event("Score block", -1, -1, end - begin);
+
+  const int num_lanes = end - begin;
+  const double xy_grid_step = xy_sampling_resolution;
+
+  // The geometry of the grid of each lane.  Unused lanes look up cell 0 of
+  // the first grid with a weight of 0.
+  float max_x[kBlockSize];
+  float max_y[kBlockSize];
+  int grid_offsets[kBlockSize];
+  double min_x[kBlockSize];
+  double min_y[kBlockSize];
+  double discount_factors[kBlockSize];
+  size_t max_num_points = 0;
+  size_t max_num_transforms = 0;
+  for (int l = 0; l < kBlockSize; ++l) {
+    max_x[l] = 0;
+    max_y[l] = 0;
+    grid_offsets[l] = 0;
+    if (l >= num_lanes) {
+      continue;
+    }
+
+    const SmallAlignmentProblem& problem = problems[begin + l];
+    if (problem.current_points->size() >
+        static_cast<size_t>(DensityGridSmallEvaluator::kMaxPoints)) {
+      printf("Error - %zu current points is more than the %d points that "
+             "DensityGridSmallBatch can hold\n",
+             problem.current_points->size(),
+             DensityGridSmallEvaluator::kMaxPoints);
+      exit(1);
+    }
+
+    const double sigma_xy = AlignmentEvaluator::computeSigmaXY(
+          params_, xy_sampling_resolution, problem.xy_sensor_resolution);
+    int x_size;
+    int y_size;
+    DensityGridSmallEvaluator::buildGrid(
+          *problem.prev_points, xy_grid_step, sigma_xy, params_,
+          &grid_arena_[l * kGridCells], &min_x[l], &min_y[l],
+          &x_size, &y_size);
+    max_x[l] = x_size - 1;
+    max_y[l] = y_size - 1;
+    grid_offsets[l] = l * kGridCells;
+
+    discount_factors[l] = AlignmentEvaluator::computeMeasurementDiscountFactor(
+          params_, problem.current_points->size());
+
+    max_num_points = max(max_num_points, problem.current_points->size());
+    max_num_transforms = max(max_num_transforms, problem.transforms->size());
+  }
+
+  // Interleave the current points of the lanes, in grid units.
+  x_.assign(max_num_points * kBlockSize, 0);
+  y_.assign(max_num_points * kBlockSize, 0);
+  weights_.assign(max_num_points * kBlockSize, 0);
+  for (int l = 0; l < num_lanes; ++l) {
+    const pcl::PointCloud<pcl::PointXYZRGB>& current_points =
+        *problems[begin + l].current_points;
+    const double x_offset = -min_x[l] / xy_grid_step;
+    const double y_offset = -min_y[l] / xy_grid_step;
+    for (size_t i = 0; i < current_points.size(); ++i) {
+      const pcl::PointXYZRGB& pt = current_points[i];
+      x_[i * kBlockSize + l] = pt.x / xy_grid_step + x_offset;
+      y_[i * kBlockSize + l] = pt.y / xy_grid_step + y_offset;
+      weights_[i * kBlockSize + l] = 1;
+    }
+  }
+
+  for (int l = 0; l < num_lanes; ++l) {
+    ScoredTransforms<ScoredTransformXYZ>& lane_scores =
+        (*scored_transforms)[begin + l];
+    lane_scores.clear();
+    lane_scores.resize(problems[begin + l].transforms->size());
+  }
+
+  // Score transform t of every lane together.
+  const float* grid = &grid_arena_[0];
+  for (size_t t = 0; t < max_num_transforms; ++t) {
+    float x_shifts[kBlockSize];
+    float y_shifts[kBlockSize];
+    for (int l = 0; l < kBlockSize; ++l) {
+      x_shifts[l] = 0;
+      y_shifts[l] = 0;
+      if (l < num_lanes && t < problems[begin + l].transforms->size()) {
+        const XYZTransform& transform = (*problems[begin + l].transforms)[t];
+        x_shifts[l] = transform.x / xy_grid_step;
+        y_shifts[l] = transform.y / xy_grid_step;
+      }
+    }
+
+    // As in DensityGridSmallEvaluator, each point is clamped to its grid
+    // before rounding, so that rounding is a truncation.
+    float sums[kBlockSize];
+    std::fill(sums, sums + kBlockSize, 0.0f);
+    for (size_t i = 0; i < max_num_points; ++i) {
+      const float* xs = &x_[i * kBlockSize];
+      const float* ys = &y_[i * kBlockSize];
+      const float* ws = &weights_[i * kBlockSize];
+      for (int l = 0; l < kBlockSize; ++l) {
+        const float x = minValue(maxValue(xs[l] + x_shifts[l], 0.0f), max_x[l]);
+        const float y = minValue(maxValue(ys[l] + y_shifts[l], 0.0f), max_y[l]);
+        const int index = grid_offsets[l] +
+            static_cast<int>(x + 0.5f) * kGridSize +
+            static_cast<int>(y + 0.5f);
+        sums[l] += ws[l] * grid[index];
+      }
+    }
+
+    for (int l = 0; l < num_lanes; ++l) {
+      const SmallAlignmentProblem& problem = problems[begin + l];
+      if (t >= problem.transforms->size()) {
+        continue;
+      }
+      const XYZTransform& transform = (*problem.transforms)[t];
+
+      // Combine the motion model score with the (discounted) measurement
+      // score to get the final log probability.
+      const double log_prob =
+          log(problem.motion_model->computeScore(
+                transform.x, transform.y, transform.z)) +
+          discount_factors[l] * sums[l];
+
+      (*scored_transforms)[begin + l].set(ScoredTransformXYZ(
+            transform.x, transform.y, transform.z, log_prob,
+            transform.volume), t);
+    }
+  }
+}
+
+} // namespace precision_tracking
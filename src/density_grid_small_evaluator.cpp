@@ -0,0 +1,313 @@
+/*
+ * density_grid_small_evaluator.cpp
+ *
+ *      Author: davheld
+ *
+ */
+
+#include <stdlib.h>
+
+#include <pcl/common/common.h>
+
+#include <precision_tracking/density_grid_small_evaluator.h>
+#include <precision_tracking/trace_recorder.h>
+
+namespace precision_tracking {
+
+namespace {
+
+using std::max;
+using std::min;
+
+// Number of cells of padding on each side of the previous points, as in
+// DensityGrid2dEvaluator.
+const int kPadding = 2;
+
+// Look up the log density of the cell of the point (x, y), in grid units.
+// The point is clamped to the grid before rounding, so that rounding is a
+// truncation of a non-negative number.
+inline float lookup(const float* density_grid, const float x, const float y,
+                    const float max_x, const float max_y)
+{
+  const int x_index = static_cast<int>(min(max(x, 0.0f), max_x) + 0.5f);
+  const int y_index = static_cast<int>(min(max(y, 0.0f), max_y) + 0.5f);
+  return density_grid[x_index * DensityGridSmallEvaluator::kGridSize +
+                      y_index];
+}
+
+} // namespace
+
+DensityGridSmallEvaluator::DensityGridSmallEvaluator(const Params *params)
+  : AlignmentEvaluator(params),
+    grid_memory_(kDensityGridMemory),
+    xSize_(0),
+    ySize_(0),
+    xy_grid_step_(0),
+    min_x_(0),
+    min_y_(0),
+    num_points_(0)
+{
+  grid_memory_.set(sizeof(density_grid_));
+}
+
+DensityGridSmallEvaluator::~DensityGridSmallEvaluator()
+{
+}
+
+bool DensityGridSmallEvaluator::fits(
+    const pcl::PointCloud<pcl::PointXYZRGB>& current_points,
+    const pcl::PointCloud<pcl::PointXYZRGB>& prev_points,
+    const double xy_sampling_resolution)
+{
+  if (current_points.size() > static_cast<size_t>(kMaxPoints) ||
+      prev_points.empty() || xy_sampling_resolution <= 0) {
+    return false;
+  }
+
+  pcl::PointXYZRGB min_pt;
+  pcl::PointXYZRGB max_pt;
+  pcl::getMinMax3D(prev_points, min_pt, max_pt);
+
+  // Leave one extra cell for rounding.
+  const double max_size =
+      (kGridSize - 2 * kPadding - 1) * xy_sampling_resolution;
+  return max_pt.x - min_pt.x <= max_size && max_pt.y - min_pt.y <= max_size;
+}
+
+size_t DensityGridSmallEvaluator::memoryUsage() const
+{
+  return AlignmentEvaluator::memoryUsage() +
+      (sizeof(*this) - sizeof(AlignmentEvaluator));
+}
+
+void DensityGridSmallEvaluator::score3DTransforms(
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+    const Eigen::Vector3f& ,
+    const double xy_sampling_resolution,
+    const double z_sampling_resolution,
+    const double sensor_horizontal_resolution,
+    const double sensor_vertical_resolution,
+    const std::vector<XYZTransform>& transforms,
+    const MotionModel& motion_model,
+    ScoredTransforms<ScoredTransformXYZ>* scored_transforms)
+{
+  init(xy_sampling_resolution, z_sampling_resolution,
+       sensor_horizontal_resolution, sensor_vertical_resolution,
+       current_points->size());
+
+  // Convert the current points to grid units once for all of the transforms.
+  setCurrentPoints(current_points);
+
+  const size_t num_transforms = transforms.size();
+  scored_transforms->clear();
+  scored_transforms->resize(num_transforms);
+
+  for (size_t i = 0; i < num_transforms; ++i) {
+    const XYZTransform& transform = transforms[i];
+
+    const double total_log_density = computeLogDensity(
+          transform.x / xy_grid_step_, transform.y / xy_grid_step_);
+
+    // Combine the motion model score with the (discounted) measurement score
+    // to get the final log probability.
+    const double log_prob =
+        log(motion_model.computeScore(transform.x, transform.y, transform.z)) +
+        measurement_discount_factor_ * total_log_density;
+
+    scored_transforms->set(ScoredTransformXYZ(
+          transform.x, transform.y, transform.z, log_prob, transform.volume),
+                           i);
+  }
+}
+
+void DensityGridSmallEvaluator::init(const double xy_sampling_resolution,
+          const double z_sampling_resolution,
+          const double sensor_horizontal_resolution,
+          const double sensor_vertical_resolution,
+          const size_t num_current_points)
+{
+  AlignmentEvaluator::init(xy_sampling_resolution, z_sampling_resolution,
+                           sensor_horizontal_resolution,
+                           sensor_vertical_resolution, num_current_points);
+
+  ScopedTraceEvent trace_event("Build density grid");
+
+  xy_grid_step_ = xy_sampling_resolution;
+  buildGrid(*prev_points_, xy_grid_step_, sigma_xy_, params_, density_grid_,
+            &min_x_, &min_y_, &xSize_, &ySize_);
+}
+
+void DensityGridSmallEvaluator::buildGrid(
+    const pcl::PointCloud<pcl::PointXYZRGB>& prev_points,
+    const double xy_grid_step, const double sigma_xy, const Params* params,
+    float* cells, double* min_x, double* min_y, int* x_size, int* y_size)
+{
+  // Find the min and max of the previous points.
+  pcl::PointXYZRGB min_pt;
+  pcl::PointXYZRGB max_pt;
+  pcl::getMinMax3D(prev_points, min_pt, max_pt);
+
+  const double epsilon = 0.0001;
+
+  // As in DensityGrid2dEvaluator, we add padding to allow for inexact
+  // matches.  The outer grid cells are kept empty and are used to represent
+  // the empty space around the tracked object.
+  *min_x = min_pt.x - (kPadding * xy_grid_step + epsilon);
+  *min_y = min_pt.y - (kPadding * xy_grid_step + epsilon);
+  const double max_x = max_pt.x + kPadding * xy_grid_step;
+  const double max_y = max_pt.y + kPadding * xy_grid_step;
+
+  const int xSize = min(kGridSize, max(1, static_cast<int>(
+      ceil((max_x - *min_x) / xy_grid_step))));
+  const int ySize = min(kGridSize, max(1, static_cast<int>(
+      ceil((max_y - *min_y) / xy_grid_step))));
+  *x_size = xSize;
+  *y_size = ySize;
+
+  // Reset the part of the density grid that covers the object.
+  const float default_val = log(params->kSmoothingFactor);
+  for (int i = 0; i < xSize; ++i) {
+    std::fill(cells + i * kGridSize, cells + i * kGridSize + ySize,
+              default_val);
+  }
+
+  // Cells farther than the size of the grid are never reached.
+  const int num_spillover_steps_xy = min(kGridSize - 1, static_cast<int>(
+      ceil(params->kSpilloverRadius * sigma_xy / xy_grid_step - 1)));
+
+  // Convert sigma to a factor such that
+  // exp(-x^2 * grid_size^2 / 2 sigma^2) = exp(x^2 * factor)
+  // where x is the number of grid steps.
+  const double xy_exp_factor =
+      -1.0 * pow(xy_grid_step, 2) / (2 * pow(sigma_xy, 2));
+
+  // Pre-compute the density spillover for different cell distances.
+  float spillovers[kGridSize][kGridSize];
+  for (int i = 0; i <= num_spillover_steps_xy; ++i) {
+    for (int j = 0; j <= num_spillover_steps_xy; ++j) {
+      const double log_xy_density = (i * i + j * j) * xy_exp_factor;
+      spillovers[i][j] =
+          log(exp(log_xy_density) + params->kSmoothingFactor);
+    }
+  }
+
+  // Apply this offset when converting from the point location to the index.
+  const double x_offset = -*min_x / xy_grid_step;
+  const double y_offset = -*min_y / xy_grid_step;
+
+  const size_t num_points = prev_points.size();
+  for (size_t i = 0; i < num_points; ++i) {
+    const pcl::PointXYZRGB& pt = prev_points[i];
+
+    // Find the indices for this point.
+    const int x_index = round(pt.x / xy_grid_step + x_offset);
+    const int y_index = round(pt.y / xy_grid_step + y_offset);
+
+    // Add limit checks to make sure we don't segfault
+    if (x_index < 1 || x_index > xSize - 2) {
+      continue;
+    }
+    if (y_index < 1 || y_index > ySize - 2) {
+      continue;
+    }
+
+    // Spill the probability density into neighboring regions (but not to
+    // the borders, which represent the empty space around the tracked
+    // object).
+    const int max_x_index =
+        max(1, min(xSize - 2, x_index + num_spillover_steps_xy));
+    const int max_y_index =
+        max(1, min(ySize - 2, y_index + num_spillover_steps_xy));
+    const int min_x_index =
+        min(xSize - 2, max(1, x_index - num_spillover_steps_xy));
+    const int min_y_index =
+        min(ySize - 2, max(1, y_index - num_spillover_steps_xy));
+
+    for (int x_spill = min_x_index; x_spill <= max_x_index; ++x_spill) {
+      const int x_diff = abs(x_index - x_spill);
+      float* row = cells + x_spill * kGridSize;
+
+      for (int y_spill = min_y_index; y_spill <= max_y_index; ++y_spill) {
+        const int y_diff = abs(y_index - y_spill);
+        row[y_spill] = max(row[y_spill], spillovers[x_diff][y_diff]);
+      }
+    }
+  }
+}
+
+void DensityGridSmallEvaluator::setCurrentPoints(
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points)
+{
+  if (current_points->size() > static_cast<size_t>(kMaxPoints)) {
+    printf("Error - %zu current points is more than the %d points that "
+           "DensityGridSmallEvaluator can hold\n",
+           current_points->size(), kMaxPoints);
+    exit(1);
+  }
+
+  const double x_offset = -min_x_ / xy_grid_step_;
+  const double y_offset = -min_y_ / xy_grid_step_;
+
+  num_points_ = current_points->size();
+  for (int i = 0; i < num_points_; ++i) {
+    const pcl::PointXYZRGB& pt = (*current_points)[i];
+    x_[i] = pt.x / xy_grid_step_ + x_offset;
+    y_[i] = pt.y / xy_grid_step_ + y_offset;
+  }
+}
+
+double DensityGridSmallEvaluator::computeLogDensity(
+    const float x_shift, const float y_shift) const
+{
+  const float max_x = xSize_ - 1;
+  const float max_y = ySize_ - 1;
+
+  // Unroll by 4 with independent sums, so that the lookups are not
+  // serialized by the additions.
+  float sum0 = 0;
+  float sum1 = 0;
+  float sum2 = 0;
+  float sum3 = 0;
+  int i = 0;
+  for (; i + 4 <= num_points_; i += 4) {
+    sum0 += lookup(density_grid_, x_[i] + x_shift, y_[i] + y_shift,
+                   max_x, max_y);
+    sum1 += lookup(density_grid_, x_[i + 1] + x_shift, y_[i + 1] + y_shift,
+                   max_x, max_y);
+    sum2 += lookup(density_grid_, x_[i + 2] + x_shift, y_[i + 2] + y_shift,
+                   max_x, max_y);
+    sum3 += lookup(density_grid_, x_[i + 3] + x_shift, y_[i + 3] + y_shift,
+                   max_x, max_y);
+  }
+  for (; i < num_points_; ++i) {
+    sum0 += lookup(density_grid_, x_[i] + x_shift, y_[i] + y_shift,
+                   max_x, max_y);
+  }
+
+  return (sum0 + sum1) + (sum2 + sum3);
+}
+
+double DensityGridSmallEvaluator::getLogProbability(
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+    const Eigen::Vector3f& ,
+    const MotionModel& motion_model,
+    const double delta_x, const double delta_y, const double delta_z)
+{
+  setCurrentPoints(current_points);
+
+  const double total_log_density = computeLogDensity(
+        delta_x / xy_grid_step_, delta_y / xy_grid_step_);
+
+  // Compute the motion model probability.
+  const double motion_model_prob = motion_model.computeScore(
+              delta_x, delta_y, delta_z);
+
+  // Combine the motion model score with the (discounted) measurement score to
+  // get the final log probability.
+  const double log_prob = log(motion_model_prob) +
+      measurement_discount_factor_ * total_log_density;
+
+  return log_prob;
+}
+
+} // namespace precision_tracking
@@ -10,6 +10,7 @@
 #include <utility>
 #include <vector>
 #include <algorithm>
+#include <limits>
 
 #include <pcl/common/common.h>
 #include <pcl/common/transforms.h>
@@ -17,6 +18,7 @@
 #include <boost/math/constants/constants.hpp>
 
 #include <precision_tracking/lf_rgbd_6d_evaluator.h>
+#include <precision_tracking/trace_recorder.h>
 
 
 using std::max;
@@ -32,16 +34,22 @@ namespace {
 
 const double pi = boost::math::constants::pi<double>();
 
+float getSquaredDistance(const pcl::PointXYZRGB& a, const pcl::PointXYZRGB& b)
+{
+  const float dx = a.x - b.x;
+  const float dy = a.y - b.y;
+  const float dz = a.z - b.z;
+  return dx * dx + dy * dy + dz * dz;
+}
+
 } // namespace
 
 
 LF_RGBD_6D_Evaluator::LF_RGBD_6D_Evaluator(const Params *params)
     : AlignmentEvaluator(params),
-      searchTree_(false),  //  //By setting sorted to false,
-                                // the radiusSearch operations will be faster.
-      max_nn_(1),
-      nn_indices_(max_nn_),
-      nn_sq_dists_(max_nn_),
+      search_tree_memory_(kSearchTreeMemory),
+      num_graph_neighbors_(0),
+      use_warm_start_(false),
       use_color_(params->useColor),
       color_exp_factor1_(-1.0 / params_->kValueSigma1),
       color_exp_factor2_(-1.0 / params_->kValueSigma2)
@@ -56,14 +64,86 @@ LF_RGBD_6D_Evaluator::~LF_RGBD_6D_Evaluator()
 void LF_RGBD_6D_Evaluator::setPrevPoints(
     const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr prev_points)
 {
+  // Keep the search tree and the neighbor graph if the points are the same
+  // (e.g. the same frame is the model of two alignments in a row).
+  if (prev_points == prev_points_) {
+    return;
+  }
+
   AlignmentEvaluator::setPrevPoints(prev_points);
 
-  // Set the input cloud for the search tree to the previous points for NN
-  // lookups.
-  searchTree_.setInputCloud(prev_points_);
+  ScopedTraceEvent trace_event("Build search tree");
+
+  // Build the search tree from the previous points for NN lookups.
+  searchTree_.build(*prev_points_);
+
+  // The neighbor graph and the warm starts refer to the old points.
+  neighbor_graph_.clear();
+  neighbor_radius_sq_.clear();
+  warm_start_indices_.clear();
+
+  search_tree_memory_.set(getSearchTreeMemoryUsage());
+}
+
+void LF_RGBD_6D_Evaluator::computeNeighborGraph()
+{
+  ScopedTraceEvent trace_event("Build neighbor graph");
+
+  const int num_prev_points = prev_points_->size();
+  num_graph_neighbors_ =
+      max(0, min(params_->kNeighborGraphSize, num_prev_points - 1));
+
+  neighbor_graph_.resize(num_prev_points * num_graph_neighbors_);
+  neighbor_radius_sq_.resize(num_prev_points);
+
+  std::vector<int> indices;
+  std::vector<float> sq_dists;
+  for (int i = 0; i < num_prev_points; ++i) {
+    // A single previous point is always the nearest neighbor.
+    neighbor_radius_sq_[i] = std::numeric_limits<float>::max();
+    if (num_graph_neighbors_ == 0) {
+      continue;
+    }
+
+    // The bound on the walks requires the exact nearest neighbors.  The
+    // search includes the point itself.
+    searchTree_.nearestKSearch((*prev_points_)[i], num_graph_neighbors_ + 1,
+                               &indices, &sq_dists);
+
+    int* neighbors = &neighbor_graph_[i * num_graph_neighbors_];
+    int num_neighbors = 0;
+    for (size_t j = 0; j < indices.size() &&
+         num_neighbors < num_graph_neighbors_; ++j) {
+      if (indices[j] != i) {
+        neighbors[num_neighbors] = indices[j];
+        neighbor_radius_sq_[i] = sq_dists[j];
+        num_neighbors++;
+      }
+    }
+
+    // Pad with the point itself if the search returned too few neighbors.
+    for (; num_neighbors < num_graph_neighbors_; ++num_neighbors) {
+      neighbors[num_neighbors] = i;
+      neighbor_radius_sq_[i] = 0;
+    }
+  }
+
+  search_tree_memory_.set(getSearchTreeMemoryUsage());
+}
+
+size_t LF_RGBD_6D_Evaluator::memoryUsage() const
+{
+  return AlignmentEvaluator::memoryUsage() +
+      (sizeof(*this) - sizeof(AlignmentEvaluator)) +
+      getSearchTreeMemoryUsage();
+}
 
-  // Set search tree epsilon for a speedup.
-  searchTree_.setEpsilon(params_->kSearchTreeEpsilon);
+size_t LF_RGBD_6D_Evaluator::getSearchTreeMemoryUsage() const
+{
+  return (searchTree_.memoryUsage() - sizeof(searchTree_)) +
+      neighbor_graph_.capacity() * sizeof(int) +
+      neighbor_radius_sq_.capacity() * sizeof(float) +
+      warm_start_indices_.capacity() * sizeof(int);
 }
 
 void LF_RGBD_6D_Evaluator::init(const double xy_sampling_resolution,
@@ -90,6 +170,13 @@ void LF_RGBD_6D_Evaluator::init(const double xy_sampling_resolution,
     prob_color_match_ = params_->kProbColorMatch * exp(-pow(sampling_resolution, 2) /
         (2 * pow(params_->kColorThreshFactor, 2)));
   }
+
+  use_warm_start_ = params_->kCoherentNNSearch &&
+      xy_sampling_resolution_ <= params_->kCoherentNNMaxResolution &&
+      z_sampling_resolution_ <= params_->kCoherentNNMaxResolution;
+  if (use_warm_start_ && neighbor_radius_sq_.empty()) {
+    computeNeighborGraph();
+  }
 }
 
 void LF_RGBD_6D_Evaluator::score6DTransforms(
@@ -225,7 +312,8 @@ double LF_RGBD_6D_Evaluator::getLogProbability(
     const pcl::PointXYZRGB& current_pt = (*transformed_current_points)[i];
 
     // Compute the probability.
-    log_measurement_prob += get_log_prob(current_pt);
+    log_measurement_prob += get_log_prob(
+          current_pt, params_->kCoherentNNSearch ? static_cast<int>(i) : -1);
   }
 
   // Compute the motion model probability.
@@ -270,20 +358,74 @@ double LF_RGBD_6D_Evaluator::getPointProbability(
        sensor_horizontal_resolution, sensor_vertical_resolution,
        num_current_points);
 
-  get_log_prob(point);
+  get_log_prob(point, -1);
+}
+
+int LF_RGBD_6D_Evaluator::findNearestNeighbor(
+    const pcl::PointXYZRGB& current_pt, const int point_index, float* sq_dist)
+{
+  if (point_index < 0) {
+    return searchTree_.nearestSearch(current_pt, params_->kSearchTreeEpsilon,
+                                     sq_dist);
+  }
+
+  if (static_cast<size_t>(point_index) >= warm_start_indices_.size()) {
+    warm_start_indices_.resize(point_index + 1, -1);
+  }
+  int& warm_start_index = warm_start_indices_[point_index];
+
+  if (use_warm_start_ && warm_start_index >= 0) {
+    // Walk downhill in the neighbor graph from the previous nearest neighbor.
+    int best_index = warm_start_index;
+    float best_sq_dist =
+        getSquaredDistance((*prev_points_)[best_index], current_pt);
+
+    int current_index = -1;
+    while (current_index != best_index) {
+      current_index = best_index;
+      const int* neighbors =
+          &neighbor_graph_[current_index * num_graph_neighbors_];
+      for (int j = 0; j < num_graph_neighbors_; ++j) {
+        const float neighbor_sq_dist =
+            getSquaredDistance((*prev_points_)[neighbors[j]], current_pt);
+        if (neighbor_sq_dist < best_sq_dist) {
+          best_sq_dist = neighbor_sq_dist;
+          best_index = neighbors[j];
+        }
+      }
+    }
+
+    // None of the neighbors of the previous point p found by the walk is
+    // closer than d = |x - p|.  Any closer point q would satisfy
+    // |p - q| <= |p - x| + |x - q| < 2d, so if 2d is within the radius of
+    // the neighbors of p, q would be one of them; p is then the exact
+    // nearest neighbor.
+    if (4 * best_sq_dist <= neighbor_radius_sq_[best_index]) {
+      warm_start_index = best_index;
+      *sq_dist = best_sq_dist;
+      return best_index;
+    }
+  }
+
+  // Fall back to the search tree.
+  warm_start_index = searchTree_.nearestSearch(
+        current_pt, params_->kSearchTreeEpsilon, sq_dist);
+  return warm_start_index;
 }
 
-double LF_RGBD_6D_Evaluator::get_log_prob(const pcl::PointXYZRGB& current_pt)
+double LF_RGBD_6D_Evaluator::get_log_prob(const pcl::PointXYZRGB& current_pt,
+                                          const int point_index)
 {
   // Find the nearest neighbor.
-  searchTree_.nearestKSearch(current_pt, max_nn_, nn_indices_, nn_sq_dists_);
-  const pcl::PointXYZRGB& prev_pt = (*prev_points_)[nn_indices_[0]];
+  float nn_sq_dist;
+  const int nn_index = findNearestNeighbor(current_pt, point_index, &nn_sq_dist);
+  const pcl::PointXYZRGB& prev_pt = (*prev_points_)[nn_index];
 
   // Compute the log probability of this neighbor match.
   // The NN search is isotropic, but our measurement model is not!
   // To acccount for this, we weight the NN search only by the isotropic
   // xyz_exp_factor_.
-  const double log_point_match_prob_i = nn_sq_dists_[0] * xyz_exp_factor_;
+  const double log_point_match_prob_i = nn_sq_dist * xyz_exp_factor_;
 
   // Compute the probability of this neighbor match.
   const double point_match_prob_spatial_i = exp(log_point_match_prob_i);
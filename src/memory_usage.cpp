@@ -0,0 +1,163 @@
+/*
+ * memory_usage.cpp
+ *
+ *      Author: davheld
+ *
+ */
+
+#include <sstream>
+#include <sys/resource.h>
+
+#include <precision_tracking/memory_usage.h>
+
+namespace precision_tracking {
+
+namespace {
+
+const char* const kCategoryNames[kNumMemoryCategories] = {
+  "Density grids",
+  "Search trees",
+  "Point clouds",
+  "Motion models"
+};
+
+// Current and peak usage, indexed by category, with the totals last.
+// These are updated with atomic operations since trackers in different
+// threads allocate concurrently.
+size_t current_bytes[kNumMemoryCategories + 1];
+size_t peak_bytes[kNumMemoryCategories + 1];
+
+void updatePeak(const int index, const size_t current)
+{
+  size_t peak = peak_bytes[index];
+  while (current > peak) {
+    const size_t prev_peak =
+        __sync_val_compare_and_swap(&peak_bytes[index], peak, current);
+    if (prev_peak == peak) {
+      break;
+    }
+    peak = prev_peak;
+  }
+}
+
+void addBytes(const MemoryCategory category, const size_t bytes)
+{
+  if (bytes == 0) {
+    return;
+  }
+  updatePeak(category, __sync_add_and_fetch(&current_bytes[category], bytes));
+  updatePeak(kNumMemoryCategories,
+             __sync_add_and_fetch(&current_bytes[kNumMemoryCategories], bytes));
+}
+
+void subtractBytes(const MemoryCategory category, const size_t bytes)
+{
+  if (bytes == 0) {
+    return;
+  }
+  __sync_sub_and_fetch(&current_bytes[category], bytes);
+  __sync_sub_and_fetch(&current_bytes[kNumMemoryCategories], bytes);
+}
+
+MemoryUsage getUsage(const int index)
+{
+  MemoryUsage usage;
+  usage.current = current_bytes[index];
+  usage.peak = peak_bytes[index];
+  return usage;
+}
+
+void appendUsage(const std::string& name, const MemoryUsage& usage,
+                 std::ostringstream* oss)
+{
+  *oss << name << ": " << usage.current / 1e6 << " MB (peak "
+       << usage.peak / 1e6 << " MB)\n";
+}
+
+} // namespace
+
+MemoryUsage getMemoryUsage(const MemoryCategory category)
+{
+  return getUsage(category);
+}
+
+MemoryUsage getTotalMemoryUsage()
+{
+  return getUsage(kNumMemoryCategories);
+}
+
+void resetPeakMemoryUsage()
+{
+  for (int i = 0; i <= kNumMemoryCategories; ++i) {
+    peak_bytes[i] = current_bytes[i];
+  }
+}
+
+size_t getPeakResidentMemory()
+{
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+  // ru_maxrss is in kilobytes.
+  return static_cast<size_t>(usage.ru_maxrss) * 1024;
+}
+
+std::string reportMemoryUsage()
+{
+  std::ostringstream oss;
+  for (int i = 0; i < kNumMemoryCategories; ++i) {
+    appendUsage(kCategoryNames[i], getUsage(i), &oss);
+  }
+  appendUsage("Total tracker memory", getTotalMemoryUsage(), &oss);
+  oss << "Peak resident memory of the process: "
+      << getPeakResidentMemory() / 1e6 << " MB";
+  return oss.str();
+}
+
+size_t getCloudMemoryUsage(const pcl::PointCloud<pcl::PointXYZRGB>& cloud)
+{
+  return sizeof(cloud) + cloud.points.capacity() * sizeof(pcl::PointXYZRGB);
+}
+
+TrackedMemory::TrackedMemory(const MemoryCategory category, const size_t bytes)
+  : category_(category),
+    bytes_(bytes)
+{
+  addBytes(category_, bytes_);
+}
+
+TrackedMemory::TrackedMemory(const TrackedMemory& other)
+  : category_(other.category_),
+    bytes_(other.bytes_)
+{
+  addBytes(category_, bytes_);
+}
+
+TrackedMemory& TrackedMemory::operator=(const TrackedMemory& other)
+{
+  if (this != &other) {
+    subtractBytes(category_, bytes_);
+    category_ = other.category_;
+    bytes_ = other.bytes_;
+    addBytes(category_, bytes_);
+  }
+  return *this;
+}
+
+TrackedMemory::~TrackedMemory()
+{
+  subtractBytes(category_, bytes_);
+}
+
+void TrackedMemory::set(const size_t bytes)
+{
+  if (bytes > bytes_) {
+    addBytes(category_, bytes - bytes_);
+  } else {
+    subtractBytes(category_, bytes_ - bytes);
+  }
+  bytes_ = bytes;
+}
+
+} // namespace precision_tracking
@@ -7,6 +7,8 @@
  */
 
 
+#include <cstdio>
+
 #include <boost/math/constants/constants.hpp>
 
 #include <precision_tracking/motion_model.h>
@@ -19,6 +21,21 @@ namespace {
 
 const double pi = boost::math::constants::pi<double>();
 
+// Increment when the serialized state changes.
+const int kMotionModelSerializationVersion = 1;
+
+template <typename Derived>
+void writeMatrix(const Eigen::MatrixBase<Derived>& matrix, std::ostream& out) {
+  out.write((const char*) matrix.derived().data(),
+            sizeof(double) * matrix.size());
+}
+
+template <typename Derived>
+void readMatrix(std::istream& istrm, Eigen::MatrixBase<Derived>* matrix) {
+  istrm.read((char*) matrix->derived().data(),
+             sizeof(double) * matrix->size());
+}
+
 } // namespace
 
 
@@ -27,7 +44,8 @@ MotionModel::MotionModel(const Params *params)
     pdf_constant_(1),
     min_score_(params_->kMotionMinProb),
     valid_(false),
-    flip_(1)
+    flip_(1),
+    memory_(kMotionModelMemory, sizeof(MotionModel))
 {
   // We assume that, at each time step, we independently sample an acceleration
   // with 0 mean and covariance of covariance_propagation_uncertainty_.
@@ -42,6 +60,10 @@ MotionModel::MotionModel(const Params *params)
   covariance_velocity_ =
       params_->kCentroidInitVelocityVariance * Eigen::Matrix3d::Identity();
   mean_velocity_ = Eigen::Vector3d::Zero();
+
+  mean_delta_position_ = Eigen::Vector3d::Zero();
+  covariance_delta_position_ = Eigen::Matrix3d::Zero();
+  covariance_delta_position_inv_ = Eigen::Matrix3d::Zero();
 }
 
 MotionModel::~MotionModel()
@@ -267,4 +289,56 @@ void MotionModel::propagate(const double& recorded_time_diff)
   pdf_constant_ = 1 / (pow(2 * pi, k/2) * pow(determinant, 0.5));
 }
 
+void MotionModel::serialize(std::ostream& out) const
+{
+  out.write((const char*) &kMotionModelSerializationVersion, sizeof(int));
+
+  writeMatrix(mean_velocity_, out);
+  writeMatrix(covariance_velocity_, out);
+  writeMatrix(mean_delta_position_, out);
+  writeMatrix(covariance_delta_position_, out);
+  writeMatrix(covariance_delta_position_inv_, out);
+  out.write((const char*) &pdf_constant_, sizeof(double));
+  out.write((const char*) &min_score_, sizeof(double));
+
+  const char valid = valid_;
+  out.write(&valid, sizeof(char));
+  out.write((const char*) &flip_, sizeof(int));
+}
+
+bool MotionModel::deserialize(std::istream& istrm)
+{
+  int serialization_version;
+  istrm.read((char*) &serialization_version, sizeof(int));
+  if (!istrm || serialization_version != kMotionModelSerializationVersion) {
+    printf("Error - expected motion model serialization version %d\n",
+           kMotionModelSerializationVersion);
+    return false;
+  }
+
+  // Read into a copy, so that this motion model is unchanged on failure.
+  MotionModel motion_model(*this);
+
+  readMatrix(istrm, &motion_model.mean_velocity_);
+  readMatrix(istrm, &motion_model.covariance_velocity_);
+  readMatrix(istrm, &motion_model.mean_delta_position_);
+  readMatrix(istrm, &motion_model.covariance_delta_position_);
+  readMatrix(istrm, &motion_model.covariance_delta_position_inv_);
+  istrm.read((char*) &motion_model.pdf_constant_, sizeof(double));
+  istrm.read((char*) &motion_model.min_score_, sizeof(double));
+
+  char valid;
+  istrm.read(&valid, sizeof(char));
+  motion_model.valid_ = valid;
+  istrm.read((char*) &motion_model.flip_, sizeof(int));
+
+  if (!istrm) {
+    printf("Error - reached the end of the motion model state\n");
+    return false;
+  }
+
+  *this = motion_model;
+  return true;
+}
+
 } // namespace precision_tracking
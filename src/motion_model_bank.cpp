@@ -0,0 +1,391 @@
+/*
+ * motion_model_bank.cpp
+ *
+ *      Author: davheld
+ *
+ */
+
+#include <algorithm>
+
+#include <boost/math/constants/constants.hpp>
+
+#include <precision_tracking/motion_model_bank.h>
+
+namespace precision_tracking {
+
+namespace {
+
+const double pi = boost::math::constants::pi<double>();
+
+// Returns a if the mask is 1 and b if the mask is 0.  This is written
+// arithmetically rather than as a conditional so that the compiler can
+// vectorize it without -ffast-math; both values must be finite.
+inline double select(const double mask, const double a, const double b)
+{
+  return mask * a + (1 - mask) * b;
+}
+
+// Unlike std::max, this returns a value rather than a reference, which
+// the compiler can vectorize.
+inline double maxValue(const double a, const double b)
+{
+  return a < b ? b : a;
+}
+
+// Invert a symmetric 3x3 matrix using its cofactors, and return its
+// determinant.
+inline double invertSymmetric(
+    const double xx, const double xy, const double xz,
+    const double yy, const double yz, const double zz,
+    double* inv_xx, double* inv_xy, double* inv_xz,
+    double* inv_yy, double* inv_yz, double* inv_zz)
+{
+  const double c_xx = yy * zz - yz * yz;
+  const double c_xy = xz * yz - xy * zz;
+  const double c_xz = xy * yz - xz * yy;
+  const double c_yy = xx * zz - xz * xz;
+  const double c_yz = xy * xz - xx * yz;
+  const double c_zz = xx * yy - xy * xy;
+
+  const double determinant = xx * c_xx + xy * c_xy + xz * c_xz;
+  const double inv_determinant = 1 / determinant;
+
+  *inv_xx = c_xx * inv_determinant;
+  *inv_xy = c_xy * inv_determinant;
+  *inv_xz = c_xz * inv_determinant;
+  *inv_yy = c_yy * inv_determinant;
+  *inv_yz = c_yz * inv_determinant;
+  *inv_zz = c_zz * inv_determinant;
+
+  return determinant;
+}
+
+} // namespace
+
+void MotionModelBank::SymmetricMatrices::set(const int lane,
+                                             const double diagonal)
+{
+  xx[lane] = diagonal;
+  xy[lane] = 0;
+  xz[lane] = 0;
+  yy[lane] = diagonal;
+  yz[lane] = 0;
+  zz[lane] = diagonal;
+}
+
+Eigen::Matrix3d MotionModelBank::SymmetricMatrices::get(const int lane) const
+{
+  Eigen::Matrix3d matrix;
+  matrix << xx[lane], xy[lane], xz[lane],
+            xy[lane], yy[lane], yz[lane],
+            xz[lane], yz[lane], zz[lane];
+  return matrix;
+}
+
+MotionModelBank::MotionModelBank(const Params *params)
+  : params_(params),
+    num_rows_(0),
+    memory_(kMotionModelMemory, sizeof(MotionModelBank))
+{
+}
+
+int MotionModelBank::addTrack()
+{
+  const int row = num_rows_;
+  num_rows_++;
+
+  if (row % kBlockSize == 0) {
+    // Start a new block, initializing all of its tracks.
+    blocks_.push_back(Block());
+    for (int i = 0; i < kBlockSize; ++i) {
+      clear(row + i);
+    }
+    memory_.set(sizeof(*this) + blocks_.capacity() * sizeof(Block));
+  } else {
+    clear(row);
+  }
+
+  return row;
+}
+
+void MotionModelBank::clear(const int row)
+{
+  Block& block = blocks_[row / kBlockSize];
+  const int lane = row % kBlockSize;
+
+  // Same initial state as the centroid Kalman filter of MotionModel.
+  block.mean_velocity_x[lane] = 0;
+  block.mean_velocity_y[lane] = 0;
+  block.mean_velocity_z[lane] = 0;
+  block.covariance_velocity.set(lane, params_->kCentroidInitVelocityVariance);
+
+  block.mean_delta_position_x[lane] = 0;
+  block.mean_delta_position_y[lane] = 0;
+  block.mean_delta_position_z[lane] = 0;
+  block.covariance_delta_position.set(lane, 0);
+  block.covariance_delta_position_inv.set(lane, 0);
+  // MotionModel starts with a normalization constant of 1, which is the
+  // constant for this determinant.
+  block.covariance_delta_position_determinant[lane] = 1 / pow(2 * pi, 3);
+
+  block.valid[lane] = 0;
+
+  block.has_prev_centroid[lane] = 0;
+  block.prev_centroid_x[lane] = 0;
+  block.prev_centroid_y[lane] = 0;
+  block.prev_centroid_z[lane] = 0;
+  block.prev_timestamp[lane] = 0;
+
+  block.observed[lane] = 0;
+  block.centroid_x[lane] = 0;
+  block.centroid_y[lane] = 0;
+  block.centroid_z[lane] = 0;
+  block.timestamp[lane] = 0;
+}
+
+void MotionModelBank::addCentroid(const int row,
+                                  const Eigen::Vector4f& centroid,
+                                  const double timestamp)
+{
+  Block& block = blocks_[row / kBlockSize];
+  const int lane = row % kBlockSize;
+
+  block.observed[lane] = 1;
+  block.centroid_x[lane] = centroid(0);
+  block.centroid_y[lane] = centroid(1);
+  block.centroid_z[lane] = centroid(2);
+  block.timestamp[lane] = timestamp;
+}
+
+void MotionModelBank::update()
+{
+  for (size_t i = 0; i < blocks_.size(); ++i) {
+    updateBlock(&blocks_[i]);
+  }
+}
+
+void MotionModelBank::updateBlock(Block* block) const
+{
+  const double propagation_variance_xy = params_->kPropagationVarianceXY;
+  const double propagation_variance_z = params_->kPropagationVarianceZ;
+  const double measurement_noise = params_->kCentroidMeasurementNoise;
+
+  double* mv_x = block->mean_velocity_x;
+  double* mv_y = block->mean_velocity_y;
+  double* mv_z = block->mean_velocity_z;
+  double* cv_xx = block->covariance_velocity.xx;
+  double* cv_xy = block->covariance_velocity.xy;
+  double* cv_xz = block->covariance_velocity.xz;
+  double* cv_yy = block->covariance_velocity.yy;
+  double* cv_yz = block->covariance_velocity.yz;
+  double* cv_zz = block->covariance_velocity.zz;
+  double* md_x = block->mean_delta_position_x;
+  double* md_y = block->mean_delta_position_y;
+  double* md_z = block->mean_delta_position_z;
+  double* cd_xx = block->covariance_delta_position.xx;
+  double* cd_xy = block->covariance_delta_position.xy;
+  double* cd_xz = block->covariance_delta_position.xz;
+  double* cd_yy = block->covariance_delta_position.yy;
+  double* cd_yz = block->covariance_delta_position.yz;
+  double* cd_zz = block->covariance_delta_position.zz;
+  double* ci_xx = block->covariance_delta_position_inv.xx;
+  double* ci_xy = block->covariance_delta_position_inv.xy;
+  double* ci_xz = block->covariance_delta_position_inv.xz;
+  double* ci_yy = block->covariance_delta_position_inv.yy;
+  double* ci_yz = block->covariance_delta_position_inv.yz;
+  double* ci_zz = block->covariance_delta_position_inv.zz;
+  double* cd_determinant = block->covariance_delta_position_determinant;
+  double* valid = block->valid;
+  double* has_prev = block->has_prev_centroid;
+  double* prev_x = block->prev_centroid_x;
+  double* prev_y = block->prev_centroid_y;
+  double* prev_z = block->prev_centroid_z;
+  double* prev_timestamp = block->prev_timestamp;
+  double* observed = block->observed;
+  const double* centroid_x = block->centroid_x;
+  const double* centroid_y = block->centroid_y;
+  const double* centroid_z = block->centroid_z;
+  const double* timestamp = block->timestamp;
+
+  // If the time difference is 0 or very small, we avoid numerical issues
+  // by thresholding at 0.01.  Tracks without a previous observation get the
+  // minimum time difference, since their results are discarded anyway.
+  // This is computed in a separate loop, since gcc does not vectorize the
+  // loop below if it is computed there.
+  double time_diffs[kBlockSize];
+  for (int i = 0; i < kBlockSize; ++i) {
+    time_diffs[i] = maxValue(
+          has_prev[i] * (timestamp[i] - prev_timestamp[i]), 0.01);
+  }
+
+  // Every track in the block is computed, and the results are only kept for
+  // the tracks that were observed, so that the loop has no branches.  The
+  // state of every track is kept finite (including unused tracks at the end
+  // of the last block) so that the discarded results are finite too.
+  for (int i = 0; i < kBlockSize; ++i) {
+    // Tracks with a previous observation are updated; they are propagated
+    // first if they have already been updated before.
+    const double do_update = observed[i] * has_prev[i];
+    const double do_propagate = do_update * valid[i];
+
+    const double time_diff = time_diffs[i];
+    const double time_diff_sq = time_diff * time_diff;
+
+    // Propagate the motion model forward; see MotionModel::propagate.
+    const double pv_xx = cv_xx[i] + propagation_variance_xy * time_diff_sq;
+    const double pv_yy = cv_yy[i] + propagation_variance_xy * time_diff_sq;
+    const double pv_zz = cv_zz[i] + propagation_variance_z * time_diff_sq;
+
+    const double pd_xx = cd_xx[i] + pv_xx * time_diff_sq;
+    const double pd_xy = cd_xy[i] + cv_xy[i] * time_diff_sq;
+    const double pd_xz = cd_xz[i] + cv_xz[i] * time_diff_sq;
+    const double pd_yy = cd_yy[i] + pv_yy * time_diff_sq;
+    const double pd_yz = cd_yz[i] + cv_yz[i] * time_diff_sq;
+    const double pd_zz = maxValue(cd_zz[i] + pv_zz * time_diff_sq, 0.1);
+
+    double pi_xx, pi_xy, pi_xz, pi_yy, pi_yz, pi_zz;
+    const double determinant = invertSymmetric(
+          pd_xx, pd_xy, pd_xz, pd_yy, pd_yz, pd_zz,
+          &pi_xx, &pi_xy, &pi_xz, &pi_yy, &pi_yz, &pi_zz);
+
+    md_x[i] = select(do_propagate, mv_x[i] * time_diff, md_x[i]);
+    md_y[i] = select(do_propagate, mv_y[i] * time_diff, md_y[i]);
+    md_z[i] = select(do_propagate, mv_z[i] * time_diff, md_z[i]);
+    cd_xx[i] = select(do_propagate, pd_xx, cd_xx[i]);
+    cd_xy[i] = select(do_propagate, pd_xy, cd_xy[i]);
+    cd_xz[i] = select(do_propagate, pd_xz, cd_xz[i]);
+    cd_yy[i] = select(do_propagate, pd_yy, cd_yy[i]);
+    cd_yz[i] = select(do_propagate, pd_yz, cd_yz[i]);
+    cd_zz[i] = select(do_propagate, pd_zz, cd_zz[i]);
+    ci_xx[i] = select(do_propagate, pi_xx, ci_xx[i]);
+    ci_xy[i] = select(do_propagate, pi_xy, ci_xy[i]);
+    ci_xz[i] = select(do_propagate, pi_xz, ci_xz[i]);
+    ci_yy[i] = select(do_propagate, pi_yy, ci_yy[i]);
+    ci_yz[i] = select(do_propagate, pi_yz, ci_yz[i]);
+    ci_zz[i] = select(do_propagate, pi_zz, ci_zz[i]);
+    cd_determinant[i] = select(do_propagate, determinant, cd_determinant[i]);
+
+    // The velocity covariance, after propagation if the track was propagated.
+    const double v_xx = select(do_propagate, pv_xx, cv_xx[i]);
+    const double v_xy = cv_xy[i];
+    const double v_xz = cv_xz[i];
+    const double v_yy = select(do_propagate, pv_yy, cv_yy[i]);
+    const double v_yz = cv_yz[i];
+    const double v_zz = select(do_propagate, pv_zz, cv_zz[i]);
+
+    // Update the Kalman filter with the velocity measured from the centroid
+    // displacement; see MotionModel::addCentroidDiff.  The measurement
+    // matrix is the identity, so the Kalman gain is V * (V + Q)^-1.
+    double s_xx, s_xy, s_xz, s_yy, s_yz, s_zz;
+    invertSymmetric(v_xx + measurement_noise, v_xy, v_xz,
+                    v_yy + measurement_noise, v_yz,
+                    v_zz + measurement_noise,
+                    &s_xx, &s_xy, &s_xz, &s_yy, &s_yz, &s_zz);
+
+    const double k_xx = v_xx * s_xx + v_xy * s_xy + v_xz * s_xz;
+    const double k_xy = v_xx * s_xy + v_xy * s_yy + v_xz * s_yz;
+    const double k_xz = v_xx * s_xz + v_xy * s_yz + v_xz * s_zz;
+    const double k_yx = v_xy * s_xx + v_yy * s_xy + v_yz * s_xz;
+    const double k_yy = v_xy * s_xy + v_yy * s_yy + v_yz * s_yz;
+    const double k_yz = v_xy * s_xz + v_yy * s_yz + v_yz * s_zz;
+    const double k_zx = v_xz * s_xx + v_yz * s_xy + v_zz * s_xz;
+    const double k_zy = v_xz * s_xy + v_yz * s_yy + v_zz * s_yz;
+    const double k_zz = v_xz * s_xz + v_yz * s_yz + v_zz * s_zz;
+
+    // Convert the centroid displacement to a velocity measurement.
+    const double innovation_x =
+        (centroid_x[i] - prev_x[i]) / time_diff - mv_x[i];
+    const double innovation_y =
+        (centroid_y[i] - prev_y[i]) / time_diff - mv_y[i];
+    const double innovation_z =
+        (centroid_z[i] - prev_z[i]) / time_diff - mv_z[i];
+
+    mv_x[i] = select(do_update, mv_x[i] + k_xx * innovation_x +
+                     k_xy * innovation_y + k_xz * innovation_z, mv_x[i]);
+    mv_y[i] = select(do_update, mv_y[i] + k_yx * innovation_x +
+                     k_yy * innovation_y + k_yz * innovation_z, mv_y[i]);
+    mv_z[i] = select(do_update, mv_z[i] + k_zx * innovation_x +
+                     k_zy * innovation_y + k_zz * innovation_z, mv_z[i]);
+
+    // (I - K) V, which is symmetric.
+    cv_xx[i] = select(do_update,
+        v_xx - (k_xx * v_xx + k_xy * v_xy + k_xz * v_xz), v_xx);
+    cv_xy[i] = select(do_update,
+        v_xy - (k_xx * v_xy + k_xy * v_yy + k_xz * v_yz), v_xy);
+    cv_xz[i] = select(do_update,
+        v_xz - (k_xx * v_xz + k_xy * v_yz + k_xz * v_zz), v_xz);
+    cv_yy[i] = select(do_update,
+        v_yy - (k_yx * v_xy + k_yy * v_yy + k_yz * v_yz), v_yy);
+    cv_yz[i] = select(do_update,
+        v_yz - (k_yx * v_xz + k_yy * v_yz + k_yz * v_zz), v_yz);
+    cv_zz[i] = select(do_update,
+        v_zz - (k_zx * v_xz + k_zy * v_yz + k_zz * v_zz), v_zz);
+
+    // After the first measurement, the motion model is valid.
+    valid[i] = select(do_update, 1, valid[i]);
+
+    // Save the observation for the next update.
+    prev_x[i] = select(observed[i], centroid_x[i], prev_x[i]);
+    prev_y[i] = select(observed[i], centroid_y[i], prev_y[i]);
+    prev_z[i] = select(observed[i], centroid_z[i], prev_z[i]);
+    prev_timestamp[i] = select(observed[i], timestamp[i], prev_timestamp[i]);
+    has_prev[i] = select(observed[i], 1, has_prev[i]);
+    observed[i] = 0;
+  }
+}
+
+Eigen::Vector3f MotionModelBank::get_mean_velocity(const int row) const
+{
+  const Block& block = blocks_[row / kBlockSize];
+  const int lane = row % kBlockSize;
+  return Eigen::Vector3f(block.mean_velocity_x[lane],
+                         block.mean_velocity_y[lane],
+                         block.mean_velocity_z[lane]);
+}
+
+Eigen::Matrix3d MotionModelBank::get_covariance_velocity(const int row) const
+{
+  return blocks_[row / kBlockSize].covariance_velocity.get(row % kBlockSize);
+}
+
+Eigen::Matrix3d MotionModelBank::get_covariance_delta_position(
+    const int row) const
+{
+  return blocks_[row / kBlockSize].covariance_delta_position.get(
+        row % kBlockSize);
+}
+
+bool MotionModelBank::valid(const int row) const
+{
+  return blocks_[row / kBlockSize].valid[row % kBlockSize] != 0;
+}
+
+double MotionModelBank::computeScore(const int row, const double x,
+                                     const double y, const double z) const
+{
+  if (!valid(row)) {
+    return 1;
+  }
+
+  const Block& block = blocks_[row / kBlockSize];
+  const int lane = row % kBlockSize;
+
+  const Eigen::Vector3d diff(x - block.mean_delta_position_x[lane],
+                             y - block.mean_delta_position_y[lane],
+                             z - block.mean_delta_position_z[lane]);
+  const double log_prob = -0.5 *
+      diff.dot(block.covariance_delta_position_inv.get(lane) * diff);
+
+  // Compute the constant in front of the multivariate Guassian.
+  const double pdf_constant = 1 / (pow(2 * pi, 1.5) *
+      sqrt(block.covariance_delta_position_determinant[lane]));
+
+  return std::max(pdf_constant * exp(log_prob), params_->kMotionMinProb);
+}
+
+size_t MotionModelBank::memoryUsage() const
+{
+  return memory_.get();
+}
+
+} // namespace precision_tracking
@@ -0,0 +1,326 @@
+/*
+ * particle_tracker3d.cpp
+ *
+ *      Author: davheld
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include <boost/math/constants/constants.hpp>
+#include <boost/random/normal_distribution.hpp>
+#include <boost/random/uniform_01.hpp>
+
+#include <precision_tracking/particle_tracker3d.h>
+#include <precision_tracking/trace_recorder.h>
+
+namespace precision_tracking {
+
+namespace {
+
+using std::max;
+using std::min;
+using std::vector;
+
+const double pi = boost::math::constants::pi<double>();
+
+// Fraction of the first round that is drawn uniformly from the search range,
+// so that the alignment can be found even if the motion model is wrong.
+const double kUniformFraction = 0.5;
+
+// The search range is widened to at least this size (in meters) in each
+// dimension, so that its probability density is finite.
+const double kMinRangeSize = 0.01;
+
+// Parents more than this many standard deviations from a particle are
+// ignored when computing the probability density of the proposal.
+const double kMaxKernelDistance = 4;
+
+} // namespace
+
+ParticleTracker3d::ParticleTracker3d(const Params *params)
+  : params_(params),
+    rng_(0),
+    scoring_profile_(NULL),
+    perf_counters_(NULL)
+{
+}
+
+void ParticleTracker3d::track(
+    const double initial_xy_sampling_resolution,
+    const double initial_z_sampling_resolution,
+    const std::pair <double, double>& xRange,
+    const std::pair <double, double>& yRange,
+    const std::pair <double, double>& zRange,
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& prev_points,
+    const Eigen::Vector3f& current_points_centroid,
+    const MotionModel& motion_model,
+    const double xy_sensor_resolution,
+    const double z_sensor_resolution,
+    boost::shared_ptr<AlignmentEvaluator> alignment_evaluator,
+    boost::shared_ptr<AlignmentEvaluator> coarse_alignment_evaluator,
+    ScoredTransforms<ScoredTransformXYZ>* scored_transforms)
+{
+  // As in ADHTracker3d, we are limited in accuracy by the sensor resolution.
+  const double min_xy_sampling_resolution =
+      max(xy_sensor_resolution / params_->kMinResFactor,
+          params_->kDesiredSamplingResolution);
+
+  // Reduce the sampling resolution geometrically so that the last round is
+  // at the minimum sampling resolution.
+  const int num_rounds = max(1, params_->kNumParticleRounds);
+  const double reduction = num_rounds > 1 ?
+      pow(min(1.0, min_xy_sampling_resolution / initial_xy_sampling_resolution),
+          1.0 / (num_rounds - 1)) : 1;
+
+  const bool sample_z = initial_z_sampling_resolution > 0 &&
+      zRange.first != zRange.second;
+
+  sampleInitialParticles(xRange, yRange, zRange, sample_z, motion_model);
+
+  if (coarse_alignment_evaluator) {
+    coarse_alignment_evaluator->setPrevPoints(prev_points);
+  }
+  bool set_prev_points = false;
+
+  double xy_sampling_resolution = initial_xy_sampling_resolution;
+  double z_sampling_resolution = initial_z_sampling_resolution;
+  for (int round = 0; round < num_rounds; ++round) {
+    if (round > 0) {
+      xy_sampling_resolution *= reduction;
+      z_sampling_resolution *= reduction;
+
+      // Jitter the particles by about half of the sampling resolution, so
+      // that the particles of a parent cover its cell.
+      resampleParticles(*scored_transforms, xy_sampling_resolution / 2,
+                        z_sampling_resolution / 2, sample_z);
+    }
+
+    boost::shared_ptr<AlignmentEvaluator> round_evaluator;
+    if (coarse_alignment_evaluator &&
+        xy_sampling_resolution > params_->kCascadeResolution) {
+      round_evaluator = coarse_alignment_evaluator;
+    } else {
+      round_evaluator = alignment_evaluator;
+      if (!set_prev_points) {
+        alignment_evaluator->setPrevPoints(prev_points);
+        set_prev_points = true;
+      }
+    }
+
+    {
+      ScopedTraceEvent trace_event("Score round", -1, round,
+                                   particles_.size());
+      if (scoring_profile_) {
+        scoring_profile_->start(perf_counters_);
+      }
+      round_evaluator->score3DTransforms(
+            current_points, current_points_centroid,
+            xy_sampling_resolution, z_sampling_resolution,
+            xy_sensor_resolution, z_sensor_resolution,
+            particles_, motion_model, scored_transforms);
+      if (scoring_profile_) {
+        scoring_profile_->stop(perf_counters_);
+      }
+    }
+
+    // Weight each particle by its probability divided by the probability of
+    // drawing it.
+    vector<ScoredTransformXYZ>& scored_particles =
+        scored_transforms->getScoredTransforms();
+    for (size_t i = 0; i < scored_particles.size(); ++i) {
+      scored_particles[i].setUnnormalizedLogProb(
+            scored_particles[i].getUnnormalizedLogProb() -
+            log_proposal_probs_[i]);
+    }
+  }
+
+  // Each particle represents a volume of about 1 / (N * proposal density),
+  // so that the probability per unit volume is proportional to the
+  // posterior density (which is used by ScoredTransforms::findBest).
+  vector<ScoredTransformXYZ>& scored_particles =
+      scored_transforms->getScoredTransforms();
+  const size_t num_particles = scored_particles.size();
+  for (size_t i = 0; i < num_particles; ++i) {
+    const ScoredTransformXYZ& particle = scored_particles[i];
+    const double volume = exp(-log_proposal_probs_[i]) / num_particles;
+    scored_particles[i] = ScoredTransformXYZ(
+          particle.getX(), particle.getY(), particle.getZ(),
+          particle.getUnnormalizedLogProb(), volume);
+  }
+}
+
+void ParticleTracker3d::sampleInitialParticles(
+    const std::pair <double, double>& xRange,
+    const std::pair <double, double>& yRange,
+    const std::pair <double, double>& zRange,
+    const bool sample_z,
+    const MotionModel& motion_model)
+{
+  boost::random::uniform_01<> uniform;
+  boost::random::normal_distribution<> normal;
+
+  const int num_dims = sample_z ? 3 : 2;
+
+  // The uniform distribution over the search range.
+  const Eigen::Vector3d range_center(
+        (xRange.first + xRange.second) / 2, (yRange.first + yRange.second) / 2,
+        (zRange.first + zRange.second) / 2);
+  const Eigen::Vector3d range_size =
+      Eigen::Vector3d(xRange.second - xRange.first,
+                      yRange.second - yRange.first,
+                      zRange.second - zRange.first).cwiseMax(kMinRangeSize);
+  const Eigen::Vector3d range_min = range_center - range_size / 2;
+  double range_volume = range_size(0) * range_size(1);
+  if (sample_z) {
+    range_volume *= range_size(2);
+  }
+
+  // The motion model, in the frame of the transforms (see
+  // MotionModel::computeScore).
+  const int flip = motion_model.get_flip() ? -1 : 1;
+  const Eigen::Vector3d prior_mean =
+      flip * motion_model.get_mean_delta_position();
+  const Eigen::MatrixXd prior_covariance =
+      motion_model.get_covariance_delta_position().topLeftCorner(
+        num_dims, num_dims);
+  const Eigen::LLT<Eigen::MatrixXd> llt(prior_covariance);
+  const bool use_prior =
+      motion_model.valid() && llt.info() == Eigen::Success;
+  const Eigen::MatrixXd prior_sqrt =
+      use_prior ? Eigen::MatrixXd(llt.matrixL()) :
+                  Eigen::MatrixXd::Identity(num_dims, num_dims);
+  const double prior_normalizer = 1.0 /
+      (pow(2 * pi, num_dims / 2.0) * prior_sqrt.diagonal().prod());
+
+  // Without a motion model, sample uniformly.
+  const double uniform_fraction = use_prior ? kUniformFraction : 1;
+
+  const int num_particles = max(1, params_->kNumParticles);
+  const double volume = range_volume / num_particles;
+  particles_.clear();
+  log_proposal_probs_.clear();
+  for (int i = 0; i < num_particles; ++i) {
+    Eigen::Vector3d position;
+    if (uniform(rng_) < uniform_fraction) {
+      for (int d = 0; d < 3; ++d) {
+        position(d) = range_min(d) + uniform(rng_) * range_size(d);
+      }
+    } else {
+      Eigen::VectorXd noise(num_dims);
+      for (int d = 0; d < num_dims; ++d) {
+        noise(d) = normal(rng_);
+      }
+      position.head(num_dims) =
+          prior_mean.head(num_dims) + prior_sqrt * noise;
+    }
+    if (!sample_z) {
+      position(2) = zRange.first;
+    }
+
+    // The probability density of the mixture at this particle.
+    double proposal_prob = 0;
+    if (uniform_fraction > 0) {
+      proposal_prob += uniform_fraction / range_volume;
+    }
+    if (uniform_fraction < 1) {
+      const Eigen::VectorXd diff =
+          position.head(num_dims) - prior_mean.head(num_dims);
+      const Eigen::VectorXd whitened =
+          prior_sqrt.triangularView<Eigen::Lower>().solve(diff);
+      proposal_prob += (1 - uniform_fraction) * prior_normalizer *
+          exp(-0.5 * whitened.squaredNorm());
+    }
+
+    particles_.push_back(XYZTransform(position(0), position(1), position(2),
+                                      volume));
+    log_proposal_probs_.push_back(log(proposal_prob));
+  }
+}
+
+void ParticleTracker3d::resampleParticles(
+    const ScoredTransforms<ScoredTransformXYZ>& scored_particles,
+    const double xy_jitter, const double z_jitter, const bool sample_z)
+{
+  boost::random::uniform_01<> uniform;
+  boost::random::normal_distribution<> normal;
+
+  const vector<double>& probs = scored_particles.getNormalizedProbs();
+  const int num_particles = max(1, params_->kNumParticles);
+
+  // Draw the parents by systematic resampling, which only needs a single
+  // random number and keeps the number of copies of each particle within 1
+  // of its expected value.
+  parents_.clear();
+  parent_counts_.clear();
+  const double offset = uniform(rng_);
+  double cumulative_prob = 0;
+  int num_drawn = 0;
+  for (size_t i = 0; i < probs.size(); ++i) {
+    cumulative_prob += probs[i] * num_particles;
+    int count = 0;
+    while (num_drawn < num_particles && num_drawn + offset < cumulative_prob) {
+      count++;
+      num_drawn++;
+    }
+    if (count > 0) {
+      parents_.push_back(particles_[i]);
+      parent_counts_.push_back(count);
+    }
+  }
+  // Rounding errors can leave the last few draws.
+  if (num_drawn < num_particles) {
+    parent_counts_.back() += num_particles - num_drawn;
+  }
+
+  // Jitter the copies of each parent.
+  const double volume = pow(2 * xy_jitter, 2) * (sample_z ? 2 * z_jitter : 1);
+  particles_.clear();
+  vector<int> own_parents;
+  own_parents.reserve(num_particles);
+  for (size_t j = 0; j < parents_.size(); ++j) {
+    const XYZTransform& parent = parents_[j];
+    for (int k = 0; k < parent_counts_[j]; ++k) {
+      const double x = parent.x + xy_jitter * normal(rng_);
+      const double y = parent.y + xy_jitter * normal(rng_);
+      const double z = sample_z ? parent.z + z_jitter * normal(rng_) :
+                                  parent.z;
+      particles_.push_back(XYZTransform(x, y, z, volume));
+      own_parents.push_back(j);
+    }
+  }
+
+  // The proposal is a mixture of Gaussians around the parents.
+  const double xy_exp_factor = -0.5 / (xy_jitter * xy_jitter);
+  const double z_exp_factor = sample_z ? -0.5 / (z_jitter * z_jitter) : 0;
+  const double normalizer = sample_z ?
+      1.0 / (pow(2 * pi, 1.5) * xy_jitter * xy_jitter * z_jitter) :
+      1.0 / (2 * pi * xy_jitter * xy_jitter);
+  const double max_exponent = -0.5 * kMaxKernelDistance * kMaxKernelDistance;
+
+  log_proposal_probs_.resize(particles_.size());
+  for (size_t i = 0; i < particles_.size(); ++i) {
+    const XYZTransform& particle = particles_[i];
+    double proposal_prob = 0;
+    for (size_t j = 0; j < parents_.size(); ++j) {
+      const XYZTransform& parent = parents_[j];
+      const double dx = particle.x - parent.x;
+      const double dy = particle.y - parent.y;
+      const double dz = particle.z - parent.z;
+      const double exponent = (dx * dx + dy * dy) * xy_exp_factor +
+          dz * dz * z_exp_factor;
+
+      // The particle's own parent is always included, so that the density
+      // is never 0.
+      if (exponent >= max_exponent ||
+          static_cast<int>(j) == own_parents[i]) {
+        proposal_prob += parent_counts_[j] * exp(exponent);
+      }
+    }
+    log_proposal_probs_[i] = log(proposal_prob * normalizer / num_particles);
+  }
+}
+
+} // namespace precision_tracking
@@ -0,0 +1,191 @@
+/*
+ * perf_counters.cpp
+ *
+ *      Author: davheld
+ *
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include <precision_tracking/perf_counters.h>
+
+namespace precision_tracking {
+
+namespace {
+
+#ifdef __linux__
+
+// The events that we count, in the order of the fields in PerfCounts.
+const uint64_t kEventConfigs[] = {
+  PERF_COUNT_HW_CPU_CYCLES,
+  PERF_COUNT_HW_INSTRUCTIONS,
+  PERF_COUNT_HW_CACHE_MISSES,
+  PERF_COUNT_HW_BRANCH_MISSES
+};
+
+int openCounter(const uint64_t config, const int group_fd)
+{
+  perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.read_format = PERF_FORMAT_GROUP;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  // Only the group leader starts disabled; the other counters follow it.
+  attr.disabled = group_fd == -1 ? 1 : 0;
+
+  // Count the calling thread on any CPU.
+  return syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+#endif
+
+} // namespace
+
+PerfCounters::PerfCounters()
+  : group_fd_(-1)
+{
+  for (int i = 0; i < kNumEvents; ++i) {
+    fds_[i] = -1;
+  }
+
+#ifdef __linux__
+  for (int i = 0; i < kNumEvents; ++i) {
+    fds_[i] = openCounter(kEventConfigs[i], i == 0 ? -1 : fds_[0]);
+    if (fds_[i] < 0) {
+      // Counters are not available (e.g. not permitted by
+      // /proc/sys/kernel/perf_event_paranoid, or running in a VM).
+      for (int j = 0; j < i; ++j) {
+        close(fds_[j]);
+        fds_[j] = -1;
+      }
+      return;
+    }
+  }
+
+  group_fd_ = fds_[0];
+  ioctl(group_fd_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(group_fd_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+}
+
+PerfCounters::~PerfCounters()
+{
+#ifdef __linux__
+  for (int i = 0; i < kNumEvents; ++i) {
+    if (fds_[i] >= 0) {
+      close(fds_[i]);
+    }
+  }
+#endif
+}
+
+bool PerfCounters::read(PerfCounts* counts) const
+{
+  if (!valid()) {
+    return false;
+  }
+
+#ifdef __linux__
+  // With PERF_FORMAT_GROUP, the leader returns the number of counters
+  // followed by the value of each counter.
+  uint64_t values[1 + kNumEvents];
+  const ssize_t size = ::read(group_fd_, values, sizeof(values));
+  if (size != static_cast<ssize_t>(sizeof(values)) ||
+      values[0] != kNumEvents) {
+    return false;
+  }
+
+  counts->cycles = values[1];
+  counts->instructions = values[2];
+  counts->cache_misses = values[3];
+  counts->branch_misses = values[4];
+  return true;
+#else
+  return false;
+#endif
+}
+
+StageProfile::StageProfile(const std::string& name)
+  : name_(name),
+    timer_(name),
+    has_counts_(true),
+    counting_(false)
+{
+}
+
+void StageProfile::start(const PerfCounters* counters)
+{
+  counting_ = counters && counters->read(&start_counts_);
+  timer_.start();
+}
+
+void StageProfile::stop(const PerfCounters* counters)
+{
+  timer_.stop();
+
+  PerfCounts end_counts;
+  if (counting_ && counters->read(&end_counts)) {
+    counts_.cycles += end_counts.cycles - start_counts_.cycles;
+    counts_.instructions += end_counts.instructions - start_counts_.instructions;
+    counts_.cache_misses += end_counts.cache_misses - start_counts_.cache_misses;
+    counts_.branch_misses +=
+        end_counts.branch_misses - start_counts_.branch_misses;
+  } else {
+    // If any interval was not counted, the totals are incomplete.
+    has_counts_ = false;
+  }
+  counting_ = false;
+}
+
+void StageProfile::add(const StageProfile& other)
+{
+  timer_.add(other.timer_);
+  counts_.add(other.counts_);
+  has_counts_ = has_counts_ && other.has_counts_;
+}
+
+void StageProfile::reset()
+{
+  timer_.reset();
+  counts_ = PerfCounts();
+  has_counts_ = true;
+  counting_ = false;
+}
+
+std::string StageProfile::report() const
+{
+  std::ostringstream oss;
+  oss << name_ << ": " << timer_.getMilliseconds() << " ms over "
+      << timer_.getNumIntervals() << " calls";
+  if (timer_.getNumIntervals() > 0 && has_counts_) {
+    const double ipc = counts_.cycles > 0 ?
+          static_cast<double>(counts_.instructions) / counts_.cycles : 0;
+    oss << ", " << counts_.cycles << " cycles, " << counts_.instructions
+        << " instructions (IPC " << ipc << "), " << counts_.cache_misses
+        << " LLC misses, " << counts_.branch_misses << " branch misses";
+  } else {
+    oss << ", hardware counters not available";
+  }
+  oss << ".";
+  return oss.str();
+}
+
+void StageProfile::print() const
+{
+  printf("[PROFILE] %s\n", report().c_str());
+}
+
+} // namespace precision_tracking
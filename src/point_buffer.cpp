@@ -0,0 +1,72 @@
+/*
+ * point_buffer.cpp
+ *
+ *      Author: davheld
+ *
+ */
+
+#include <algorithm>
+
+#include <precision_tracking/point_buffer.h>
+
+namespace precision_tracking {
+
+namespace {
+
+// Read the value at index i of a strided array.
+template <typename T>
+inline T getStrided(const T* values, const size_t stride, const size_t i)
+{
+  return *reinterpret_cast<const T*>(
+        reinterpret_cast<const char*>(values) + i * stride);
+}
+
+} // namespace
+
+void PointBuffer::copyTo(pcl::PointCloud<pcl::PointXYZRGB>* cloud) const
+{
+  cloud->resize(num_points);
+  cloud->width = num_points;
+  cloud->height = 1;
+  cloud->is_dense = true;
+
+  for (size_t i = 0; i < num_points; ++i) {
+    pcl::PointXYZRGB& pt = (*cloud)[i];
+    pt.x = getStrided(x, xyz_stride, i);
+    pt.y = getStrided(y, xyz_stride, i);
+    pt.z = getStrided(z, xyz_stride, i);
+    if (hasColors()) {
+      pt.r = getStrided(r, color_stride, i);
+      pt.g = getStrided(g, color_stride, i);
+      pt.b = getStrided(b, color_stride, i);
+    } else {
+      pt.r = 0;
+      pt.g = 0;
+      pt.b = 0;
+    }
+  }
+}
+
+void PointBuffer::copyTo(float* x_out, float* y_out, float* z_out,
+                         uint8_t* r_out, uint8_t* g_out, uint8_t* b_out) const
+{
+  for (size_t i = 0; i < num_points; ++i) {
+    x_out[i] = getStrided(x, xyz_stride, i);
+    y_out[i] = getStrided(y, xyz_stride, i);
+    z_out[i] = getStrided(z, xyz_stride, i);
+  }
+
+  if (hasColors()) {
+    for (size_t i = 0; i < num_points; ++i) {
+      r_out[i] = getStrided(r, color_stride, i);
+      g_out[i] = getStrided(g, color_stride, i);
+      b_out[i] = getStrided(b, color_stride, i);
+    }
+  } else {
+    std::fill(r_out, r_out + num_points, 0);
+    std::fill(g_out, g_out + num_points, 0);
+    std::fill(b_out, b_out + num_points, 0);
+  }
+}
+
+} // namespace precision_tracking
@@ -12,9 +12,13 @@
 
 #include <precision_tracking/down_sampler.h>
 #include <precision_tracking/density_grid_2d_evaluator.h>
+#include <precision_tracking/density_grid_25d_evaluator.h>
 #include <precision_tracking/density_grid_3d_evaluator.h>
+#include <precision_tracking/density_grid_color_evaluator.h>
+#include <precision_tracking/density_grid_small_evaluator.h>
 #include <precision_tracking/lf_rgbd_6d_evaluator.h>
 #include <precision_tracking/precision_tracker.h>
+#include <precision_tracking/trace_recorder.h>
 
 
 namespace precision_tracking {
@@ -29,15 +33,35 @@ using std::max;
 PrecisionTracker::PrecisionTracker(const Params *params)
   : params_(params),
     adh_tracker3d_(params_),
-    down_sampler_(params_->stochastic_downsample, params_)
+    particle_tracker3d_(params_),
+    down_sampler_(params_->stochastic_downsample, params_),
+    cached_model_key_(-1, 0, 0)
 {
-  if (params_->useColor) {
+  stage_profiles_.push_back(StageProfile("Range estimation"));
+  stage_profiles_.push_back(StageProfile("Down-sampling"));
+  stage_profiles_.push_back(StageProfile("Alignment"));
+  stage_profiles_.push_back(StageProfile("Scoring (part of alignment)"));
+
+  if (params_->useColor && params_->kUseColorGrid) {
+    alignment_evaluator_.reset(new DensityGridColorEvaluator(params_));
+  } else if (params_->useColor) {
     alignment_evaluator_.reset(new LF_RGBD_6D_Evaluator(params_));
   } else if (params_->use3D){
     alignment_evaluator_.reset(new DensityGrid3dEvaluator(params_));
+  } else if (params_->use25D) {
+    alignment_evaluator_.reset(new DensityGrid25dEvaluator(params_));
   } else {
     alignment_evaluator_.reset(new DensityGrid2dEvaluator(params_));
   }
+
+  const bool uses_2d_evaluator =
+      !params_->useColor && !params_->use3D && !params_->use25D;
+  if (params_->kCascadeResolution > 0 && !uses_2d_evaluator) {
+    coarse_alignment_evaluator_.reset(new DensityGrid2dEvaluator(params_));
+  }
+  if (params_->kSmallObjectMaxPoints > 0 && uses_2d_evaluator) {
+    small_alignment_evaluator_.reset(new DensityGridSmallEvaluator(params_));
+  }
 }
 
 
@@ -54,6 +78,42 @@ void PrecisionTracker::track(
     const MotionModel& motion_model,
     ScoredTransforms<ScoredTransformXYZ>* scored_transforms)
 {
+  trackModel(current_points, prev_points, prev_points->size(), NULL,
+             sensor_horizontal_resolution_actual,
+             sensor_vertical_resolution_actual, motion_model,
+             scored_transforms);
+}
+
+void PrecisionTracker::track(
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& prev_points,
+    const FrameKey& model_key,
+    const double sensor_horizontal_resolution_actual,
+    const double sensor_vertical_resolution_actual,
+    const MotionModel& motion_model,
+    ScoredTransforms<ScoredTransformXYZ>* scored_transforms)
+{
+  trackModel(current_points, prev_points, model_key.num_points,
+             model_key.track_id >= 0 ? &model_key : NULL,
+             sensor_horizontal_resolution_actual,
+             sensor_vertical_resolution_actual, motion_model,
+             scored_transforms);
+}
+
+void PrecisionTracker::trackModel(
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& prev_points,
+    const size_t prev_num_points,
+    const FrameKey* model_key,
+    const double sensor_horizontal_resolution_actual,
+    const double sensor_vertical_resolution_actual,
+    const MotionModel& motion_model,
+    ScoredTransforms<ScoredTransformXYZ>* scored_transforms)
+{
+  ScopedTraceEvent trace_event("PrecisionTracker::track");
+
+  startStage(kRangeEstimation);
+
   // Estimate the search range for alignment.
   std::pair <double, double> xRange;
   std::pair <double, double> yRange;
@@ -66,17 +126,35 @@ void PrecisionTracker::track(
   const Eigen::Vector3f current_points_centroid =
       current_points_centroid_4d.head(3);
 
-  // Down-sample the previous points.
-  pcl::PointCloud<pcl::PointXYZRGB>::Ptr previous_model_downsampled(
-        new pcl::PointCloud<pcl::PointXYZRGB>);
-  down_sampler_.downSamplePoints(
-        prev_points, params_->kPrevFrameDownsample, previous_model_downsampled);
+  stopStage(kRangeEstimation);
+  startStage(kDownSampling);
+
+  // Down-sample the previous points, unless they are the cached model.
+  pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr previous_model_downsampled;
+  if (model_key && cached_model_ && *model_key == cached_model_key_) {
+    previous_model_downsampled = cached_model_;
+  } else {
+    pcl::PointCloud<pcl::PointXYZRGB>::Ptr down_sampled_prev(
+          new pcl::PointCloud<pcl::PointXYZRGB>);
+    down_sampler_.downSamplePoints(
+          prev_points, params_->kPrevFrameDownsample, down_sampled_prev);
+    previous_model_downsampled = down_sampled_prev;
+
+    // Without a key, the evaluator is bound to points that cannot be
+    // reused, so the cached model is dropped.
+    if (model_key) {
+      cached_model_ = previous_model_downsampled;
+      cached_model_key_ = *model_key;
+    } else {
+      cached_model_.reset();
+    }
+  }
 
   // Compute the ratio by which we down-sampled, which decreases the effective
   // resolution.
   const double down_sample_factor_prev =
       static_cast<double>(previous_model_downsampled->size()) /
-      static_cast<double>(prev_points->size());
+      static_cast<double>(max(prev_num_points, prev_points->size()));
 
   // Down-sample the current points.
   pcl::PointCloud<pcl::PointXYZRGB>::Ptr down_sampled_current(
@@ -90,15 +168,107 @@ void PrecisionTracker::track(
   const double sensor_vertical_res =
       sensor_vertical_resolution_actual / down_sample_factor_prev;
 
+  double initial_xy_sampling_resolution;
+  double initial_z_sampling_resolution;
+  computeInitialSamplingResolution(xRange, yRange,
+                                   &initial_xy_sampling_resolution,
+                                   &initial_z_sampling_resolution);
+
+  // Small objects are scored with the small-object evaluator if they fit in
+  // its grid at the finest level of the search.
+  boost::shared_ptr<AlignmentEvaluator> alignment_evaluator =
+      alignment_evaluator_;
+  if (small_alignment_evaluator_ &&
+      static_cast<int>(previous_model_downsampled->size()) <=
+      params_->kSmallObjectMaxPoints) {
+    const double min_xy_sampling_resolution =
+        computeMinXYSamplingResolution(sensor_horizontal_res);
+    double finest_xy_sampling_resolution = initial_xy_sampling_resolution;
+    while (finest_xy_sampling_resolution > min_xy_sampling_resolution) {
+      finest_xy_sampling_resolution /= params_->kReductionFactor;
+    }
+    if (DensityGridSmallEvaluator::fits(*down_sampled_current,
+                                        *previous_model_downsampled,
+                                        finest_xy_sampling_resolution)) {
+      alignment_evaluator = small_alignment_evaluator_;
+    }
+  }
+
+  stopStage(kDownSampling);
+  startStage(kAlignment);
+
+  // The search profiles the scoring of the candidate transforms itself.
+  StageProfile* scoring_profile =
+      params_->profileStages ? &stage_profiles_[kScoring] : NULL;
+  adh_tracker3d_.setScoringProfile(scoring_profile, perf_counters_.get());
+  particle_tracker3d_.setScoringProfile(scoring_profile, perf_counters_.get());
+
   // Align the current points to the previous points using the annealed
-  // dynamic histogram tracker.
-  adh_tracker3d_.track(
-        params_->kInitialXYSamplingResolution, params_->kInitialZSamplingResolution,
-        xRange, yRange, zRange,
-        down_sampled_current, previous_model_downsampled,
-        current_points_centroid, motion_model,
-        sensor_horizontal_res, sensor_vertical_res,
-        alignment_evaluator_, scored_transforms);
+  // dynamic histogram tracker (or the particle tracker).
+  if (params_->useParticleTracker) {
+    particle_tracker3d_.track(
+          initial_xy_sampling_resolution, initial_z_sampling_resolution,
+          xRange, yRange, zRange,
+          down_sampled_current, previous_model_downsampled,
+          current_points_centroid, motion_model,
+          sensor_horizontal_res, sensor_vertical_res,
+          alignment_evaluator, coarse_alignment_evaluator_, scored_transforms);
+  } else {
+    adh_tracker3d_.track(
+          initial_xy_sampling_resolution, initial_z_sampling_resolution,
+          xRange, yRange, zRange,
+          down_sampled_current, previous_model_downsampled,
+          current_points_centroid, motion_model,
+          sensor_horizontal_res, sensor_vertical_res,
+          alignment_evaluator, coarse_alignment_evaluator_, scored_transforms);
+  }
+
+  stopStage(kAlignment);
+}
+
+size_t PrecisionTracker::memoryUsage() const
+{
+  size_t bytes = sizeof(*this) +
+      (adh_tracker3d_.memoryUsage() - sizeof(adh_tracker3d_)) +
+      (particle_tracker3d_.memoryUsage() - sizeof(particle_tracker3d_)) +
+      stage_profiles_.capacity() * sizeof(StageProfile);
+  if (alignment_evaluator_) {
+    bytes += alignment_evaluator_->memoryUsage();
+  }
+  if (coarse_alignment_evaluator_) {
+    bytes += coarse_alignment_evaluator_->memoryUsage();
+  }
+  if (small_alignment_evaluator_) {
+    bytes += small_alignment_evaluator_->memoryUsage();
+  }
+  if (perf_counters_) {
+    bytes += sizeof(PerfCounters);
+  }
+  // The cached model is the previous points of the evaluator, which are
+  // counted by the evaluator.
+  return bytes;
+}
+
+void PrecisionTracker::startStage(const Stage stage)
+{
+  if (!params_->profileStages) {
+    return;
+  }
+
+  if (!perf_counters_) {
+    perf_counters_.reset(new PerfCounters);
+  }
+
+  stage_profiles_[stage].start(perf_counters_.get());
+}
+
+void PrecisionTracker::stopStage(const Stage stage)
+{
+  if (!params_->profileStages) {
+    return;
+  }
+
+  stage_profiles_[stage].stop(perf_counters_.get());
 }
 
 void PrecisionTracker::estimateRange(
@@ -153,6 +323,50 @@ void PrecisionTracker::estimateRange(
   *zRange = std::make_pair(-params_->maxZ + z_init, params_->maxZ + z_init);
 }
 
+double PrecisionTracker::computeMinXYSamplingResolution(
+    const double xy_sensor_resolution) const
+{
+  return max(xy_sensor_resolution / params_->kMinResFactor,
+             params_->kDesiredSamplingResolution);
+}
+
+void PrecisionTracker::computeInitialSamplingResolution(
+    const std::pair <double, double>& xRange,
+    const std::pair <double, double>& yRange,
+    double* initial_xy_sampling_resolution,
+    double* initial_z_sampling_resolution) const
+{
+  *initial_xy_sampling_resolution = params_->kInitialXYSamplingResolution;
+  *initial_z_sampling_resolution = params_->kInitialZSamplingResolution;
+
+  // The resolution at which the range has about kTargetInitialCandidates
+  // samples.
+  const double area = (xRange.second - xRange.first) *
+      (yRange.second - yRange.first);
+  if (params_->kTargetInitialCandidates <= 0 || area <= 0) {
+    return;
+  }
+
+  const double target_resolution =
+      sqrt(area / params_->kTargetInitialCandidates);
+
+  // Round to the nearest power of kReductionFactor times the default initial
+  // resolution, so that the levels of the search are at the same resolutions
+  // as without a target and the last level is as fine as it would be
+  // otherwise.  If this is below the minimum resolution, the search has a
+  // single level.
+  const int exponent = static_cast<int>(round(
+      log(target_resolution / params_->kInitialXYSamplingResolution) /
+      log(params_->kReductionFactor)));
+  const double xy_sampling_resolution =
+      params_->kInitialXYSamplingResolution *
+      pow(params_->kReductionFactor, exponent);
+
+  *initial_z_sampling_resolution *=
+      xy_sampling_resolution / *initial_xy_sampling_resolution;
+  *initial_xy_sampling_resolution = xy_sampling_resolution;
+}
+
 Eigen::Matrix4f PrecisionTracker::estimateAlignmentCentroidDiff(
     const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& curr_points,
     const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& prev_points) const
@@ -0,0 +1,115 @@
+/*
+ * segmented_tracker.cpp
+ *
+ *      Author: davheld
+ *
+ */
+
+#include <algorithm>
+
+#include <boost/make_shared.hpp>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <precision_tracking/segmented_tracker.h>
+#include <precision_tracking/tracker.h>
+
+namespace precision_tracking {
+
+SegmentedTracker::SegmentedTracker(const Params* params,
+                                   const bool use_precision_tracker,
+                                   const int num_threads)
+  : params_(params),
+    num_threads_(std::max(num_threads, 1))
+{
+  if (use_precision_tracker) {
+    for (int i = 0; i < num_threads_; ++i) {
+      precision_trackers_.push_back(
+            boost::make_shared<PrecisionTracker>(params_));
+    }
+  }
+}
+
+int SegmentedTracker::getNumSegments(const size_t num_frames) const
+{
+  const size_t segment_length =
+      std::max(params_->kSegmentLength, params_->kSegmentBurnIn + 1);
+
+  // Tracks that are not much longer than a segment are not worth splitting,
+  // since every extra segment repeats the burn-in.
+  if (num_frames < 2 * segment_length) {
+    return 1;
+  }
+  return num_frames / segment_length;
+}
+
+void SegmentedTracker::track(
+    const std::vector<TrackedFrame>& frames, const int track_id,
+    std::vector<Eigen::Vector3f>* estimated_velocities)
+{
+  estimated_velocities->assign(frames.size(), Eigen::Vector3f::Zero());
+
+  const int num_segments = getNumSegments(frames.size());
+
+  // Each segment writes the estimates for its own frames, so no locking is
+  // needed to stitch the segments together.
+  #pragma omp parallel for num_threads(num_threads_) schedule(dynamic)
+  for (int i = 0; i < num_segments; ++i) {
+    const size_t first_output = frames.size() * i / num_segments;
+    const size_t end = frames.size() * (i + 1) / num_segments;
+
+    // The first segment starts at the beginning of the track and does not
+    // need a burn-in.  The other segments need at least one frame of
+    // burn-in, since the first frame of a tracker has no velocity estimate.
+    const size_t burn_in = std::min(
+          static_cast<size_t>(std::max(params_->kSegmentBurnIn, 1)),
+          first_output);
+    const size_t begin = first_output - burn_in;
+
+    boost::shared_ptr<PrecisionTracker> precision_tracker;
+    if (!precision_trackers_.empty()) {
+#ifdef _OPENMP
+      precision_tracker = precision_trackers_[omp_get_thread_num()];
+#else
+      precision_tracker = precision_trackers_[0];
+#endif
+    }
+
+    trackSegment(frames, begin, first_output, end, track_id,
+                 precision_tracker, estimated_velocities);
+  }
+}
+
+void SegmentedTracker::trackSegment(
+    const std::vector<TrackedFrame>& frames,
+    const size_t begin, const size_t first_output, const size_t end,
+    const int track_id,
+    const boost::shared_ptr<PrecisionTracker>& precision_tracker,
+    std::vector<Eigen::Vector3f>* estimated_velocities) const
+{
+  // Each segment gets a new tracker so that no state is shared between
+  // segments.
+  Tracker tracker(params_);
+  tracker.setTrackId(track_id);
+  if (precision_tracker) {
+    tracker.setPrecisionTracker(precision_tracker);
+  }
+
+  for (size_t i = begin; i < end; ++i) {
+    const TrackedFrame& frame = frames[i];
+
+    Eigen::Vector3f estimated_velocity;
+    tracker.addPoints(frame.cloud, frame.timestamp,
+                      frame.sensor_horizontal_resolution,
+                      frame.sensor_vertical_resolution,
+                      &estimated_velocity);
+
+    if (i >= first_output) {
+      (*estimated_velocities)[i] = estimated_velocity;
+    }
+  }
+}
+
+} // namespace precision_tracking
@@ -0,0 +1,300 @@
+/*
+ * static_kd_tree.cpp
+ *
+ *      Author: davheld
+ *
+ */
+
+#include <algorithm>
+#include <limits>
+
+#include <precision_tracking/static_kd_tree.h>
+
+namespace precision_tracking {
+
+namespace {
+
+// Coordinate of the unused slots of the buckets.  The squared distance to
+// these slots is large but finite, so they are never the nearest point.
+const float kFarAway = 1e18f;
+
+// The tree never has more levels than this (2^32 leaves).
+const int kMaxDepth = 32;
+
+// A subtree that remains to be searched, with a lower bound on the squared
+// distance from the query to any of its points.
+struct PendingNode {
+  int node;
+  float min_sq_dist;
+};
+
+float getCoordinate(const pcl::PointXYZRGB& point, const int dim)
+{
+  return dim == 0 ? point.x : (dim == 1 ? point.y : point.z);
+}
+
+// Orders indices of points by one of their coordinates.
+class CompareCoordinate {
+public:
+  CompareCoordinate(const pcl::PointCloud<pcl::PointXYZRGB>& points,
+                    const int dim)
+    : points_(points), dim_(dim)
+  {
+  }
+
+  bool operator()(const int a, const int b) const {
+    return getCoordinate(points_[a], dim_) < getCoordinate(points_[b], dim_);
+  }
+
+private:
+  const pcl::PointCloud<pcl::PointXYZRGB>& points_;
+  int dim_;
+};
+
+} // namespace
+
+StaticKdTree::StaticKdTree()
+  : num_points_(0),
+    num_leaves_(1)
+{
+}
+
+void StaticKdTree::build(const pcl::PointCloud<pcl::PointXYZRGB>& points)
+{
+  num_points_ = points.size();
+
+  // Use the fewest leaves that hold all of the points.  Splitting each node
+  // in half leaves at most ceil(num_points / num_leaves) points per leaf.
+  num_leaves_ = 1;
+  while (static_cast<size_t>(num_leaves_) * kBucketSize < num_points_) {
+    num_leaves_ *= 2;
+  }
+
+  // These only allocate memory if the cloud is larger than any previous one.
+  split_dims_.resize(num_leaves_ - 1);
+  split_values_.resize(num_leaves_ - 1);
+  const size_t num_slots = num_leaves_ * kBucketSize;
+  xs_.assign(num_slots, kFarAway);
+  ys_.assign(num_slots, kFarAway);
+  zs_.assign(num_slots, kFarAway);
+  indices_.assign(num_slots, -1);
+
+  permutation_.resize(num_points_);
+  for (size_t i = 0; i < num_points_; ++i) {
+    permutation_[i] = i;
+  }
+
+  if (num_points_ > 0) {
+    buildNode(points, 0, 0, num_points_);
+  }
+}
+
+void StaticKdTree::buildNode(const pcl::PointCloud<pcl::PointXYZRGB>& points,
+                             const int node, const int begin, const int end)
+{
+  if (node >= num_leaves_ - 1) {
+    // Copy the points into the bucket of this leaf.
+    const int slot = (node - (num_leaves_ - 1)) * kBucketSize;
+    for (int i = begin; i < end; ++i) {
+      const pcl::PointXYZRGB& point = points[permutation_[i]];
+      xs_[slot + i - begin] = point.x;
+      ys_[slot + i - begin] = point.y;
+      zs_[slot + i - begin] = point.z;
+      indices_[slot + i - begin] = permutation_[i];
+    }
+    return;
+  }
+
+  // Split along the dimension in which the points are most spread out.
+  Eigen::Vector3f min_pt = Eigen::Vector3f::Constant(kFarAway);
+  Eigen::Vector3f max_pt = Eigen::Vector3f::Constant(-kFarAway);
+  for (int i = begin; i < end; ++i) {
+    const pcl::PointXYZRGB& point = points[permutation_[i]];
+    const Eigen::Vector3f xyz(point.x, point.y, point.z);
+    min_pt = min_pt.cwiseMin(xyz);
+    max_pt = max_pt.cwiseMax(xyz);
+  }
+  int dim;
+  (max_pt - min_pt).maxCoeff(&dim);
+
+  // Split at the median, so that the tree is balanced.
+  const int mid = begin + (end - begin) / 2;
+  if (mid < end) {
+    std::nth_element(permutation_.begin() + begin, permutation_.begin() + mid,
+                     permutation_.begin() + end,
+                     CompareCoordinate(points, dim));
+    split_values_[node] = getCoordinate(points[permutation_[mid]], dim);
+  } else {
+    // An empty subtree; queries go to the left.
+    split_values_[node] = kFarAway;
+  }
+  split_dims_[node] = dim;
+
+  buildNode(points, 2 * node + 1, begin, mid);
+  buildNode(points, 2 * node + 2, mid, end);
+}
+
+int StaticKdTree::scanLeaf(const int leaf, const float x, const float y,
+                           const float z, float* sq_dists) const
+{
+  const int slot = leaf * kBucketSize;
+  const float* xs = &xs_[slot];
+  const float* ys = &ys_[slot];
+  const float* zs = &zs_[slot];
+
+  // The buckets have a fixed size, so this loop is vectorized.
+  for (int i = 0; i < kBucketSize; ++i) {
+    const float dx = xs[i] - x;
+    const float dy = ys[i] - y;
+    const float dz = zs[i] - z;
+    sq_dists[i] = dx * dx + dy * dy + dz * dz;
+  }
+
+  int nearest = 0;
+  for (int i = 1; i < kBucketSize; ++i) {
+    if (sq_dists[i] < sq_dists[nearest]) {
+      nearest = i;
+    }
+  }
+  return nearest;
+}
+
+int StaticKdTree::nearestSearch(const pcl::PointXYZRGB& point,
+                                const float epsilon, float* sq_dist) const
+{
+  *sq_dist = std::numeric_limits<float>::max();
+  if (num_points_ == 0) {
+    return -1;
+  }
+
+  // Subtrees are skipped if (1 + epsilon) times their distance is not
+  // closer than the nearest point so far.
+  const float scale = (1 + epsilon) * (1 + epsilon);
+  const float query[3] = { point.x, point.y, point.z };
+
+  int nearest_index = -1;
+  float sq_dists[kBucketSize];
+
+  // Search the nearer child of each node first, saving the farther child.
+  // The saved nodes are deeper than the nodes saved before them, so the
+  // stack never holds more than one node per level.
+  PendingNode stack[kMaxDepth + 1];
+  int stack_size = 0;
+  stack[stack_size].node = 0;
+  stack[stack_size].min_sq_dist = 0;
+  stack_size++;
+
+  while (stack_size > 0) {
+    stack_size--;
+    const PendingNode pending = stack[stack_size];
+    if (pending.min_sq_dist * scale >= *sq_dist) {
+      continue;
+    }
+
+    int node = pending.node;
+    while (node < num_leaves_ - 1) {
+      const float diff = query[split_dims_[node]] - split_values_[node];
+      const int near_child = diff < 0 ? 2 * node + 1 : 2 * node + 2;
+      const int far_child = diff < 0 ? 2 * node + 2 : 2 * node + 1;
+
+      const float far_sq_dist = std::max(pending.min_sq_dist, diff * diff);
+      if (far_sq_dist * scale < *sq_dist) {
+        stack[stack_size].node = far_child;
+        stack[stack_size].min_sq_dist = far_sq_dist;
+        stack_size++;
+      }
+      node = near_child;
+    }
+
+    const int leaf = node - (num_leaves_ - 1);
+    const int nearest = scanLeaf(leaf, query[0], query[1], query[2], sq_dists);
+    if (sq_dists[nearest] < *sq_dist) {
+      *sq_dist = sq_dists[nearest];
+      nearest_index = indices_[leaf * kBucketSize + nearest];
+    }
+  }
+
+  return nearest_index;
+}
+
+void StaticKdTree::nearestKSearch(const pcl::PointXYZRGB& point, const int k,
+                                  std::vector<int>* indices,
+                                  std::vector<float>* sq_dists) const
+{
+  // The nearest points so far, sorted by distance.
+  indices->assign(k, -1);
+  sq_dists->assign(k, std::numeric_limits<float>::max());
+  if (num_points_ == 0 || k <= 0) {
+    indices->clear();
+    sq_dists->clear();
+    return;
+  }
+
+  const float query[3] = { point.x, point.y, point.z };
+  float leaf_sq_dists[kBucketSize];
+
+  PendingNode stack[kMaxDepth + 1];
+  int stack_size = 0;
+  stack[stack_size].node = 0;
+  stack[stack_size].min_sq_dist = 0;
+  stack_size++;
+
+  while (stack_size > 0) {
+    stack_size--;
+    const PendingNode pending = stack[stack_size];
+    if (pending.min_sq_dist >= (*sq_dists)[k - 1]) {
+      continue;
+    }
+
+    int node = pending.node;
+    while (node < num_leaves_ - 1) {
+      const float diff = query[split_dims_[node]] - split_values_[node];
+      const int near_child = diff < 0 ? 2 * node + 1 : 2 * node + 2;
+      const int far_child = diff < 0 ? 2 * node + 2 : 2 * node + 1;
+
+      const float far_sq_dist = std::max(pending.min_sq_dist, diff * diff);
+      if (far_sq_dist < (*sq_dists)[k - 1]) {
+        stack[stack_size].node = far_child;
+        stack[stack_size].min_sq_dist = far_sq_dist;
+        stack_size++;
+      }
+      node = near_child;
+    }
+
+    const int leaf = node - (num_leaves_ - 1);
+    scanLeaf(leaf, query[0], query[1], query[2], leaf_sq_dists);
+    for (int i = 0; i < kBucketSize; ++i) {
+      const int index = indices_[leaf * kBucketSize + i];
+      if (index < 0 || leaf_sq_dists[i] >= (*sq_dists)[k - 1]) {
+        continue;
+      }
+
+      // Insert the point in sorted order.
+      int j = k - 1;
+      while (j > 0 && (*sq_dists)[j - 1] > leaf_sq_dists[i]) {
+        (*sq_dists)[j] = (*sq_dists)[j - 1];
+        (*indices)[j] = (*indices)[j - 1];
+        j--;
+      }
+      (*sq_dists)[j] = leaf_sq_dists[i];
+      (*indices)[j] = index;
+    }
+  }
+
+  // Remove the unused entries if there are fewer than k points.
+  if (num_points_ < static_cast<size_t>(k)) {
+    indices->resize(num_points_);
+    sq_dists->resize(num_points_);
+  }
+}
+
+size_t StaticKdTree::memoryUsage() const
+{
+  return sizeof(*this) +
+      split_dims_.capacity() * sizeof(unsigned char) +
+      split_values_.capacity() * sizeof(float) +
+      (xs_.capacity() + ys_.capacity() + zs_.capacity()) * sizeof(float) +
+      (indices_.capacity() + permutation_.capacity()) * sizeof(int);
+}
+
+} // namespace precision_tracking
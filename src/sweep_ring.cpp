@@ -0,0 +1,356 @@
+/*
+ * sweep_ring.cpp
+ *
+ *      Author: davheld
+ *
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <precision_tracking/sweep_ring.h>
+
+namespace precision_tracking {
+
+namespace {
+
+// Identifies a mapping as a sweep ring of this layout.  Increment when the
+// layout changes.
+const uint32_t kSweepRingMagic = 0x53575231;
+
+const size_t kCacheLineSize = 64;
+
+// Records in a slot start at multiples of 8 bytes.
+size_t alignRecord(const size_t bytes)
+{
+  return (bytes + 7) & ~static_cast<size_t>(7);
+}
+
+// The start of each slot.
+struct SlotHeader {
+  double timestamp;
+  uint32_t num_objects;
+  uint32_t padding;
+};
+
+// The start of each object in a slot, which is followed by the x, y and z
+// coordinates of its points (as floats) and then by their r, g and b values.
+struct ObjectRecord {
+  int32_t track_id;
+  uint32_t num_points;
+  uint32_t has_colors;
+  uint32_t padding;
+  double timestamp;
+  double sensor_horizontal_resolution;
+  double sensor_vertical_resolution;
+};
+
+size_t getObjectBytes(const size_t num_points)
+{
+  return alignRecord(sizeof(ObjectRecord) +
+                     num_points * (3 * sizeof(float) + 3 * sizeof(uint8_t)));
+}
+
+} // namespace
+
+// The start of the shared memory, followed by the slots.  The counts that
+// the producer and the consumer write are on separate cache lines, so that
+// neither invalidates the line that the other is writing.
+struct SweepRingHeader {
+  // Written by the consumer when the ring is created.
+  uint32_t magic;
+  uint32_t num_slots;
+  uint64_t slot_size;
+  char padding0[kCacheLineSize - 16];
+
+  // Written by the producer: the number of sweeps that were committed, and
+  // whether the ring was closed.
+  volatile uint64_t num_written;
+  volatile uint32_t closed;
+  char padding1[kCacheLineSize - 12];
+
+  // Written by the consumer: the number of sweeps that were released.
+  volatile uint64_t num_released;
+  char padding2[kCacheLineSize - 8];
+
+  char* getSlot(const uint64_t sweep_num) {
+    return reinterpret_cast<char*>(this + 1) +
+        (sweep_num % num_slots) * slot_size;
+  }
+};
+
+SweepRingConsumer::SweepRingConsumer(const std::string& name,
+                                     const size_t num_slots,
+                                     const size_t slot_size)
+  : name_(name),
+    header_(NULL),
+    mapped_size_(0),
+    reading_(false)
+{
+  const size_t aligned_slot_size = alignRecord(slot_size);
+  if (num_slots == 0 || aligned_slot_size < sizeof(SlotHeader)) {
+    printf("Error - a sweep ring needs at least one slot of at least %zu "
+           "bytes\n", sizeof(SlotHeader));
+    exit(1);
+  }
+
+  // Replace a ring that was left behind by a previous run.
+  shm_unlink(name_.c_str());
+  const int fd = shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    printf("Error - could not create the sweep ring %s: %s\n",
+           name_.c_str(), strerror(errno));
+    exit(1);
+  }
+
+  mapped_size_ = sizeof(SweepRingHeader) + num_slots * aligned_slot_size;
+  if (ftruncate(fd, mapped_size_) != 0) {
+    printf("Error - could not allocate %zu bytes for the sweep ring %s: %s\n",
+           mapped_size_, name_.c_str(), strerror(errno));
+    exit(1);
+  }
+
+  void* memory = mmap(NULL, mapped_size_, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fd, 0);
+  ::close(fd);
+  if (memory == MAP_FAILED) {
+    printf("Error - could not map the sweep ring %s: %s\n",
+           name_.c_str(), strerror(errno));
+    exit(1);
+  }
+
+  header_ = static_cast<SweepRingHeader*>(memory);
+  header_->num_slots = num_slots;
+  header_->slot_size = aligned_slot_size;
+  header_->num_written = 0;
+  header_->closed = 0;
+  header_->num_released = 0;
+
+  // A producer that sees the magic number sees the rest of the header.
+  __sync_synchronize();
+  header_->magic = kSweepRingMagic;
+}
+
+SweepRingConsumer::~SweepRingConsumer()
+{
+  munmap(header_, mapped_size_);
+  shm_unlink(name_.c_str());
+}
+
+bool SweepRingConsumer::isClosed() const
+{
+  const bool closed = header_->closed != 0;
+
+  // The producer commits its last sweep before closing the ring, so a
+  // consumer that sees the ring closed must also see that sweep in the
+  // next readSweep.
+  __sync_synchronize();
+  return closed;
+}
+
+bool SweepRingConsumer::readSweep(RingSweep* sweep)
+{
+  if (reading_) {
+    printf("Error - release the last sweep before reading the next one\n");
+    exit(1);
+  }
+
+  const uint64_t num_released = header_->num_released;
+  if (header_->num_written == num_released) {
+    return false;
+  }
+
+  // Do not read the slot before seeing that it was committed.
+  __sync_synchronize();
+
+  const char* slot = header_->getSlot(num_released);
+  const SlotHeader& slot_header = *reinterpret_cast<const SlotHeader*>(slot);
+  sweep->timestamp = slot_header.timestamp;
+  sweep->objects.clear();
+
+  size_t offset = sizeof(SlotHeader);
+  for (uint32_t i = 0; i < slot_header.num_objects; ++i) {
+    // Check that the record is in the slot before reading its size.
+    if (offset + sizeof(ObjectRecord) > header_->slot_size) {
+      printf("Error - the sweep at time %lf has %u objects but only room "
+             "for %u; skipping the rest of the sweep\n",
+             slot_header.timestamp, slot_header.num_objects, i);
+      break;
+    }
+    const ObjectRecord& record =
+        *reinterpret_cast<const ObjectRecord*>(slot + offset);
+    const size_t num_points = record.num_points;
+    if (offset + getObjectBytes(num_points) > header_->slot_size) {
+      printf("Error - object %u of the sweep at time %lf does not fit in "
+             "its slot; skipping the rest of the sweep\n", i,
+             slot_header.timestamp);
+      break;
+    }
+
+    const float* x = reinterpret_cast<const float*>(&record + 1);
+    const float* y = x + num_points;
+    const float* z = y + num_points;
+    const uint8_t* r = reinterpret_cast<const uint8_t*>(z + num_points);
+    const uint8_t* g = r + num_points;
+    const uint8_t* b = g + num_points;
+
+    RingObject object(PointBuffer(x, y, z, sizeof(float), num_points));
+    if (record.has_colors) {
+      object.points.setColors(r, g, b, sizeof(uint8_t));
+    }
+    object.track_id = record.track_id;
+    object.timestamp = record.timestamp;
+    object.sensor_horizontal_resolution = record.sensor_horizontal_resolution;
+    object.sensor_vertical_resolution = record.sensor_vertical_resolution;
+    sweep->objects.push_back(object);
+
+    offset += getObjectBytes(num_points);
+  }
+
+  reading_ = true;
+  return true;
+}
+
+void SweepRingConsumer::releaseSweep()
+{
+  if (!reading_) {
+    return;
+  }
+
+  // Finish reading the slot before the producer can reuse it.
+  __sync_synchronize();
+  header_->num_released = header_->num_released + 1;
+  reading_ = false;
+}
+
+SweepRingProducer::SweepRingProducer(const std::string& name)
+  : header_(NULL),
+    mapped_size_(0),
+    slot_(NULL),
+    slot_bytes_used_(0)
+{
+  const int fd = shm_open(name.c_str(), O_RDWR, 0);
+  if (fd < 0) {
+    printf("Error - could not open the sweep ring %s: %s\n",
+           name.c_str(), strerror(errno));
+    exit(1);
+  }
+
+  struct stat stats;
+  if (fstat(fd, &stats) != 0 ||
+      static_cast<size_t>(stats.st_size) < sizeof(SweepRingHeader)) {
+    printf("Error - %s is not a sweep ring\n", name.c_str());
+    exit(1);
+  }
+
+  mapped_size_ = stats.st_size;
+  void* memory = mmap(NULL, mapped_size_, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fd, 0);
+  ::close(fd);
+  if (memory == MAP_FAILED) {
+    printf("Error - could not map the sweep ring %s: %s\n",
+           name.c_str(), strerror(errno));
+    exit(1);
+  }
+
+  header_ = static_cast<SweepRingHeader*>(memory);
+  const uint32_t magic = header_->magic;
+  __sync_synchronize();
+  if (magic != kSweepRingMagic ||
+      sizeof(SweepRingHeader) +
+      header_->num_slots * header_->slot_size != mapped_size_) {
+    printf("Error - %s is not a sweep ring\n", name.c_str());
+    exit(1);
+  }
+}
+
+SweepRingProducer::~SweepRingProducer()
+{
+  munmap(header_, mapped_size_);
+}
+
+bool SweepRingProducer::beginSweep(const double timestamp)
+{
+  const uint64_t num_written = header_->num_written;
+  if (num_written - header_->num_released >= header_->num_slots) {
+    return false;
+  }
+
+  // Do not write the slot before seeing that it was released.
+  __sync_synchronize();
+
+  slot_ = header_->getSlot(num_written);
+  SlotHeader* slot_header = reinterpret_cast<SlotHeader*>(slot_);
+  slot_header->timestamp = timestamp;
+  slot_header->num_objects = 0;
+  slot_header->padding = 0;
+  slot_bytes_used_ = sizeof(SlotHeader);
+  return true;
+}
+
+bool SweepRingProducer::addObject(const int track_id,
+                                  const double timestamp,
+                                  const double sensor_horizontal_resolution,
+                                  const double sensor_vertical_resolution,
+                                  const PointBuffer& points)
+{
+  if (!slot_) {
+    printf("Error - call beginSweep before adding objects\n");
+    exit(1);
+  }
+
+  const size_t num_points = points.size();
+  const size_t object_bytes = getObjectBytes(num_points);
+  if (slot_bytes_used_ + object_bytes > header_->slot_size) {
+    return false;
+  }
+
+  ObjectRecord* record =
+      reinterpret_cast<ObjectRecord*>(slot_ + slot_bytes_used_);
+  record->track_id = track_id;
+  record->num_points = num_points;
+  record->has_colors = points.hasColors();
+  record->padding = 0;
+  record->timestamp = timestamp;
+  record->sensor_horizontal_resolution = sensor_horizontal_resolution;
+  record->sensor_vertical_resolution = sensor_vertical_resolution;
+
+  float* x = reinterpret_cast<float*>(record + 1);
+  float* y = x + num_points;
+  float* z = y + num_points;
+  uint8_t* r = reinterpret_cast<uint8_t*>(z + num_points);
+  uint8_t* g = r + num_points;
+  uint8_t* b = g + num_points;
+  points.copyTo(x, y, z, r, g, b);
+
+  reinterpret_cast<SlotHeader*>(slot_)->num_objects++;
+  slot_bytes_used_ += object_bytes;
+  return true;
+}
+
+void SweepRingProducer::commitSweep()
+{
+  if (!slot_) {
+    return;
+  }
+
+  // The consumer sees the new count only after the whole slot is written.
+  __sync_synchronize();
+  header_->num_written = header_->num_written + 1;
+  slot_ = NULL;
+}
+
+void SweepRingProducer::close()
+{
+  __sync_synchronize();
+  header_->closed = 1;
+}
+
+} // namespace precision_tracking
@@ -0,0 +1,233 @@
+/*
+ * trace_recorder.cpp
+ *
+ *      Author: davheld
+ *
+ */
+
+#include <cstdio>
+#include <vector>
+#include <pthread.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+#include <precision_tracking/cycle_timer.h>
+#include <precision_tracking/trace_recorder.h>
+
+namespace precision_tracking {
+
+namespace {
+
+// Maximum number of events recorded by each thread, to bound the memory
+// used by the recorder (32 MB per thread).  Further begin events are
+// dropped along with their end events; the end events of begin events that
+// were recorded are always recorded, so that every recorded event is
+// closed.
+const size_t kMaxEventsPerThread = 1 << 20;
+
+struct TraceEvent {
+  const char* name;
+  char phase;
+  int track_id;
+  int level;
+  int num_candidates;
+  uint64_t ticks;
+};
+
+// The events recorded by a single thread.
+struct TraceBuffer {
+  int thread_id;
+  size_t num_dropped;
+
+  // Number of dropped begin events whose end events have not been seen yet.
+  // Once the buffer is full, every begin event is dropped, so these are the
+  // innermost open events and the next end events belong to them.
+  size_t num_open_dropped;
+  std::vector<TraceEvent> events;
+};
+
+// All buffers ever registered.  Buffers are never deleted, since each
+// thread keeps a pointer to its own buffer.
+std::vector<TraceBuffer*> trace_buffers;
+pthread_mutex_t trace_buffers_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// The time that recording was first enabled.
+uint64_t origin_ticks = 0;
+
+// Per-thread state.
+__thread TraceBuffer* thread_buffer = NULL;
+__thread int current_track_id = -1;
+__thread int current_level = -1;
+
+int getThreadId()
+{
+#ifdef __linux__
+  return syscall(SYS_gettid);
+#else
+  return trace_buffers.size();
+#endif
+}
+
+TraceBuffer* getThreadBuffer()
+{
+  if (!thread_buffer) {
+    TraceBuffer* buffer = new TraceBuffer;
+    buffer->num_dropped = 0;
+    buffer->num_open_dropped = 0;
+
+    pthread_mutex_lock(&trace_buffers_mutex);
+    buffer->thread_id = getThreadId();
+    trace_buffers.push_back(buffer);
+    pthread_mutex_unlock(&trace_buffers_mutex);
+
+    thread_buffer = buffer;
+  }
+  return thread_buffer;
+}
+
+void writeArgs(FILE* file, const TraceEvent& event)
+{
+  fprintf(file, ",\"args\":{");
+  bool first = true;
+  if (event.track_id >= 0) {
+    fprintf(file, "\"track\":%d", event.track_id);
+    first = false;
+  }
+  if (event.level >= 0) {
+    fprintf(file, "%s\"level\":%d", first ? "" : ",", event.level);
+    first = false;
+  }
+  if (event.num_candidates >= 0) {
+    fprintf(file, "%s\"candidates\":%d", first ? "" : ",",
+            event.num_candidates);
+  }
+  fprintf(file, "}");
+}
+
+} // namespace
+
+bool TraceRecorder::enabled_ = false;
+
+void TraceRecorder::enable()
+{
+  if (origin_ticks == 0) {
+    origin_ticks = readCycleCounter();
+  }
+  enabled_ = true;
+}
+
+void TraceRecorder::disable()
+{
+  enabled_ = false;
+}
+
+void TraceRecorder::record(const char* name, const char phase,
+                           const int track_id, const int level,
+                           const int num_candidates)
+{
+  TraceBuffer* buffer = getThreadBuffer();
+  if (phase == 'B' && buffer->events.size() >= kMaxEventsPerThread) {
+    buffer->num_dropped++;
+    buffer->num_open_dropped++;
+    return;
+  }
+  if (phase == 'E' && buffer->num_open_dropped > 0) {
+    buffer->num_dropped++;
+    buffer->num_open_dropped--;
+    return;
+  }
+
+  TraceEvent event;
+  event.name = name;
+  event.phase = phase;
+  event.track_id = track_id;
+  event.level = level;
+  event.num_candidates = num_candidates;
+  event.ticks = readCycleCounter();
+  buffer->events.push_back(event);
+}
+
+bool TraceRecorder::writeChromeTrace(const std::string& filename)
+{
+  FILE* file = fopen(filename.c_str(), "w");
+  if (file == NULL) {
+    printf("Cannot open file: %s\n", filename.c_str());
+    return false;
+  }
+
+  const double ticks_per_us = getCycleCounterFrequency() / 1e6;
+
+  fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,"
+          "\"args\":{\"name\":\"precision_tracking\"}}");
+
+  pthread_mutex_lock(&trace_buffers_mutex);
+  for (size_t i = 0; i < trace_buffers.size(); ++i) {
+    const TraceBuffer& buffer = *trace_buffers[i];
+    if (buffer.num_dropped > 0) {
+      printf("Warning - dropped %zu trace events from thread %d\n",
+             buffer.num_dropped, buffer.thread_id);
+    }
+
+    for (size_t j = 0; j < buffer.events.size(); ++j) {
+      const TraceEvent& event = buffer.events[j];
+
+      // Events recorded before enable() was first called have no origin.
+      const double ts = event.ticks > origin_ticks ?
+            (event.ticks - origin_ticks) / ticks_per_us : 0;
+
+      fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,"
+              "\"pid\":1,\"tid\":%d", event.name, event.phase, ts,
+              buffer.thread_id);
+      if (event.phase == 'B') {
+        writeArgs(file, event);
+      }
+      fprintf(file, "}");
+    }
+  }
+  pthread_mutex_unlock(&trace_buffers_mutex);
+
+  fprintf(file, "\n]}\n");
+  fclose(file);
+  return true;
+}
+
+void TraceRecorder::clear()
+{
+  pthread_mutex_lock(&trace_buffers_mutex);
+  for (size_t i = 0; i < trace_buffers.size(); ++i) {
+    trace_buffers[i]->events.clear();
+    trace_buffers[i]->num_dropped = 0;
+  }
+  pthread_mutex_unlock(&trace_buffers_mutex);
+}
+
+void ScopedTraceEvent::begin(const int track_id, const int level,
+                             const int num_candidates)
+{
+  prev_track_id_ = current_track_id;
+  prev_level_ = current_level;
+
+  if (track_id >= 0) {
+    current_track_id = track_id;
+  }
+  if (level >= 0) {
+    current_level = level;
+  }
+
+  TraceRecorder::record(name_, 'B', current_track_id, current_level,
+                        num_candidates);
+}
+
+void ScopedTraceEvent::end()
+{
+  TraceRecorder::record(name_, 'E', current_track_id, current_level, -1);
+
+  current_track_id = prev_track_id_;
+  current_level = prev_level_;
+}
+
+} // namespace precision_tracking
@@ -0,0 +1,354 @@
+/*
+ * track_associator.cpp
+ *
+ *      Author: davheld
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+#include <boost/unordered_map.hpp>
+
+#include <pcl/common/centroid.h>
+
+#include <precision_tracking/density_grid_small_evaluator.h>
+#include <precision_tracking/down_sampler.h>
+#include <precision_tracking/trace_recorder.h>
+#include <precision_tracking/track_associator.h>
+
+namespace precision_tracking {
+
+namespace {
+
+using std::vector;
+
+typedef pcl::PointCloud<pcl::PointXYZRGB> Cloud;
+
+// Cells of the spatial hash, indexed by (x, y) cell coordinates.
+typedef std::pair<int, int> CellIndex;
+typedef boost::unordered_map<CellIndex, vector<int> > SpatialHash;
+
+// The cells are at least this large (in meters), so that the cell indices
+// stay finite if the gate has no size.
+const double kMinCellSize = 0.1;
+
+CellIndex getCell(const Eigen::Vector3f& position, const double cell_size)
+{
+  return CellIndex(static_cast<int>(floor(position(0) / cell_size)),
+                   static_cast<int>(floor(position(1) / cell_size)));
+}
+
+Eigen::Vector3f computeCentroid(const Cloud& points)
+{
+  Eigen::Vector4f centroid;
+  pcl::compute3DCentroid(points, centroid);
+  return centroid.head(3);
+}
+
+bool compareTrackIndex(const AssociationCandidate& a,
+                       const AssociationCandidate& b)
+{
+  return a.track_index < b.track_index;
+}
+
+bool compareScore(const AssociationCandidate& a,
+                  const AssociationCandidate& b)
+{
+  return a.score > b.score;
+}
+
+// Marginalize over the translations: the log of the mean probability.
+double computeMeanLogLikelihood(
+    const ScoredTransforms<ScoredTransformXYZ>& scored_transforms)
+{
+  const vector<ScoredTransformXYZ>& scores =
+      scored_transforms.getScoredTransforms();
+  double max_log_prob = -std::numeric_limits<double>::max();
+  for (size_t k = 0; k < scores.size(); ++k) {
+    max_log_prob = std::max(max_log_prob, scores[k].getUnnormalizedLogProb());
+  }
+  double sum_prob = 0;
+  for (size_t k = 0; k < scores.size(); ++k) {
+    sum_prob += exp(scores[k].getUnnormalizedLogProb() - max_log_prob);
+  }
+  return max_log_prob + log(sum_prob / scores.size());
+}
+
+} // namespace
+
+TrackAssociator::TrackAssociator(const Params* params)
+  : params_(params),
+    alignment_evaluator_(params),
+    batch_(params)
+{
+}
+
+void TrackAssociator::scoreCandidates(
+    const vector<boost::shared_ptr<Tracker> >& trackers,
+    const vector<TrackedFrame>& segments,
+    vector<AssociationCandidate>* candidates)
+{
+  ScopedTraceEvent trace_event("TrackAssociator::scoreCandidates");
+
+  candidates->clear();
+
+  if (segments.empty()) {
+    return;
+  }
+
+  // The segments may have been observed at slightly different times (e.g.
+  // during a sweep of the sensor).  The tracks are hashed by their predicted
+  // centroid at the time of the earliest segment.
+  double min_timestamp = segments[0].timestamp;
+  double max_timestamp = segments[0].timestamp;
+  for (size_t j = 1; j < segments.size(); ++j) {
+    min_timestamp = std::min(min_timestamp, segments[j].timestamp);
+    max_timestamp = std::max(max_timestamp, segments[j].timestamp);
+  }
+
+  const size_t num_trackers = trackers.size();
+  vector<Eigen::Vector3f, Eigen::aligned_allocator<Eigen::Vector3f> >
+      prev_centroids(num_trackers, Eigen::Vector3f::Zero());
+  vector<Eigen::Vector3f, Eigen::aligned_allocator<Eigen::Vector3f> >
+      hashed_centroids(num_trackers, Eigen::Vector3f::Zero());
+  vector<int> observed_tracks;
+  double max_speed = 0;
+
+  // The state of each track as of its last alignment.  Reading it must not
+  // wake dormant tracks or align deferred frames, so the state of a dormant
+  // track is unpacked into a temporary tracker instead.
+  vector<const Tracker*> states(num_trackers);
+  vector<boost::shared_ptr<Tracker> > unpacked_trackers;
+  for (size_t i = 0; i < num_trackers; ++i) {
+    const Tracker* state = trackers[i].get();
+    if (state->isDormant()) {
+      boost::shared_ptr<Tracker> unpacked_tracker(new Tracker(params_));
+      if (!state->unpackDormantState(unpacked_tracker.get())) {
+        continue;
+      }
+      unpacked_trackers.push_back(unpacked_tracker);
+      state = unpacked_tracker.get();
+    }
+    const Cloud::ConstPtr prev_points = state->peek_previous_points();
+    if (prev_points->empty()) {
+      continue;
+    }
+    states[i] = state;
+    observed_tracks.push_back(i);
+    prev_centroids[i] = computeCentroid(*prev_points);
+
+    const Eigen::Vector3f velocity =
+        state->peek_motion_model()->get_mean_velocity();
+    hashed_centroids[i] = prev_centroids[i] +
+        velocity * (min_timestamp - state->peek_prev_timestamp());
+    max_speed = std::max(max_speed,
+                         static_cast<double>(velocity.head(2).norm()));
+  }
+
+  // A segment is within the gate of a track if it is within
+  // kAssociationGateRadius of the predicted centroid of the track at the
+  // time of the segment, which is at most max_speed * (max_timestamp -
+  // min_timestamp) from the hashed centroid.  With cells at least as large
+  // as this distance, only the 3x3 neighboring cells need to be searched.
+  const double gate_radius = params_->kAssociationGateRadius;
+  const double cell_size = std::max(
+        gate_radius + max_speed * (max_timestamp - min_timestamp),
+        kMinCellSize);
+
+  SpatialHash track_cells;
+  for (size_t k = 0; k < observed_tracks.size(); ++k) {
+    const int i = observed_tracks[k];
+    track_cells[getCell(hashed_centroids[i], cell_size)].push_back(i);
+  }
+
+  // Gate the (track, segment) pairs.
+  vector<Eigen::Vector3f, Eigen::aligned_allocator<Eigen::Vector3f> >
+      segment_centroids(segments.size(), Eigen::Vector3f::Zero());
+  for (size_t j = 0; j < segments.size(); ++j) {
+    const TrackedFrame& segment = segments[j];
+    if (segment.cloud->empty()) {
+      continue;
+    }
+    segment_centroids[j] = computeCentroid(*segment.cloud);
+
+    const CellIndex cell = getCell(segment_centroids[j], cell_size);
+    for (int dx = -1; dx <= 1; ++dx) {
+      for (int dy = -1; dy <= 1; ++dy) {
+        const SpatialHash::const_iterator it =
+            track_cells.find(CellIndex(cell.first + dx, cell.second + dy));
+        if (it == track_cells.end()) {
+          continue;
+        }
+
+        for (size_t k = 0; k < it->second.size(); ++k) {
+          const int track_index = it->second[k];
+          const Tracker& state = *states[track_index];
+          const double time_diff =
+              segment.timestamp - state.peek_prev_timestamp();
+          const Eigen::Vector3f predicted_centroid =
+              prev_centroids[track_index] +
+              state.peek_motion_model()->get_mean_velocity() * time_diff;
+          const Eigen::Vector3f diff =
+              segment_centroids[j] - predicted_centroid;
+          if (diff.head(2).norm() <= gate_radius) {
+            AssociationCandidate candidate;
+            candidate.track_index = track_index;
+            candidate.segment_index = j;
+            candidate.score = 0;
+            candidates->push_back(candidate);
+          }
+        }
+      }
+    }
+  }
+
+  // Prepare the candidates of each track together, so that the previous
+  // points of each track are only down-sampled once.
+  std::sort(candidates->begin(), candidates->end(), compareTrackIndex);
+
+  // Segments are only down-sampled if they are candidates for some track.
+  vector<Cloud::Ptr> down_sampled_segments(segments.size());
+
+  const double xy_sampling_resolution = params_->kInitialXYSamplingResolution;
+  const int num_steps = static_cast<int>(
+        floor(params_->kAssociationSearchRadius / xy_sampling_resolution));
+
+  // The alignment of each candidate.  Reserve the space up front so that
+  // the batched problems can point into these vectors.
+  vector<MotionModel> motion_models;
+  motion_models.reserve(candidates->size());
+  vector<vector<XYZTransform> > transforms(candidates->size());
+
+  // Candidates whose points fit in a small density grid are scored in a
+  // batch, and the others with the 2D density grid.
+  vector<SmallAlignmentProblem> batch_problems;
+  vector<size_t> batch_candidates;
+
+  ScoredTransforms<ScoredTransformXYZ> scored_transforms;
+
+  int prev_track_index = -1;
+  Cloud::Ptr prev_down_sampled;
+  double down_sample_factor_prev = 1;
+  for (size_t i = 0; i < candidates->size(); ++i) {
+    AssociationCandidate& candidate = (*candidates)[i];
+    const Tracker& state = *states[candidate.track_index];
+    const TrackedFrame& segment = segments[candidate.segment_index];
+
+    if (candidate.track_index != prev_track_index) {
+      const Cloud::ConstPtr prev_points = state.peek_previous_points();
+      prev_down_sampled.reset(new Cloud);
+      DownSampler::downSamplePointsDeterministic(
+            prev_points, params_->kPrevFrameDownsample, prev_down_sampled,
+            params_->kUseCeil);
+
+      // As in PrecisionTracker::track, the previous points of a dormant
+      // track may already have been down-sampled.
+      down_sample_factor_prev =
+          static_cast<double>(prev_down_sampled->size()) /
+          std::max(state.peek_previous_num_points(), prev_points->size());
+      prev_track_index = candidate.track_index;
+    }
+
+    Cloud::Ptr& segment_down_sampled =
+        down_sampled_segments[candidate.segment_index];
+    if (!segment_down_sampled) {
+      segment_down_sampled.reset(new Cloud);
+      DownSampler::downSamplePointsDeterministic(
+            segment.cloud, params_->kCurrFrameDownsample, segment_down_sampled,
+            params_->kUseCeil);
+    }
+
+    // As in Tracker::addPoints, the segment is aligned to the previous
+    // points, so the motion model is flipped.
+    motion_models.push_back(*state.peek_motion_model());
+    MotionModel& motion_model = motion_models.back();
+    motion_model.propagate(segment.timestamp - state.peek_prev_timestamp());
+    motion_model.setFlip(true);
+
+    // Sample the translations around the alignment of the centroids.
+    const Eigen::Vector3f centroid_diff =
+        prev_centroids[candidate.track_index] -
+        segment_centroids[candidate.segment_index];
+    const double volume = pow(xy_sampling_resolution, 2);
+    vector<XYZTransform>& candidate_transforms = transforms[i];
+    for (int dx = -num_steps; dx <= num_steps; ++dx) {
+      for (int dy = -num_steps; dy <= num_steps; ++dy) {
+        candidate_transforms.push_back(XYZTransform(
+            centroid_diff(0) + dx * xy_sampling_resolution,
+            centroid_diff(1) + dy * xy_sampling_resolution, 0, volume));
+      }
+    }
+
+    const double xy_sensor_resolution =
+        segment.sensor_horizontal_resolution / down_sample_factor_prev;
+
+    if (params_->kInitialZSamplingResolution == 0 &&
+        DensityGridSmallEvaluator::fits(*segment_down_sampled,
+                                        *prev_down_sampled,
+                                        xy_sampling_resolution)) {
+      SmallAlignmentProblem problem;
+      problem.current_points = segment_down_sampled;
+      problem.prev_points = prev_down_sampled;
+      problem.motion_model = &motion_model;
+      problem.transforms = &candidate_transforms;
+      problem.xy_sensor_resolution = xy_sensor_resolution;
+      batch_problems.push_back(problem);
+      batch_candidates.push_back(i);
+      continue;
+    }
+
+    alignment_evaluator_.setPrevPoints(prev_down_sampled);
+    alignment_evaluator_.score3DTransforms(
+          segment_down_sampled, segment_centroids[candidate.segment_index],
+          xy_sampling_resolution, params_->kInitialZSamplingResolution,
+          xy_sensor_resolution,
+          segment.sensor_vertical_resolution / down_sample_factor_prev,
+          candidate_transforms, motion_model, &scored_transforms);
+
+    candidate.score = computeMeanLogLikelihood(scored_transforms) /
+        segment_down_sampled->size();
+  }
+
+  vector<ScoredTransforms<ScoredTransformXYZ> > batch_scored_transforms;
+  batch_.score3DTransforms(batch_problems, xy_sampling_resolution,
+                           &batch_scored_transforms);
+  for (size_t k = 0; k < batch_candidates.size(); ++k) {
+    AssociationCandidate& candidate = (*candidates)[batch_candidates[k]];
+    candidate.score = computeMeanLogLikelihood(batch_scored_transforms[k]) /
+        batch_problems[k].current_points->size();
+  }
+}
+
+void TrackAssociator::associate(
+    const vector<boost::shared_ptr<Tracker> >& trackers,
+    const vector<TrackedFrame>& segments,
+    vector<int>* track_indices)
+{
+  vector<AssociationCandidate> candidates;
+  scoreCandidates(trackers, segments, &candidates);
+
+  std::sort(candidates.begin(), candidates.end(), compareScore);
+
+  track_indices->assign(segments.size(), -1);
+  vector<bool> assigned_tracks(trackers.size(), false);
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    const AssociationCandidate& candidate = candidates[i];
+    if (assigned_tracks[candidate.track_index] ||
+        (*track_indices)[candidate.segment_index] >= 0) {
+      continue;
+    }
+    assigned_tracks[candidate.track_index] = true;
+    (*track_indices)[candidate.segment_index] = candidate.track_index;
+  }
+}
+
+size_t TrackAssociator::memoryUsage() const
+{
+  return sizeof(*this) - sizeof(alignment_evaluator_) - sizeof(batch_) +
+      alignment_evaluator_.memoryUsage() + batch_.memoryUsage();
+}
+
+} // namespace precision_tracking
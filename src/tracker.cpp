@@ -6,17 +6,52 @@
  *
  */
 
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+
 #include <pcl/common/centroid.h>
 
+#include <precision_tracking/down_sampler.h>
+#include <precision_tracking/trace_recorder.h>
 #include <precision_tracking/tracker.h>
 
 
 namespace precision_tracking {
 
+namespace {
+
+// Increment when the serialized state changes.  Version 1 did not save
+// the number of points of the previous frame before down-sampling.
+const int kTrackerSerializationVersion = 2;
+
+// Larger counts in a serialized state are treated as corrupt rather than
+// allocated; this is far more points than any segmented object has.
+const int kMaxSerializedPoints = 1 << 22;
+
+// Start the accounting of a cloud that copies of a tracker may share.
+boost::shared_ptr<TrackedMemory> trackCloudMemory(
+    const pcl::PointCloud<pcl::PointXYZRGB>& cloud)
+{
+  return boost::shared_ptr<TrackedMemory>(
+        new TrackedMemory(kPointCloudMemory, getCloudMemoryUsage(cloud)));
+}
+
+} // namespace
+
 Tracker::Tracker(const Params *params)
   : params_(params),
     previousModel_(new pcl::PointCloud<pcl::PointXYZRGB>),
-    prev_timestamp_(-1)
+    previous_model_memory_(trackCloudMemory(*previousModel_)),
+    previous_num_points_(0),
+    prev_timestamp_(-1),
+    track_id_(-1),
+    estimated_velocity_(Eigen::Vector3f::Zero()),
+    alignment_probability_(0),
+    deferred_alignment_(false),
+    num_skipped_frames_(0),
+    dormant_state_memory_(kPointCloudMemory),
+    num_missed_frames_(0)
 {
   motion_model_.reset(new MotionModel(params_));
 }
@@ -25,6 +60,257 @@ void Tracker::clear()
 {
   motion_model_.reset(new MotionModel(params_));
   previousModel_->clear();
+  previous_model_memory_->set(getCloudMemoryUsage(*previousModel_));
+  previous_num_points_ = 0;
+  estimated_velocity_ = Eigen::Vector3f::Zero();
+  alignment_probability_ = 0;
+  deferred_frame_ = DeferredFrame();
+  num_skipped_frames_ = 0;
+  std::string().swap(dormant_state_);
+  dormant_state_memory_.set(0);
+  num_missed_frames_ = 0;
+}
+
+void Tracker::setDeferredAlignment(const bool deferred_alignment)
+{
+  if (!deferred_alignment) {
+    alignDeferredFrame();
+  }
+  deferred_alignment_ = deferred_alignment;
+}
+
+void Tracker::alignDeferredFrame() const
+{
+  if (!hasDeferredFrame()) {
+    return;
+  }
+
+  // The const getters align on demand, which only changes the state that
+  // they report.  Trackers are never created as const objects, so it is
+  // safe to cast away the constness here.
+  Tracker* tracker = const_cast<Tracker*>(this);
+
+  ScopedTraceEvent trace_event("Tracker::alignDeferredFrame", track_id_);
+
+  const DeferredFrame frame = deferred_frame_;
+  tracker->deferred_frame_ = DeferredFrame();
+  tracker->align(frame.points, frame.timestamp,
+                 frame.sensor_horizontal_resolution,
+                 frame.sensor_vertical_resolution);
+}
+
+void Tracker::updateState() const
+{
+  wake();
+  alignDeferredFrame();
+}
+
+void Tracker::addMissedFrame()
+{
+  num_missed_frames_++;
+  if (params_->kDormantMissedFrames > 0 &&
+      num_missed_frames_ >= params_->kDormantMissedFrames) {
+    makeDormant();
+  }
+}
+
+void Tracker::makeDormant()
+{
+  alignDeferredFrame();
+
+  // There is nothing to compact before the object is first observed.
+  if (isDormant() || previousModel_->empty()) {
+    return;
+  }
+
+  ScopedTraceEvent trace_event("Tracker::makeDormant", track_id_);
+
+  std::ostringstream oss;
+  if (!serialize(oss, params_->kPrevFrameDownsample)) {
+    printf("Error - could not pack the state of track %d\n", track_id_);
+    return;
+  }
+  dormant_state_ = oss.str();
+  dormant_state_memory_.set(dormant_state_.capacity());
+
+  // Release the state rather than clearing it, since copies of this tracker
+  // share the previous points and the motion model.
+  motion_model_.reset();
+  previousModel_.reset(new pcl::PointCloud<pcl::PointXYZRGB>);
+  previous_model_memory_ = trackCloudMemory(*previousModel_);
+  input_points_.reset();
+  input_points_memory_.reset();
+}
+
+void Tracker::wake() const
+{
+  if (!isDormant()) {
+    return;
+  }
+
+  // As in alignDeferredFrame, restoring the state on demand only changes
+  // how it is stored, so it is safe to cast away the constness here.
+  Tracker* tracker = const_cast<Tracker*>(this);
+
+  ScopedTraceEvent trace_event("Tracker::wake", track_id_);
+
+  const int num_skipped_frames = num_skipped_frames_;
+  const int num_missed_frames = num_missed_frames_;
+  std::istringstream iss(dormant_state_);
+  if (!tracker->deserialize(iss)) {
+    printf("Error - could not restore the state of dormant track %d\n",
+           track_id_);
+    tracker->clear();
+    return;
+  }
+  tracker->num_skipped_frames_ = num_skipped_frames;
+  tracker->num_missed_frames_ = num_missed_frames;
+}
+
+bool Tracker::unpackDormantState(Tracker* tracker) const
+{
+  if (!isDormant()) {
+    return false;
+  }
+  std::istringstream iss(dormant_state_);
+  return tracker->deserialize(iss);
+}
+
+size_t Tracker::memoryUsage() const
+{
+  if (isDormant()) {
+    return sizeof(*this) + dormant_state_.capacity();
+  }
+  size_t bytes = sizeof(*this) + getCloudMemoryUsage(*previousModel_) +
+      motion_model_->memoryUsage();
+  if (input_points_) {
+    bytes += getCloudMemoryUsage(*input_points_);
+  }
+  return bytes;
+}
+
+bool Tracker::serialize(std::ostream& out, const int max_num_points) const
+{
+  if (isDormant()) {
+    // Restore a copy of the state, which may need to be down-sampled
+    // further.
+    Tracker tracker(params_);
+    if (!unpackDormantState(&tracker)) {
+      printf("Error - could not restore the state of dormant track %d\n",
+             track_id_);
+      return false;
+    }
+    return tracker.serialize(out, max_num_points);
+  }
+
+  out.write((const char*) &kTrackerSerializationVersion, sizeof(int));
+  out.write((const char*) &track_id_, sizeof(int));
+  out.write((const char*) &prev_timestamp_, sizeof(double));
+  out.write((const char*) estimated_velocity_.data(), sizeof(float) * 3);
+  out.write((const char*) &alignment_probability_, sizeof(double));
+
+  motion_model_->serialize(out);
+
+  // Save the previous points, down-sampled to keep the state small.
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr points(
+        new pcl::PointCloud<pcl::PointXYZRGB>);
+  if (max_num_points > 0) {
+    if (previousModel_->size() > static_cast<size_t>(max_num_points)) {
+      DownSampler::downSamplePointsDeterministic(
+            previousModel_, max_num_points, points, params_->kUseCeil);
+    } else {
+      points = previousModel_;
+    }
+  }
+
+  const int num_points = points->size();
+  const int num_source_points =
+      points->empty() ? 0 : static_cast<int>(previous_num_points_);
+  out.write((const char*) &num_source_points, sizeof(int));
+  out.write((const char*) &num_points, sizeof(int));
+  for (int i = 0; i < num_points; ++i) {
+    const pcl::PointXYZRGB& point = (*points)[i];
+    out.write((const char*) &point.x, sizeof(float));
+    out.write((const char*) &point.y, sizeof(float));
+    out.write((const char*) &point.z, sizeof(float));
+    out.write((const char*) &point.r, sizeof(uint8_t));
+    out.write((const char*) &point.g, sizeof(uint8_t));
+    out.write((const char*) &point.b, sizeof(uint8_t));
+  }
+
+  return !out.fail();
+}
+
+bool Tracker::deserialize(std::istream& istrm)
+{
+  int serialization_version;
+  istrm.read((char*) &serialization_version, sizeof(int));
+  if (!istrm || serialization_version < 1 ||
+      serialization_version > kTrackerSerializationVersion) {
+    printf("Error - expected tracker serialization version %d\n",
+           kTrackerSerializationVersion);
+    return false;
+  }
+
+  int track_id;
+  double prev_timestamp;
+  Eigen::Vector3f estimated_velocity;
+  double alignment_probability;
+  istrm.read((char*) &track_id, sizeof(int));
+  istrm.read((char*) &prev_timestamp, sizeof(double));
+  istrm.read((char*) estimated_velocity.data(), sizeof(float) * 3);
+  istrm.read((char*) &alignment_probability, sizeof(double));
+
+  boost::shared_ptr<MotionModel> motion_model(new MotionModel(params_));
+  if (!istrm || !motion_model->deserialize(istrm)) {
+    return false;
+  }
+
+  int num_source_points = 0;
+  if (serialization_version >= 2) {
+    istrm.read((char*) &num_source_points, sizeof(int));
+  }
+  int num_points = 0;
+  istrm.read((char*) &num_points, sizeof(int));
+  if (!istrm || num_points < 0 || num_points > kMaxSerializedPoints) {
+    printf("Error - invalid number of points in the tracker state: %d\n",
+           num_points);
+    return false;
+  }
+
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr points(
+        new pcl::PointCloud<pcl::PointXYZRGB>);
+  points->resize(num_points);
+  for (int i = 0; i < num_points; ++i) {
+    pcl::PointXYZRGB& point = (*points)[i];
+    istrm.read((char*) &point.x, sizeof(float));
+    istrm.read((char*) &point.y, sizeof(float));
+    istrm.read((char*) &point.z, sizeof(float));
+    istrm.read((char*) &point.r, sizeof(uint8_t));
+    istrm.read((char*) &point.g, sizeof(uint8_t));
+    istrm.read((char*) &point.b, sizeof(uint8_t));
+  }
+
+  if (!istrm) {
+    printf("Error - reached the end of the tracker state\n");
+    return false;
+  }
+
+  track_id_ = track_id;
+  prev_timestamp_ = prev_timestamp;
+  estimated_velocity_ = estimated_velocity;
+  alignment_probability_ = alignment_probability;
+  motion_model_ = motion_model;
+  previousModel_ = points;
+  previous_model_memory_ = trackCloudMemory(*previousModel_);
+  previous_num_points_ = std::max(num_source_points, num_points);
+  deferred_frame_ = DeferredFrame();
+  num_skipped_frames_ = 0;
+  std::string().swap(dormant_state_);
+  dormant_state_memory_.set(0);
+  num_missed_frames_ = 0;
+
+  return true;
 }
 
 void Tracker::addPoints(
@@ -49,6 +335,8 @@ void Tracker::addPoints(
     Eigen::Vector3f* estimated_velocity,
     double* alignment_probability)
 {
+  ScopedTraceEvent trace_event("Tracker::addPoints", track_id_);
+
   // Do not align if there are no points.
   if (current_points->size() == 0){
     printf("No points - cannot align.\n");
@@ -56,9 +344,72 @@ void Tracker::addPoints(
     return;
   }
 
+  wake();
+  num_missed_frames_ = 0;
+
+  if (deferred_alignment_ && !previousModel_->empty()) {
+    // Only record the frame; a frame that is still waiting to be aligned
+    // is skipped.
+    if (hasDeferredFrame()) {
+      num_skipped_frames_++;
+    }
+    deferred_frame_.points = current_points;
+    deferred_frame_.timestamp = current_timestamp;
+    deferred_frame_.sensor_horizontal_resolution = sensor_horizontal_resolution;
+    deferred_frame_.sensor_vertical_resolution = sensor_vertical_resolution;
+  } else {
+    align(current_points, current_timestamp, sensor_horizontal_resolution,
+          sensor_vertical_resolution);
+  }
+
+  *estimated_velocity = estimated_velocity_;
+  *alignment_probability = alignment_probability_;
+}
+
+void Tracker::addPoints(
+    const PointBuffer& current_points,
+    const double current_timestamp,
+    const double sensor_horizontal_resolution,
+    const double sensor_vertical_resolution,
+    Eigen::Vector3f* estimated_velocity)
+{
+    double alignment_probability;
+    addPoints(current_points, current_timestamp, sensor_horizontal_resolution,
+              sensor_vertical_resolution, estimated_velocity,
+              &alignment_probability);
+}
+
+void Tracker::addPoints(
+    const PointBuffer& current_points,
+    const double current_timestamp,
+    const double sensor_horizontal_resolution,
+    const double sensor_vertical_resolution,
+    Eigen::Vector3f* estimated_velocity,
+    double* alignment_probability)
+{
+  // The cloud is still shared if it holds a deferred frame or if it was
+  // copied along with this tracker, in which case a new cloud is needed.
+  if (!input_points_ || !input_points_.unique()) {
+    input_points_.reset(new pcl::PointCloud<pcl::PointXYZRGB>);
+    input_points_memory_ = trackCloudMemory(*input_points_);
+  }
+  current_points.copyTo(input_points_.get());
+  input_points_memory_->set(getCloudMemoryUsage(*input_points_));
+
+  addPoints(input_points_, current_timestamp, sensor_horizontal_resolution,
+            sensor_vertical_resolution, estimated_velocity,
+            alignment_probability);
+}
+
+void Tracker::align(
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+    const double current_timestamp,
+    const double sensor_horizontal_resolution,
+    const double sensor_vertical_resolution)
+{
   if (previousModel_->empty()) {
     // No previous points - just creating initial model.
-    *estimated_velocity = Eigen::Vector3f::Zero();
+    estimated_velocity_ = Eigen::Vector3f::Zero();
   } else {
     const double timestamp_diff = current_timestamp - prev_timestamp_;
 
@@ -66,40 +417,48 @@ void Tracker::addPoints(
     motion_model_->propagate(timestamp_diff);
 
     // Always align the smaller points to the bigger points.
-    const bool flip = previousModel_->size() > current_points->size();
+    const bool flip = previous_num_points_ > current_points->size();
 
     if (precision_tracker_) {
-      // Align.
+      // Align.  The frame that is the model is identified by its timestamp,
+      // so that if it is also the model of the next alignment, the
+      // precision tracker can reuse the model that it built.
       ScoredTransforms<ScoredTransformXYZ> scored_transforms;
       if (!flip) {
           motion_model_->setFlip(false);
           // Previous points are smaller - align previous points to current.
+          const FrameKey model_key(track_id_, current_timestamp,
+                                   current_points->size());
           precision_tracker_->track(
-                previousModel_, current_points, sensor_horizontal_resolution,
-                sensor_vertical_resolution, *motion_model_, &scored_transforms);
+                previousModel_, current_points, model_key,
+                sensor_horizontal_resolution, sensor_vertical_resolution,
+                *motion_model_, &scored_transforms);
       } else {
           motion_model_->setFlip(true);
 
           // Current points are smaller - align current points to previous.
+          const FrameKey model_key(track_id_, prev_timestamp_,
+                                   previous_num_points_);
           precision_tracker_->track(
-                current_points, previousModel_, sensor_horizontal_resolution,
-                sensor_vertical_resolution, *motion_model_, &scored_transforms);
+                current_points, previousModel_, model_key,
+                sensor_horizontal_resolution, sensor_vertical_resolution,
+                *motion_model_, &scored_transforms);
       }
 
 
       motion_model_->addTransformsWeightedGaussian(scored_transforms,
                                                   timestamp_diff);
       ScoredTransformXYZ best_transform;
-      scored_transforms.findBest(&best_transform, alignment_probability);
+      scored_transforms.findBest(&best_transform, &alignment_probability_);
 
       if (params_->useMean) {
         Eigen::Vector3f mean_velocity = motion_model_->get_mean_velocity();
-        *estimated_velocity = mean_velocity;
+        estimated_velocity_ = mean_velocity;
       } else {
         Eigen::Vector3f best_displacement;
         best_transform.getEigen(&best_displacement);
 
-        *estimated_velocity = (flip ? -1 : 1) * best_displacement / timestamp_diff;
+        estimated_velocity_ = (flip ? -1 : 1) * best_displacement / timestamp_diff;
       }
     } else {
       // Track using the centroid-based Kalman filter.
@@ -114,12 +473,21 @@ void Tracker::addPoints(
       motion_model_->addCentroidDiff(centroidDiff, timestamp_diff);
 
       Eigen::Vector3f mean_velocity = motion_model_->get_mean_velocity();
-      *estimated_velocity = mean_velocity;
+      estimated_velocity_ = mean_velocity;
     }
   }
 
-  // Save mdoel and timestamp.
-  *previousModel_ = *current_points;
+  // Save mdoel and timestamp.  Points from a PointBuffer are swapped in
+  // rather than copied, unless the previous points are shared (e.g. by a
+  // copy of this tracker).
+  if (current_points == input_points_ && previousModel_.unique()) {
+    previousModel_.swap(input_points_);
+    previous_model_memory_.swap(input_points_memory_);
+  } else {
+    *previousModel_ = *current_points;
+  }
+  previous_model_memory_->set(getCloudMemoryUsage(*previousModel_));
+  previous_num_points_ = previousModel_->size();
   prev_timestamp_ = current_timestamp;
 }
 
@@ -0,0 +1,100 @@
+/*
+ * tracker_snapshot.cpp
+ *
+ *      Author: davheld
+ *
+ */
+
+#include <cstdio>
+#include <fstream>
+
+#include <precision_tracking/tracker_snapshot.h>
+
+namespace precision_tracking {
+
+namespace {
+
+// Identifies a snapshot file ("PTSN").
+const int kSnapshotMagic = 0x4e535450;
+
+} // namespace
+
+bool saveTrackerSnapshot(
+    const std::string& filename,
+    const std::vector<boost::shared_ptr<Tracker> >& trackers,
+    const int max_num_points)
+{
+  const std::string temp_filename = filename + ".tmp";
+
+  std::ofstream ofs(temp_filename.c_str(), std::ios::out | std::ios::binary);
+  if (!ofs) {
+    printf("Error - Could not open file: %s\n", temp_filename.c_str());
+    return false;
+  }
+
+  const int num_trackers = trackers.size();
+  ofs.write((const char*) &kSnapshotMagic, sizeof(int));
+  ofs.write((const char*) &num_trackers, sizeof(int));
+  for (int i = 0; i < num_trackers; ++i) {
+    // Otherwise the number of trackers would not match the saved states, so
+    // the previous snapshot is kept.
+    if (!trackers[i]->serialize(ofs, max_num_points)) {
+      printf("Error - Could not save tracker %d to: %s\n", i,
+             temp_filename.c_str());
+      ofs.close();
+      remove(temp_filename.c_str());
+      return false;
+    }
+  }
+
+  ofs.close();
+  if (!ofs) {
+    printf("Error - Could not write file: %s\n", temp_filename.c_str());
+    return false;
+  }
+
+  if (rename(temp_filename.c_str(), filename.c_str()) != 0) {
+    printf("Error - Could not rename %s to %s\n", temp_filename.c_str(),
+           filename.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+bool loadTrackerSnapshot(
+    const std::string& filename,
+    const Params* params,
+    std::vector<boost::shared_ptr<Tracker> >* trackers)
+{
+  std::ifstream ifs(filename.c_str(), std::ios::in | std::ios::binary);
+  if (!ifs) {
+    printf("Error - Could not open file: %s\n", filename.c_str());
+    return false;
+  }
+
+  int magic;
+  int num_trackers;
+  ifs.read((char*) &magic, sizeof(int));
+  ifs.read((char*) &num_trackers, sizeof(int));
+  if (!ifs || magic != kSnapshotMagic || num_trackers < 0) {
+    printf("Error - Not a tracker snapshot: %s\n", filename.c_str());
+    return false;
+  }
+
+  std::vector<boost::shared_ptr<Tracker> > restored_trackers;
+  for (int i = 0; i < num_trackers; ++i) {
+    boost::shared_ptr<Tracker> tracker(new Tracker(params));
+    if (!tracker->deserialize(ifs)) {
+      printf("Error - Could not restore tracker %d from: %s\n", i,
+             filename.c_str());
+      return false;
+    }
+    restored_trackers.push_back(tracker);
+  }
+
+  trackers->swap(restored_trackers);
+  return true;
+}
+
+} // namespace precision_tracking
@@ -6,17 +6,35 @@
  *
  */
 
+#include <algorithm>
 #include <string>
 #include <cstdio>
 #include <sstream>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include <boost/math/constants/constants.hpp>
 #include <boost/make_shared.hpp>
 
+#include <pcl/common/centroid.h>
+
+#include <precision_tracking/async_tracker.h>
 #include <precision_tracking/track_manager_color.h>
 #include <precision_tracking/tracker.h>
 #include <precision_tracking/high_res_timer.h>
+#include <precision_tracking/cycle_timer.h>
+#include <precision_tracking/density_grid_small_batch.h>
+#include <precision_tracking/density_grid_small_evaluator.h>
+#include <precision_tracking/down_sampler.h>
+#include <precision_tracking/memory_usage.h>
+#include <precision_tracking/motion_model.h>
+#include <precision_tracking/motion_model_bank.h>
+#include <precision_tracking/trace_recorder.h>
+#include <precision_tracking/segmented_tracker.h>
 #include <precision_tracking/sensor_specs.h>
+#include <precision_tracking/sweep_ring.h>
+#include <precision_tracking/track_associator.h>
+#include <precision_tracking/tracker_snapshot.h>
 
 using std::string;
 
@@ -24,6 +42,10 @@ namespace {
 
 const double pi = boost::math::constants::pi<double>();
 
+// Whether to profile each stage of the precision tracker with hardware
+// performance counters.
+bool profile_stages = false;
+
 } // namespace
 
 // Structure for storing estimated velocities for each track.
@@ -206,6 +228,58 @@ void find_bad_frames(const precision_tracking::track_manager_color::TrackManager
   }
 }
 
+// Print the time spent scoring each annealing level, summed over all threads.
+void printLevelScoringTimes(
+    const std::vector<boost::shared_ptr<precision_tracking::PrecisionTracker> >&
+      precision_trackers) {
+  std::vector<precision_tracking::CycleTimer> level_timers;
+  for (size_t i = 0; i < precision_trackers.size(); ++i) {
+    const std::vector<precision_tracking::CycleTimer>& timers =
+        precision_trackers[i]->get_adh_tracker3d().getLevelScoringTimers();
+    for (size_t j = 0; j < timers.size(); ++j) {
+      if (level_timers.size() <= j) {
+        level_timers.push_back(
+              precision_tracking::CycleTimer(timers[j].description_));
+      }
+      level_timers[j].add(timers[j]);
+    }
+  }
+
+  for (size_t i = 0; i < level_timers.size(); ++i) {
+    level_timers[i].print();
+  }
+}
+
+// Print the profile of each stage of the precision tracker, summed over all
+// threads.
+void printStageProfiles(
+    const std::vector<boost::shared_ptr<precision_tracking::PrecisionTracker> >&
+      precision_trackers) {
+  std::vector<precision_tracking::StageProfile> stage_profiles;
+  for (size_t i = 0; i < precision_trackers.size(); ++i) {
+    const std::vector<precision_tracking::StageProfile>& profiles =
+        precision_trackers[i]->get_stage_profiles();
+    for (size_t j = 0; j < profiles.size(); ++j) {
+      if (stage_profiles.size() <= j) {
+        stage_profiles.push_back(
+              precision_tracking::StageProfile(profiles[j].getName()));
+      }
+      stage_profiles[j].add(profiles[j]);
+    }
+  }
+
+  for (size_t i = 0; i < stage_profiles.size(); ++i) {
+    stage_profiles[i].print();
+  }
+
+  // The rest of the alignment is spent generating the candidate transforms.
+  if (stage_profiles.size() == precision_tracking::PrecisionTracker::kNumStages) {
+    printf("[PROFILE] Candidate generation (alignment without scoring): %lg ms.\n",
+           stage_profiles[precision_tracking::PrecisionTracker::kAlignment].getTimer().getMilliseconds() -
+           stage_profiles[precision_tracking::PrecisionTracker::kScoring].getTimer().getMilliseconds());
+  }
+}
+
 void track(
            const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
            const precision_tracking::Params& params,
@@ -222,12 +296,18 @@ void track(
 
   const int num_threads = do_parallel ? 8 : 1;
 
+  // Measure the peak memory used by this run.
+  precision_tracking::resetPeakMemoryUsage();
+
   std::vector<precision_tracking::Tracker> trackers;
+  std::vector<boost::shared_ptr<precision_tracking::PrecisionTracker> >
+      precision_trackers;
   for (int i = 0; i < num_threads; ++i) {
     precision_tracking::Tracker tracker(&params);
     if (use_precision_tracker) {
-      tracker.setPrecisionTracker(
+      precision_trackers.push_back(
           boost::make_shared<precision_tracking::PrecisionTracker>(&params));
+      tracker.setPrecisionTracker(precision_trackers.back());
     }
     trackers.push_back(tracker);
   }
@@ -252,6 +332,7 @@ void track(
 
     // Extract frames.
     const boost::shared_ptr<precision_tracking::track_manager_color::Track>& track = tracks[i];
+    tracker.setTrackId(track->track_num_);
     const std::vector< boost::shared_ptr<precision_tracking::track_manager_color::Frame> > frames =
         track->frames_;
 
@@ -294,31 +375,949 @@ void track(
 
   const double ms = hrt.getMilliseconds();
   printf("Mean runtime per frame: %lf ms\n", ms / total_num_frames);
+
+  printLevelScoringTimes(precision_trackers);
+
+  if (params.profileStages) {
+    printStageProfiles(precision_trackers);
+  }
+
+  printf("%s\n", precision_tracking::reportMemoryUsage().c_str());
 }
 
-void trackAndEvaluate(
+// Track each object by splitting long tracks into segments that are tracked
+// in parallel; the tracks themselves are processed one after another.
+void trackSegmented(
     const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
-    const string gt_folder,
     const precision_tracking::Params& params,
-    const bool use_precision_tracker,
-    const bool track_parallel) {
-  // Track all objects and store the estimated velocities.
-  std::vector<TrackResults> velocity_estimates;
-  track(track_manager, params, use_precision_tracker, track_parallel, &velocity_estimates);
+    std::vector<TrackResults>* velocity_estimates) {
+  const std::vector< boost::shared_ptr<precision_tracking::track_manager_color::Track> >& tracks =
+      track_manager.tracks_;
+
+  int total_num_frames = 0;
+  int num_segments = 0;
+
+  const int num_threads = 8;
+  precision_tracking::SegmentedTracker segmented_tracker(&params, true,
+                                                         num_threads);
+
+  velocity_estimates->resize(tracks.size());
+
+  std::ostringstream hrt_title_stream;
+  hrt_title_stream << "Total time for tracking " << tracks.size() << " objects";
+  precision_tracking::HighResTimer hrt(hrt_title_stream.str(), CLOCK_REALTIME);
+  hrt.start();
+
+  // Iterate over all tracks.
+  for (size_t i = 0; i < tracks.size(); ++i) {
+    const boost::shared_ptr<precision_tracking::track_manager_color::Track>& track = tracks[i];
+    const std::vector< boost::shared_ptr<precision_tracking::track_manager_color::Frame> >& frames =
+        track->frames_;
+
+    total_num_frames += frames.size();
+    num_segments += segmented_tracker.getNumSegments(frames.size());
+
+    std::vector<precision_tracking::TrackedFrame> tracked_frames(frames.size());
+    for (size_t j = 0; j < frames.size(); ++j) {
+      precision_tracking::TrackedFrame& tracked_frame = tracked_frames[j];
+      tracked_frame.cloud = frames[j]->cloud_;
+      tracked_frame.timestamp = frames[j]->timestamp_;
+
+      // Get the sensor resolution.
+      precision_tracking::getSensorResolution(
+            frames[j]->getCentroid(),
+            &tracked_frame.sensor_horizontal_resolution,
+            &tracked_frame.sensor_vertical_resolution);
+    }
+
+    std::vector<Eigen::Vector3f> estimated_velocities;
+    segmented_tracker.track(tracked_frames, track->track_num_,
+                            &estimated_velocities);
+
+    // We don't have a velocity for the first frame of each track.
+    TrackResults& track_estimates = (*velocity_estimates)[i];
+    track_estimates.track_num = track->track_num_;
+    for (size_t j = 1; j < estimated_velocities.size(); ++j) {
+      track_estimates.estimated_velocities.push_back(estimated_velocities[j]);
+      track_estimates.ignore_frame.push_back(false);
+    }
+  }
+
+  hrt.stop();
+  hrt.print();
+
+  const double ms = hrt.getMilliseconds();
+  printf("Mean runtime per frame: %lf ms\n", ms / total_num_frames);
+  printf("Split %zu tracks into %d segments\n", tracks.size(), num_segments);
+}
+
+// Track each object from points stored in separate arrays of coordinates,
+// as a segmentation stage that does not use PCL would provide them.
+void trackPointBuffers(
+    const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
+    const precision_tracking::Params& params,
+    std::vector<TrackResults>* velocity_estimates) {
+  const std::vector< boost::shared_ptr<precision_tracking::track_manager_color::Track> >& tracks =
+      track_manager.tracks_;
+
+  precision_tracking::Tracker tracker(&params);
+  tracker.setPrecisionTracker(
+      boost::make_shared<precision_tracking::PrecisionTracker>(&params));
+
+  velocity_estimates->resize(tracks.size());
+
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<float> z;
+
+  for (size_t i = 0; i < tracks.size(); ++i) {
+    tracker.clear();
+
+    const boost::shared_ptr<precision_tracking::track_manager_color::Track>& track = tracks[i];
+    tracker.setTrackId(track->track_num_);
+    const std::vector< boost::shared_ptr<precision_tracking::track_manager_color::Frame> >& frames =
+        track->frames_;
+
+    TrackResults& track_estimates = (*velocity_estimates)[i];
+    track_estimates.track_num = track->track_num_;
+
+    for (size_t j = 0; j < frames.size(); ++j) {
+      const pcl::PointCloud<pcl::PointXYZRGB>& cloud = *frames[j]->cloud_;
+      x.resize(cloud.size());
+      y.resize(cloud.size());
+      z.resize(cloud.size());
+      for (size_t k = 0; k < cloud.size(); ++k) {
+        x[k] = cloud[k].x;
+        y[k] = cloud[k].y;
+        z[k] = cloud[k].z;
+      }
+
+      double sensor_horizontal_resolution;
+      double sensor_vertical_resolution;
+      precision_tracking::getSensorResolution(
+            frames[j]->getCentroid(), &sensor_horizontal_resolution,
+            &sensor_vertical_resolution);
+
+      precision_tracking::PointBuffer points(NULL, NULL, NULL, 0, 0);
+      if (!cloud.empty()) {
+        points = precision_tracking::PointBuffer(
+              &x[0], &y[0], &z[0], sizeof(float), cloud.size());
+      }
+      Eigen::Vector3f estimated_velocity;
+      tracker.addPoints(points, frames[j]->timestamp_,
+                        sensor_horizontal_resolution,
+                        sensor_vertical_resolution, &estimated_velocity);
+
+      if (j > 0) {
+        track_estimates.estimated_velocities.push_back(estimated_velocity);
+        track_estimates.ignore_frame.push_back(false);
+      }
+    }
+  }
+}
+
+// Write the frames of all tracks into a sweep ring from a separate process,
+// one sweep per frame index, as an out-of-process segmentation stage would.
+void produceSweeps(
+    const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
+    const string& ring_name) {
+  const std::vector< boost::shared_ptr<precision_tracking::track_manager_color::Track> >& tracks =
+      track_manager.tracks_;
+
+  size_t num_sweeps = 0;
+  for (size_t i = 0; i < tracks.size(); ++i) {
+    num_sweeps = std::max(num_sweeps, tracks[i]->frames_.size());
+  }
+
+  precision_tracking::SweepRingProducer producer(ring_name);
+  for (size_t j = 0; j < num_sweeps; ++j) {
+    // Wait for the tracker to release a slot.
+    while (!producer.beginSweep(j)) {
+      usleep(100);
+    }
+
+    for (size_t i = 0; i < tracks.size(); ++i) {
+      if (j >= tracks[i]->frames_.size()) {
+        continue;
+      }
+      const boost::shared_ptr<precision_tracking::track_manager_color::Frame>& frame =
+          tracks[i]->frames_[j];
+      const pcl::PointCloud<pcl::PointXYZRGB>& cloud = *frame->cloud_;
+
+      double sensor_horizontal_resolution;
+      double sensor_vertical_resolution;
+      precision_tracking::getSensorResolution(
+            frame->getCentroid(), &sensor_horizontal_resolution,
+            &sensor_vertical_resolution);
+
+      // Empty frames are sent too, so that each track gets all of its frames.
+      precision_tracking::PointBuffer points(NULL, NULL, NULL, 0, 0);
+      if (!cloud.empty()) {
+        points = precision_tracking::PointBuffer(
+              &cloud[0].x, &cloud[0].y, &cloud[0].z, sizeof(pcl::PointXYZRGB),
+              cloud.size());
+        points.setColors(&cloud[0].r, &cloud[0].g, &cloud[0].b,
+                         sizeof(pcl::PointXYZRGB));
+      }
+      if (!producer.addObject(i, frame->timestamp_,
+                              sensor_horizontal_resolution,
+                              sensor_vertical_resolution, points)) {
+        printf("Error - the sweep ring slots are too small\n");
+        exit(1);
+      }
+    }
+    producer.commitSweep();
+  }
+  producer.close();
+}
+
+// Track each object from the sweeps that a separate producer process writes
+// into a sweep ring.
+void trackSweepRing(
+    const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
+    const precision_tracking::Params& params,
+    std::vector<TrackResults>* velocity_estimates) {
+  const std::vector< boost::shared_ptr<precision_tracking::track_manager_color::Track> >& tracks =
+      track_manager.tracks_;
+
+  // Each slot can hold every object of a sweep.
+  size_t slot_size = 4096;
+  for (size_t i = 0; i < tracks.size(); ++i) {
+    size_t max_num_points = 0;
+    for (size_t j = 0; j < tracks[i]->frames_.size(); ++j) {
+      max_num_points = std::max(max_num_points,
+                                tracks[i]->frames_[j]->cloud_->size());
+    }
+    slot_size += 64 + 15 * max_num_points;
+  }
+
+  const string ring_name = "/precision_tracking_test_ring";
+  precision_tracking::SweepRingConsumer consumer(ring_name, 4, slot_size);
+
+  fflush(stdout);
+  const pid_t producer_pid = fork();
+  if (producer_pid < 0) {
+    printf("Error - could not start the producer process\n");
+    exit(1);
+  }
+  if (producer_pid == 0) {
+    produceSweeps(track_manager, ring_name);
+    _exit(0);
+  }
+
+  boost::shared_ptr<precision_tracking::PrecisionTracker> precision_tracker =
+      boost::make_shared<precision_tracking::PrecisionTracker>(&params);
+  std::vector<precision_tracking::Tracker> trackers;
+  trackers.reserve(tracks.size());
+  std::vector<size_t> num_frames(tracks.size(), 0);
+  velocity_estimates->resize(tracks.size());
+  for (size_t i = 0; i < tracks.size(); ++i) {
+    // Construct each tracker separately, since copies of a tracker share
+    // its motion model and previous points.
+    trackers.push_back(precision_tracking::Tracker(&params));
+    trackers.back().setTrackId(tracks[i]->track_num_);
+    trackers.back().setPrecisionTracker(precision_tracker);
+    (*velocity_estimates)[i].track_num = tracks[i]->track_num_;
+  }
+
+  precision_tracking::RingSweep sweep;
+  while (true) {
+    const bool closed = consumer.isClosed();
+    if (!consumer.readSweep(&sweep)) {
+      if (closed) {
+        break;
+      }
+      usleep(100);
+      continue;
+    }
+
+    for (size_t k = 0; k < sweep.objects.size(); ++k) {
+      const precision_tracking::RingObject& object = sweep.objects[k];
+      precision_tracking::Tracker& tracker = trackers[object.track_id];
+
+      Eigen::Vector3f estimated_velocity;
+      tracker.addPoints(object.points, object.timestamp,
+                        object.sensor_horizontal_resolution,
+                        object.sensor_vertical_resolution,
+                        &estimated_velocity);
+
+      // As in track(), there is no velocity for the first frame.
+      if (num_frames[object.track_id]++ > 0) {
+        TrackResults& track_estimates = (*velocity_estimates)[object.track_id];
+        track_estimates.estimated_velocities.push_back(estimated_velocity);
+        track_estimates.ignore_frame.push_back(false);
+      }
+    }
+    consumer.releaseSweep();
+  }
+
+  waitpid(producer_pid, NULL, 0);
+}
+
+// Track each object with an AsyncTracker: all frames of all tracks are
+// queued at once, and the workers keep the frames of each track in order.
+void trackAsync(
+    const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
+    const precision_tracking::Params& params,
+    std::vector<TrackResults>* velocity_estimates) {
+  const std::vector< boost::shared_ptr<precision_tracking::track_manager_color::Track> >& tracks =
+      track_manager.tracks_;
+
+  int total_num_frames = 0;
+  for (size_t i = 0; i < tracks.size(); ++i) {
+    total_num_frames += tracks[i]->frames_.size();
+  }
+
+  const int num_threads = 8;
+  std::vector<precision_tracking::Tracker> trackers;
+  trackers.reserve(tracks.size());
+  for (size_t i = 0; i < tracks.size(); ++i) {
+    // Construct each tracker separately, since copies of a tracker share
+    // its motion model and previous points.
+    trackers.push_back(precision_tracking::Tracker(&params));
+    trackers.back().setTrackId(tracks[i]->track_num_);
+  }
+
+  std::ostringstream hrt_title_stream;
+  hrt_title_stream << "Total time for tracking " << tracks.size() << " objects";
+  precision_tracking::HighResTimer hrt(hrt_title_stream.str(), CLOCK_REALTIME);
+  hrt.start();
+
+  precision_tracking::AsyncTracker async_tracker(&params, true, num_threads);
+
+  std::vector<std::vector<boost::shared_ptr<precision_tracking::TrackingFuture> > >
+      futures(tracks.size());
+  for (size_t i = 0; i < tracks.size(); ++i) {
+    const std::vector< boost::shared_ptr<precision_tracking::track_manager_color::Frame> >& frames =
+        tracks[i]->frames_;
+    for (size_t j = 0; j < frames.size(); ++j) {
+      double sensor_horizontal_resolution;
+      double sensor_vertical_resolution;
+      precision_tracking::getSensorResolution(
+            frames[j]->getCentroid(), &sensor_horizontal_resolution,
+            &sensor_vertical_resolution);
+
+      futures[i].push_back(async_tracker.addPoints(
+          &trackers[i], frames[j]->cloud_, frames[j]->timestamp_,
+          sensor_horizontal_resolution, sensor_vertical_resolution));
+    }
+  }
+
+  // Collect the velocities as they become available.
+  velocity_estimates->resize(tracks.size());
+  for (size_t i = 0; i < tracks.size(); ++i) {
+    TrackResults& track_estimates = (*velocity_estimates)[i];
+    track_estimates.track_num = tracks[i]->track_num_;
+
+    // We don't have a velocity for the first frame of each track.
+    for (size_t j = 1; j < futures[i].size(); ++j) {
+      track_estimates.estimated_velocities.push_back(
+            futures[i][j]->getEstimatedVelocity());
+      track_estimates.ignore_frame.push_back(false);
+    }
+  }
+
+  hrt.stop();
+  hrt.print();
+
+  const double ms = hrt.getMilliseconds();
+  printf("Mean runtime per frame: %lf ms\n", ms / total_num_frames);
+}
+
+// Track each object twice, with one tracker that stays awake and one that
+// is made dormant after every frame and woken by the next one, and report
+// the largest difference between the velocity covariances of their motion
+// models.
+void trackDormant(
+    const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
+    const precision_tracking::Params& params,
+    std::vector<TrackResults>* awake_estimates,
+    std::vector<TrackResults>* dormant_estimates) {
+  const std::vector< boost::shared_ptr<precision_tracking::track_manager_color::Track> >& tracks =
+      track_manager.tracks_;
+
+  precision_tracking::Tracker awake_tracker(&params);
+  awake_tracker.setPrecisionTracker(
+      boost::make_shared<precision_tracking::PrecisionTracker>(&params));
+  precision_tracking::Tracker dormant_tracker(&params);
+  dormant_tracker.setPrecisionTracker(
+      boost::make_shared<precision_tracking::PrecisionTracker>(&params));
+
+  awake_estimates->resize(tracks.size());
+  dormant_estimates->resize(tracks.size());
+
+  double max_covariance_difference = 0;
+  double max_covariance = 0;
+
+  for (size_t i = 0; i < tracks.size(); ++i) {
+    awake_tracker.clear();
+    dormant_tracker.clear();
+
+    const boost::shared_ptr<precision_tracking::track_manager_color::Track>& track = tracks[i];
+    awake_tracker.setTrackId(track->track_num_);
+    dormant_tracker.setTrackId(track->track_num_);
+    const std::vector< boost::shared_ptr<precision_tracking::track_manager_color::Frame> >& frames =
+        track->frames_;
 
+    (*awake_estimates)[i].track_num = track->track_num_;
+    (*dormant_estimates)[i].track_num = track->track_num_;
+
+    for (size_t j = 0; j < frames.size(); ++j) {
+      double sensor_horizontal_resolution;
+      double sensor_vertical_resolution;
+      precision_tracking::getSensorResolution(
+            frames[j]->getCentroid(), &sensor_horizontal_resolution,
+            &sensor_vertical_resolution);
+
+      Eigen::Vector3f awake_velocity;
+      awake_tracker.addPoints(frames[j]->cloud_, frames[j]->timestamp_,
+                              sensor_horizontal_resolution,
+                              sensor_vertical_resolution, &awake_velocity);
+
+      Eigen::Vector3f dormant_velocity;
+      dormant_tracker.addPoints(frames[j]->cloud_, frames[j]->timestamp_,
+                                sensor_horizontal_resolution,
+                                sensor_vertical_resolution, &dormant_velocity);
+      dormant_tracker.makeDormant();
+
+      if (j > 0) {
+        (*awake_estimates)[i].estimated_velocities.push_back(awake_velocity);
+        (*awake_estimates)[i].ignore_frame.push_back(false);
+        (*dormant_estimates)[i].estimated_velocities.push_back(dormant_velocity);
+        (*dormant_estimates)[i].ignore_frame.push_back(false);
+      }
+    }
+
+    // This wakes the dormant tracker.
+    const Eigen::Matrix3d& awake_covariance =
+        awake_tracker.get_motion_model().get_covariance_velocity();
+    const Eigen::Matrix3d& dormant_covariance =
+        dormant_tracker.get_motion_model().get_covariance_velocity();
+    max_covariance_difference = std::max(max_covariance_difference,
+        (awake_covariance - dormant_covariance).cwiseAbs().maxCoeff());
+    max_covariance = std::max(max_covariance,
+                              awake_covariance.cwiseAbs().maxCoeff());
+  }
+
+  printf("Velocity covariance of dormant trackers: max difference %lg "
+         "(largest covariance entry %lg)\n", max_covariance_difference,
+         max_covariance);
+}
+
+// Track the first half of the frames of each object, save the trackers to
+// a snapshot and restore them, and then track the second half with both the
+// original and the restored trackers.  Every third tracker is dormant when
+// the snapshot is saved.
+void trackSnapshot(
+    const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
+    const precision_tracking::Params& params,
+    std::vector<TrackResults>* original_estimates,
+    std::vector<TrackResults>* restored_estimates) {
+  const std::vector< boost::shared_ptr<precision_tracking::track_manager_color::Track> >& tracks =
+      track_manager.tracks_;
+
+  boost::shared_ptr<precision_tracking::PrecisionTracker> original_precision_tracker =
+      boost::make_shared<precision_tracking::PrecisionTracker>(&params);
+  boost::shared_ptr<precision_tracking::PrecisionTracker> restored_precision_tracker =
+      boost::make_shared<precision_tracking::PrecisionTracker>(&params);
+
+  std::vector<boost::shared_ptr<precision_tracking::Tracker> > trackers;
+  for (size_t i = 0; i < tracks.size(); ++i) {
+    boost::shared_ptr<precision_tracking::Tracker> tracker(
+          new precision_tracking::Tracker(&params));
+    tracker->setPrecisionTracker(original_precision_tracker);
+    tracker->setTrackId(tracks[i]->track_num_);
+
+    const std::vector< boost::shared_ptr<precision_tracking::track_manager_color::Frame> >& frames =
+        tracks[i]->frames_;
+    for (size_t j = 0; j < frames.size() / 2; ++j) {
+      double sensor_horizontal_resolution;
+      double sensor_vertical_resolution;
+      precision_tracking::getSensorResolution(
+            frames[j]->getCentroid(), &sensor_horizontal_resolution,
+            &sensor_vertical_resolution);
+      Eigen::Vector3f estimated_velocity;
+      tracker->addPoints(frames[j]->cloud_, frames[j]->timestamp_,
+                         sensor_horizontal_resolution,
+                         sensor_vertical_resolution, &estimated_velocity);
+    }
+    if (i % 3 == 2) {
+      tracker->makeDormant();
+    }
+    trackers.push_back(tracker);
+  }
+
+  const string snapshot_file = "test_tracking_snapshot.bin";
+  std::vector<boost::shared_ptr<precision_tracking::Tracker> > restored_trackers;
+  if (!precision_tracking::saveTrackerSnapshot(snapshot_file, trackers,
+                                               params.kPrevFrameDownsample) ||
+      !precision_tracking::loadTrackerSnapshot(snapshot_file, &params,
+                                               &restored_trackers)) {
+    printf("Error - could not save and restore the snapshot\n");
+    return;
+  }
+  remove(snapshot_file.c_str());
+  if (restored_trackers.size() != trackers.size()) {
+    printf("Error - restored %zu of %zu trackers\n", restored_trackers.size(),
+           trackers.size());
+    return;
+  }
+
+  original_estimates->resize(tracks.size());
+  restored_estimates->resize(tracks.size());
+  for (size_t i = 0; i < tracks.size(); ++i) {
+    restored_trackers[i]->setPrecisionTracker(restored_precision_tracker);
+    (*original_estimates)[i].track_num = tracks[i]->track_num_;
+    (*restored_estimates)[i].track_num = tracks[i]->track_num_;
+
+    const std::vector< boost::shared_ptr<precision_tracking::track_manager_color::Frame> >& frames =
+        tracks[i]->frames_;
+    for (size_t j = frames.size() / 2; j < frames.size(); ++j) {
+      double sensor_horizontal_resolution;
+      double sensor_vertical_resolution;
+      precision_tracking::getSensorResolution(
+            frames[j]->getCentroid(), &sensor_horizontal_resolution,
+            &sensor_vertical_resolution);
+
+      Eigen::Vector3f original_velocity;
+      trackers[i]->addPoints(frames[j]->cloud_, frames[j]->timestamp_,
+                             sensor_horizontal_resolution,
+                             sensor_vertical_resolution, &original_velocity);
+      Eigen::Vector3f restored_velocity;
+      restored_trackers[i]->addPoints(frames[j]->cloud_, frames[j]->timestamp_,
+                                      sensor_horizontal_resolution,
+                                      sensor_vertical_resolution,
+                                      &restored_velocity);
+
+      // We don't have a velocity for the first frame of each track.
+      if (j > 0) {
+        (*original_estimates)[i].estimated_velocities.push_back(
+              original_velocity);
+        (*original_estimates)[i].ignore_frame.push_back(false);
+        (*restored_estimates)[i].estimated_velocities.push_back(
+              restored_velocity);
+        (*restored_estimates)[i].ignore_frame.push_back(false);
+      }
+    }
+  }
+}
+
+// Track all but the last frame of each object, leaving some trackers
+// dormant and some with a deferred frame, and then associate the last frames
+// with the tracks.
+void associateLastFrames(
+    const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
+    const precision_tracking::Params& params) {
+  const std::vector< boost::shared_ptr<precision_tracking::track_manager_color::Track> >& tracks =
+      track_manager.tracks_;
+
+  boost::shared_ptr<precision_tracking::PrecisionTracker> precision_tracker =
+      boost::make_shared<precision_tracking::PrecisionTracker>(&params);
+
+  std::vector<boost::shared_ptr<precision_tracking::Tracker> > trackers;
+  std::vector<precision_tracking::TrackedFrame> segments;
+  int num_dormant = 0;
+  int num_deferred = 0;
+  for (size_t i = 0; i < tracks.size(); ++i) {
+    const std::vector< boost::shared_ptr<precision_tracking::track_manager_color::Frame> >& frames =
+        tracks[i]->frames_;
+    if (frames.size() < 3) {
+      continue;
+    }
+
+    boost::shared_ptr<precision_tracking::Tracker> tracker(
+          new precision_tracking::Tracker(&params));
+    tracker->setPrecisionTracker(precision_tracker);
+    tracker->setTrackId(tracks[i]->track_num_);
+
+    for (size_t j = 0; j < frames.size(); ++j) {
+      precision_tracking::TrackedFrame frame;
+      frame.cloud = frames[j]->cloud_;
+      frame.timestamp = frames[j]->timestamp_;
+      precision_tracking::getSensorResolution(
+            frames[j]->getCentroid(), &frame.sensor_horizontal_resolution,
+            &frame.sensor_vertical_resolution);
+
+      if (j + 1 == frames.size()) {
+        segments.push_back(frame);
+        break;
+      }
+
+      // The frame before the last one of every third track is deferred.
+      if (j + 2 == frames.size() && trackers.size() % 3 == 1) {
+        tracker->setDeferredAlignment(true);
+        num_deferred++;
+      }
+
+      Eigen::Vector3f estimated_velocity;
+      tracker->addPoints(frame.cloud, frame.timestamp,
+                         frame.sensor_horizontal_resolution,
+                         frame.sensor_vertical_resolution,
+                         &estimated_velocity);
+    }
+
+    if (trackers.size() % 3 == 2) {
+      tracker->makeDormant();
+      num_dormant++;
+    }
+    trackers.push_back(tracker);
+  }
+
+  precision_tracking::HighResTimer hrt("Total time for associating the last frames",
+                                       CLOCK_REALTIME);
+  hrt.start();
+
+  precision_tracking::TrackAssociator track_associator(&params);
+  std::vector<int> track_indices;
+  track_associator.associate(trackers, segments, &track_indices);
+
+  hrt.stop();
+  hrt.print();
+
+  int num_correct = 0;
+  for (size_t j = 0; j < segments.size(); ++j) {
+    if (track_indices[j] == static_cast<int>(j)) {
+      num_correct++;
+    }
+  }
+
+  int num_still_dormant = 0;
+  int num_still_deferred = 0;
+  for (size_t i = 0; i < trackers.size(); ++i) {
+    if (trackers[i]->isDormant()) {
+      num_still_dormant++;
+    }
+    if (trackers[i]->hasDeferredFrame()) {
+      num_still_deferred++;
+    }
+  }
+
+  printf("Associated %d of %zu last frames with their own tracks\n",
+         num_correct, segments.size());
+  printf("%d of %d dormant trackers stayed dormant, %d of %d deferred frames "
+         "stayed deferred\n", num_still_dormant, num_dormant,
+         num_still_deferred, num_deferred);
+}
+
+// Score the coarse alignment of consecutive frames of small objects with
+// DensityGridSmallBatch and with DensityGridSmallEvaluator, one object at a
+// time, and report the largest difference between their scores.
+void compareSmallBatch(
+    const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
+    const precision_tracking::Params& params) {
+  typedef pcl::PointCloud<pcl::PointXYZRGB> Cloud;
+  const std::vector< boost::shared_ptr<precision_tracking::track_manager_color::Track> >& tracks =
+      track_manager.tracks_;
+
+  const double xy_sampling_resolution = params.kInitialXYSamplingResolution;
+  const int num_steps = static_cast<int>(
+        floor(params.kAssociationSearchRadius / xy_sampling_resolution));
+
+  // Enough problems for several blocks, at most.
+  const size_t max_num_problems =
+      5 * precision_tracking::DensityGridSmallBatch::kBlockSize;
+
+  std::vector<precision_tracking::SmallAlignmentProblem> problems;
+  std::vector<precision_tracking::MotionModel> motion_models;
+  motion_models.reserve(max_num_problems);
+  std::vector<std::vector<precision_tracking::XYZTransform> > transforms(
+        max_num_problems);
+  for (size_t i = 0; i < tracks.size() && problems.size() < max_num_problems;
+       ++i) {
+    const std::vector< boost::shared_ptr<precision_tracking::track_manager_color::Frame> >& frames =
+        tracks[i]->frames_;
+
+    // The centroid-based Kalman filter provides the motion model.
+    precision_tracking::Tracker tracker(&params);
+    for (size_t j = 0; j < frames.size() && problems.size() < max_num_problems;
+         ++j) {
+      double sensor_horizontal_resolution;
+      double sensor_vertical_resolution;
+      precision_tracking::getSensorResolution(
+            frames[j]->getCentroid(), &sensor_horizontal_resolution,
+            &sensor_vertical_resolution);
+
+      if (j > 0) {
+        Cloud::Ptr prev_points(new Cloud);
+        precision_tracking::DownSampler::downSamplePointsDeterministic(
+              frames[j - 1]->cloud_, params.kPrevFrameDownsample, prev_points,
+              params.kUseCeil);
+        Cloud::Ptr current_points(new Cloud);
+        precision_tracking::DownSampler::downSamplePointsDeterministic(
+              frames[j]->cloud_, params.kCurrFrameDownsample, current_points,
+              params.kUseCeil);
+
+        if (precision_tracking::DensityGridSmallEvaluator::fits(
+              *current_points, *prev_points, xy_sampling_resolution)) {
+          const size_t k = problems.size();
+          motion_models.push_back(tracker.get_motion_model());
+          motion_models.back().propagate(
+                frames[j]->timestamp_ - frames[j - 1]->timestamp_);
+          motion_models.back().setFlip(true);
+
+          const Eigen::Vector3f centroid_diff =
+              frames[j - 1]->getCentroid() - frames[j]->getCentroid();
+          for (int dx = -num_steps; dx <= num_steps; ++dx) {
+            for (int dy = -num_steps; dy <= num_steps; ++dy) {
+              transforms[k].push_back(precision_tracking::XYZTransform(
+                    centroid_diff(0) + dx * xy_sampling_resolution,
+                    centroid_diff(1) + dy * xy_sampling_resolution, 0,
+                    pow(xy_sampling_resolution, 2)));
+            }
+          }
+
+          precision_tracking::SmallAlignmentProblem problem;
+          problem.current_points = current_points;
+          problem.prev_points = prev_points;
+          problem.motion_model = &motion_models.back();
+          problem.transforms = &transforms[k];
+          problem.xy_sensor_resolution = sensor_horizontal_resolution;
+          problems.push_back(problem);
+        }
+      }
+
+      Eigen::Vector3f estimated_velocity;
+      tracker.addPoints(frames[j]->cloud_, frames[j]->timestamp_,
+                        sensor_horizontal_resolution,
+                        sensor_vertical_resolution, &estimated_velocity);
+    }
+  }
+
+  // Leave the last block partly filled.
+  if (problems.size() > 1 &&
+      problems.size() % precision_tracking::DensityGridSmallBatch::kBlockSize == 0) {
+    problems.pop_back();
+  }
+
+  precision_tracking::DensityGridSmallBatch batch(&params);
+  std::vector<precision_tracking::ScoredTransforms<precision_tracking::ScoredTransformXYZ> >
+      batch_scored_transforms;
+  batch.score3DTransforms(problems, xy_sampling_resolution,
+                          &batch_scored_transforms);
+
+  precision_tracking::DensityGridSmallEvaluator evaluator(&params);
+  precision_tracking::ScoredTransforms<precision_tracking::ScoredTransformXYZ>
+      scored_transforms;
+  double max_difference = 0;
+  double max_log_prob = 0;
+  for (size_t k = 0; k < problems.size(); ++k) {
+    const precision_tracking::SmallAlignmentProblem& problem = problems[k];
+    Eigen::Vector4f centroid;
+    pcl::compute3DCentroid(*problem.current_points, centroid);
+    evaluator.setPrevPoints(problem.prev_points);
+    evaluator.score3DTransforms(
+          problem.current_points, centroid.head(3), xy_sampling_resolution, 0,
+          problem.xy_sensor_resolution, problem.xy_sensor_resolution,
+          *problem.transforms, *problem.motion_model, &scored_transforms);
+
+    const std::vector<precision_tracking::ScoredTransformXYZ>& scores =
+        scored_transforms.getScoredTransforms();
+    const std::vector<precision_tracking::ScoredTransformXYZ>& batch_scores =
+        batch_scored_transforms[k].getScoredTransforms();
+    if (batch_scores.size() != scores.size()) {
+      printf("Error - the batch scored %zu transforms of problem %zu instead "
+             "of %zu\n", batch_scores.size(), k, scores.size());
+      continue;
+    }
+    for (size_t t = 0; t < scores.size(); ++t) {
+      max_difference = std::max(max_difference,
+          fabs(batch_scores[t].getUnnormalizedLogProb() -
+               scores[t].getUnnormalizedLogProb()));
+      max_log_prob = std::max(max_log_prob,
+                              fabs(scores[t].getUnnormalizedLogProb()));
+    }
+  }
+
+  printf("Scored %zu small alignments in blocks of %d: max difference from "
+         "scoring each alone %lg (largest log probability %lg)\n",
+         problems.size(), precision_tracking::DensityGridSmallBatch::kBlockSize,
+         max_difference, max_log_prob);
+}
+
+// Update a MotionModelBank with the centroids of all frames, one frame of
+// each track per update, and compare its estimates to those of a
+// MotionModel per track that is updated with the same centroids, as a
+// Tracker without a precision tracker does.
+void compareMotionModelBank(
+    const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
+    const precision_tracking::Params& params) {
+  const std::vector< boost::shared_ptr<precision_tracking::track_manager_color::Track> >& tracks =
+      track_manager.tracks_;
+
+  precision_tracking::MotionModelBank motion_model_bank(&params);
+  std::vector<boost::shared_ptr<precision_tracking::MotionModel> > motion_models;
+  std::vector<Eigen::Vector4f, Eigen::aligned_allocator<Eigen::Vector4f> >
+      prev_centroids(tracks.size(), Eigen::Vector4f::Zero());
+  std::vector<double> prev_timestamps(tracks.size());
+  size_t max_num_frames = 0;
+  for (size_t i = 0; i < tracks.size(); ++i) {
+    motion_model_bank.addTrack();
+    motion_models.push_back(
+        boost::make_shared<precision_tracking::MotionModel>(&params));
+    max_num_frames = std::max(max_num_frames, tracks[i]->frames_.size());
+  }
+
+  double max_velocity_difference = 0;
+  double max_covariance_difference = 0;
+  double max_score_difference = 0;
+  int num_updates = 0;
+
+  for (size_t j = 0; j < max_num_frames; ++j) {
+    // Observe the j-th frame of each track that has one.
+    for (size_t i = 0; i < tracks.size(); ++i) {
+      if (j >= tracks[i]->frames_.size()) {
+        continue;
+      }
+      const boost::shared_ptr<precision_tracking::track_manager_color::Frame>& frame =
+          tracks[i]->frames_[j];
+
+      Eigen::Vector4f centroid;
+      pcl::compute3DCentroid(*frame->cloud_, centroid);
+      motion_model_bank.addCentroid(i, centroid, frame->timestamp_);
+
+      if (j > 0) {
+        const double time_diff = frame->timestamp_ - prev_timestamps[i];
+        motion_models[i]->propagate(time_diff);
+        motion_models[i]->addCentroidDiff(centroid - prev_centroids[i],
+                                          time_diff);
+      }
+      prev_centroids[i] = centroid;
+      prev_timestamps[i] = frame->timestamp_;
+    }
+
+    motion_model_bank.update();
+
+    if (j == 0) {
+      continue;
+    }
+
+    for (size_t i = 0; i < tracks.size(); ++i) {
+      if (j >= tracks[i]->frames_.size()) {
+        continue;
+      }
+      const precision_tracking::MotionModel& motion_model = *motion_models[i];
+      if (motion_model_bank.valid(i) != motion_model.valid()) {
+        printf("Error - the bank and the motion model of track %zu disagree "
+               "on whether it is valid\n", i);
+        continue;
+      }
+
+      max_velocity_difference = std::max<double>(max_velocity_difference,
+          (motion_model_bank.get_mean_velocity(i) -
+           motion_model.get_mean_velocity()).norm());
+
+      // Relative differences of the covariances.
+      max_covariance_difference = std::max(max_covariance_difference,
+          (motion_model_bank.get_covariance_velocity(i) -
+           motion_model.get_covariance_velocity()).norm() /
+          motion_model.get_covariance_velocity().norm());
+      max_covariance_difference = std::max(max_covariance_difference,
+          (motion_model_bank.get_covariance_delta_position(i) -
+           motion_model.get_covariance_delta_position()).norm() /
+          motion_model.get_covariance_delta_position().norm());
+
+      // Score a displacement near the peak of the distribution, so that the
+      // score is not clamped to the minimum probability.
+      const Eigen::Vector3d displacement =
+          motion_model.get_mean_delta_position() +
+          Eigen::Vector3d(0.1, 0.1, 0);
+      const double score = motion_model.computeScore(
+          displacement(0), displacement(1), displacement(2));
+      const double bank_score = motion_model_bank.computeScore(
+          i, displacement(0), displacement(1), displacement(2));
+      max_score_difference = std::max(max_score_difference,
+          fabs(bank_score - score) / std::max(fabs(score), 1e-300));
+
+      num_updates++;
+    }
+  }
+
+  printf("Updated %zu motion models in blocks of %d with %d centroids: "
+         "max difference from a motion model per track %lg m/s in the mean "
+         "velocity, relative differences %lg in the covariances and %lg in "
+         "the scores\n",
+         tracks.size(), precision_tracking::MotionModelBank::kBlockSize,
+         num_updates, max_velocity_difference, max_covariance_difference,
+         max_score_difference);
+}
+
+// Compare the velocities estimated for each frame to the velocities
+// estimated by a reference run of the tracker.
+void compareVelocities(const std::vector<TrackResults>& reference_estimates,
+                       const std::vector<TrackResults>& velocity_estimates) {
+  double sum_sq = 0;
+  double max_difference = 0;
+  int num_frames = 0;
+
+  for (size_t i = 0; i < velocity_estimates.size(); ++i) {
+    const std::vector<Eigen::Vector3f>& reference_velocities =
+        reference_estimates[i].estimated_velocities;
+    const std::vector<Eigen::Vector3f>& estimated_velocities =
+        velocity_estimates[i].estimated_velocities;
+
+    for (size_t j = 0; j < estimated_velocities.size(); ++j) {
+      const double difference =
+          (estimated_velocities[j] - reference_velocities[j]).norm();
+      sum_sq += pow(difference, 2);
+      max_difference = std::max(max_difference, difference);
+      num_frames++;
+    }
+  }
+
+  printf("Difference from the reference estimates: RMS %lf m/s, max %lf m/s\n",
+         num_frames > 0 ? sqrt(sum_sq / num_frames) : 0, max_difference);
+}
+
+void evaluate(
+    const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
+    const string gt_folder,
+    std::vector<TrackResults>* velocity_estimates) {
   // Find bad frames that we want to ignore.
-  find_bad_frames(track_manager, &velocity_estimates);
+  find_bad_frames(track_manager, velocity_estimates);
 
   // Evaluate the tracking accuracy.
   boost::shared_ptr<std::vector<bool> > empty_filter;
-  evaluateTracking(velocity_estimates, gt_folder, empty_filter);
+  evaluateTracking(*velocity_estimates, gt_folder, empty_filter);
 
   // Evaluate the tracking accuracy for nearby objects.
   const double max_distance = 5;
   printf("Evaluating only for objects within %lf m:\n", max_distance);
   boost::shared_ptr<std::vector<bool> > filter(new std::vector<bool>);
   getWithinDistance(track_manager, max_distance, *filter);
-  evaluateTracking(velocity_estimates, gt_folder, filter);
+  evaluateTracking(*velocity_estimates, gt_folder, filter);
+}
+
+void trackAndEvaluate(
+    const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
+    const string gt_folder,
+    const precision_tracking::Params& params,
+    const bool use_precision_tracker,
+    const bool track_parallel) {
+  // Track all objects and store the estimated velocities.
+  std::vector<TrackResults> velocity_estimates;
+  precision_tracking::Params tracking_params = params;
+  tracking_params.profileStages = profile_stages;
+  track(track_manager, tracking_params, use_precision_tracker, track_parallel,
+        &velocity_estimates);
+
+  evaluate(track_manager, gt_folder, &velocity_estimates);
+}
+
+// Track all objects with an optional feature enabled in params, and print
+// the accuracy, the timing and the difference from the estimates of the
+// default configuration.
+void trackAndCompare(
+    const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
+    const string gt_folder,
+    const precision_tracking::Params& params,
+    const std::vector<TrackResults>& default_estimates) {
+  std::vector<TrackResults> velocity_estimates;
+  precision_tracking::Params tracking_params = params;
+  tracking_params.profileStages = profile_stages;
+  track(track_manager, tracking_params, true, false, &velocity_estimates);
+  evaluate(track_manager, gt_folder, &velocity_estimates);
+
+  compareVelocities(default_estimates, velocity_estimates);
 }
 
 void testKalman(const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
@@ -329,6 +1328,15 @@ void testKalman(const precision_tracking::track_manager_color::TrackManagerColor
   trackAndEvaluate(track_manager, gt_folder, params, false, false);
 }
 
+void testMotionModelBank(
+    const precision_tracking::track_manager_color::TrackManagerColor& track_manager) {
+  printf("\nUpdating the centroid-based Kalman filters of all objects together in a "
+         "MotionModelBank, as replay_tracking does in kalman mode, and comparing them to "
+         "the Kalman filter of each Tracker.  Please wait...\n");
+  precision_tracking::Params params;
+  compareMotionModelBank(track_manager, params);
+}
+
 void testPrecisionTracker2D(
     const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
     const string gt_folder) {
@@ -349,6 +1357,174 @@ void testPrecisionTracker2DParallel(
   trackAndEvaluate(track_manager, gt_folder, params, true, true);
 }
 
+void testPrecisionTracker2DSegmented(
+    const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
+    const string gt_folder) {
+  printf("\nTracking objects with our precision tracker in 2D, splitting long tracks into segments "
+         "that are tracked in parallel, as for offline processing of logs.  Each segment starts with "
+         "a short burn-in to initialize the motion model, so the estimates differ slightly from "
+         "tracking each object sequentially.  Please wait...\n");
+  precision_tracking::Params params;
+  params.profileStages = profile_stages;
+
+  printf("Sequential:\n");
+  std::vector<TrackResults> sequential_estimates;
+  track(track_manager, params, true, false, &sequential_estimates);
+  evaluate(track_manager, gt_folder, &sequential_estimates);
+
+  printf("Segmented (segments of %d frames with a burn-in of %d frames):\n",
+         params.kSegmentLength, params.kSegmentBurnIn);
+  std::vector<TrackResults> segmented_estimates;
+  trackSegmented(track_manager, params, &segmented_estimates);
+  evaluate(track_manager, gt_folder, &segmented_estimates);
+
+  compareVelocities(sequential_estimates, segmented_estimates);
+}
+
+void testPrecisionTracker2DParticles(
+    const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
+    const string gt_folder) {
+  printf("\nTracking objects with our precision tracker in 2D using the particle tracker (single-threaded). "
+         "This method scores a fixed number of transforms per alignment, so its time per object is predictable.  Please wait...\n");
+  precision_tracking::Params params;
+  params.useParticleTracker = true;
+  trackAndEvaluate(track_manager, gt_folder, params, true, false);
+}
+
+void testPrecisionTracker2DPointBuffer(
+    const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
+    const string gt_folder) {
+  printf("\nTracking objects with our precision tracker in 2D from points in separate coordinate arrays "
+         "(single-threaded).  The points have no color, which the 2D tracker does not use, so the "
+         "estimates should be the same as tracking the point clouds.  Please wait...\n");
+  precision_tracking::Params params;
+
+  std::vector<TrackResults> cloud_estimates;
+  track(track_manager, params, true, false, &cloud_estimates);
+
+  std::vector<TrackResults> buffer_estimates;
+  trackPointBuffers(track_manager, params, &buffer_estimates);
+  evaluate(track_manager, gt_folder, &buffer_estimates);
+
+  compareVelocities(cloud_estimates, buffer_estimates);
+}
+
+void testPrecisionTracker2DSweepRing(
+    const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
+    const string gt_folder) {
+  printf("\nTracking objects with our precision tracker in 2D from sweeps that a separate process "
+         "writes into a shared-memory ring (single-threaded).  The estimates should be the same "
+         "as tracking the point clouds.  Please wait...\n");
+  precision_tracking::Params params;
+
+  std::vector<TrackResults> cloud_estimates;
+  track(track_manager, params, true, false, &cloud_estimates);
+
+  std::vector<TrackResults> ring_estimates;
+  trackSweepRing(track_manager, params, &ring_estimates);
+  evaluate(track_manager, gt_folder, &ring_estimates);
+
+  compareVelocities(cloud_estimates, ring_estimates);
+}
+
+void testPrecisionTracker2DAsync(
+    const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
+    const string gt_folder) {
+  printf("\nTracking objects with our precision tracker in 2D asynchronously, queueing every frame "
+         "on a pool of worker threads.  The frames of each track are aligned in order, so the "
+         "estimates should be the same as tracking each object sequentially.  Please wait...\n");
+  precision_tracking::Params params;
+
+  printf("Sequential:\n");
+  std::vector<TrackResults> sequential_estimates;
+  track(track_manager, params, true, false, &sequential_estimates);
+
+  printf("Asynchronous:\n");
+  std::vector<TrackResults> async_estimates;
+  trackAsync(track_manager, params, &async_estimates);
+  evaluate(track_manager, gt_folder, &async_estimates);
+
+  compareVelocities(sequential_estimates, async_estimates);
+}
+
+void testPrecisionTracker2DDormant(
+    const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
+    const string gt_folder) {
+  printf("\nTracking objects with our precision tracker in 2D, packing the state of each tracker after "
+         "every frame as if the object were occluded.  The estimates should be the same as tracking "
+         "each object without packing, except for objects with more points than the alignment uses, "
+         "whose previous points are packed down-sampled.  Please wait...\n");
+  precision_tracking::Params params;
+
+  std::vector<TrackResults> awake_estimates;
+  std::vector<TrackResults> dormant_estimates;
+  trackDormant(track_manager, params, &awake_estimates, &dormant_estimates);
+  evaluate(track_manager, gt_folder, &dormant_estimates);
+
+  compareVelocities(awake_estimates, dormant_estimates);
+}
+
+void testPrecisionTracker2DSnapshot(
+    const precision_tracking::track_manager_color::TrackManagerColor& track_manager) {
+  printf("\nSaving the trackers to a snapshot halfway through each track and restoring them.  The "
+         "restored trackers should give the same estimates as the original trackers, except for "
+         "objects with more points than the alignment uses, whose previous points are saved "
+         "down-sampled.  Please wait...\n");
+  precision_tracking::Params params;
+
+  std::vector<TrackResults> original_estimates;
+  std::vector<TrackResults> restored_estimates;
+  trackSnapshot(track_manager, params, &original_estimates,
+                &restored_estimates);
+  compareVelocities(original_estimates, restored_estimates);
+}
+
+void testPrecisionTracker2DOptions(
+    const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
+    const string gt_folder) {
+  printf("\nTracking objects with our precision tracker in 2D (single-threaded), with the "
+         "optional speed-ups of the 2D alignment, compared to the default configuration.  "
+         "Please wait...\n");
+  precision_tracking::Params default_params;
+  default_params.profileStages = profile_stages;
+
+  printf("Default:\n");
+  std::vector<TrackResults> default_estimates;
+  track(track_manager, default_params, true, false, &default_estimates);
+  evaluate(track_manager, gt_folder, &default_estimates);
+
+  printf("Scoring at most 50 transforms per annealing level "
+         "(kMaxTransformsPerLevel):\n");
+  precision_tracking::Params params = default_params;
+  params.kMaxTransformsPerLevel = 50;
+  trackAndCompare(track_manager, gt_folder, params, default_estimates);
+
+  printf("Choosing the initial resolution to give about 100 candidate "
+         "transforms (kTargetInitialCandidates):\n");
+  params = default_params;
+  params.kTargetInitialCandidates = 100;
+  trackAndCompare(track_manager, gt_folder, params, default_estimates);
+
+  printf("Scoring objects with at most 256 points with a small density grid "
+         "(kSmallObjectMaxPoints):\n");
+  params = default_params;
+  params.kSmallObjectMaxPoints = 256;
+  trackAndCompare(track_manager, gt_folder, params, default_estimates);
+}
+
+void testTrackAssociator(
+    const precision_tracking::track_manager_color::TrackManagerColor& track_manager) {
+  printf("\nAssociating the last frame of each object with the tracks of all objects, scoring the "
+         "candidates with a coarse alignment.  Some of the trackers are dormant or have a deferred "
+         "frame, which the association should leave as they are.  Please wait...\n");
+  precision_tracking::Params params;
+  associateLastFrames(track_manager, params);
+
+  // The associator scores most candidates several at a time; these scores
+  // should be the same as scoring each candidate alone.
+  compareSmallBatch(track_manager, params);
+}
+
 void testPrecisionTracker3D(
     const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
     const string gt_folder) {
@@ -360,6 +1536,18 @@ void testPrecisionTracker3D(
   trackAndEvaluate(track_manager, gt_folder, params, true, false);
 }
 
+void testPrecisionTracker25D(
+    const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
+    const string gt_folder) {
+  printf("\nTracking objects with our precision tracker in 2.5D (single-threaded). "
+         "This method stores the heights of the points in each cell of the 2D version, "
+         "so it is nearly as fast and uses nearly as little memory as the 2D version, "
+         "but is more accurate for objects with overhangs.  Please wait...\n");
+  precision_tracking::Params params;
+  params.use25D = true;
+  trackAndEvaluate(track_manager, gt_folder, params, true, false);
+}
+
 void testPrecisionTrackerColor(
     const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
     const string gt_folder) {
@@ -370,13 +1558,70 @@ void testPrecisionTrackerColor(
   trackAndEvaluate(track_manager, gt_folder, params, true, false);
 }
 
+void testPrecisionTrackerColorGrid(
+    const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
+    const string gt_folder) {
+  printf("\nTracking objects with our precision tracker using a color density grid (single-threaded). "
+         "This method uses color at nearly the speed of the version without color.\n");
+  precision_tracking::Params params;
+  params.useColor = true;
+  params.kUseColorGrid = true;
+  trackAndEvaluate(track_manager, gt_folder, params, true, false);
+}
+
+void testPrecisionTrackerColorOptions(
+    const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
+    const string gt_folder) {
+  printf("\nTracking objects with our precision tracker using color (single-threaded), with the "
+         "optional speed-ups of the color evaluator, compared to the default configuration.  "
+         "Please wait (will be slow)...\n");
+  precision_tracking::Params default_params;
+  default_params.useColor = true;
+  default_params.profileStages = profile_stages;
+
+  printf("Default:\n");
+  std::vector<TrackResults> default_estimates;
+  track(track_manager, default_params, true, false, &default_estimates);
+  evaluate(track_manager, gt_folder, &default_estimates);
+
+  printf("Starting each nearest neighbor search from the previous nearest neighbor "
+         "(kCoherentNNSearch):\n");
+  precision_tracking::Params params = default_params;
+  params.kCoherentNNSearch = true;
+  trackAndCompare(track_manager, gt_folder, params, default_estimates);
+
+  printf("Scoring the coarse annealing levels with the 2D density grid "
+         "(kCascadeResolution):\n");
+  params = default_params;
+  params.kCascadeResolution = 0.2;
+  trackAndCompare(track_manager, gt_folder, params, default_estimates);
+}
+
 int main(int argc, char **argv)
 {
   if (argc < 3) {
-    printf("Usage: %s tm_file gt_folder\n", argv[0]);
+    printf("Usage: %s tm_file gt_folder [--profile] [--trace=trace_file]\n",
+           argv[0]);
     return (1);
   }
 
+  string trace_file;
+  for (int i = 3; i < argc; ++i) {
+    const string option = argv[i];
+    if (option == "--profile") {
+      profile_stages = true;
+    } else if (option.compare(0, 8, "--trace=") == 0) {
+      trace_file = option.substr(8);
+    } else {
+      printf("Unknown option: %s\n", option.c_str());
+      return (1);
+    }
+  }
+
+  if (!trace_file.empty()) {
+    precision_tracking::TraceRecorder::enable();
+  }
+
   string color_tm_file = argv[1];
   string gt_folder = argv[2];
 
@@ -392,19 +1637,76 @@ int main(int argc, char **argv)
   // very fast but not very accurate.
   testKalman(track_manager, gt_folder);
 
+  // Testing the Kalman filters of many objects updated together - should
+  // give the same estimates as the Kalman filter baseline.
+  testMotionModelBank(track_manager);
+
   // Testing our precision tracker - should be very accurate and quite fast.
   testPrecisionTracker2D(track_manager, gt_folder);
 
   // Testing our precision tracker - should be very accurate and quite fast.
   testPrecisionTracker2DParallel(track_manager, gt_folder);
 
+  // Testing our precision tracker on long tracks split into segments - should
+  // be almost as accurate as tracking sequentially, and faster for long tracks.
+  testPrecisionTracker2DSegmented(track_manager, gt_folder);
+
+  // Testing our precision tracker with a fixed number of scored transforms
+  // per alignment - should be about as accurate as 2D with a bounded cost.
+  testPrecisionTracker2DParticles(track_manager, gt_folder);
+
+  // Testing our precision tracker with points passed in the caller's own
+  // arrays - should give the same estimates as 2D.
+  testPrecisionTracker2DPointBuffer(track_manager, gt_folder);
+
+  // Testing our precision tracker with the objects passed from another
+  // process through shared memory - should give the same estimates as 2D.
+  testPrecisionTracker2DSweepRing(track_manager, gt_folder);
+
+  // Testing our precision tracker with all frames queued on worker threads -
+  // should give the same estimates as 2D, faster.
+  testPrecisionTracker2DAsync(track_manager, gt_folder);
+
+  // Testing our precision tracker with the state packed between frames -
+  // should give the same estimates as 2D for all but the largest objects.
+  testPrecisionTracker2DDormant(track_manager, gt_folder);
+
+  // Testing the restoring of trackers from a snapshot - should give the
+  // same estimates for all but the largest objects.
+  testPrecisionTracker2DSnapshot(track_manager);
+
+  // Testing the optional speed-ups of our precision tracker in 2D - should
+  // be about as accurate as 2D and faster.
+  testPrecisionTracker2DOptions(track_manager, gt_folder);
+
+  // Testing the association of segments with tracks - should associate
+  // almost every frame with its own track without changing the trackers.
+  testTrackAssociator(track_manager);
+
   // Testing our precision tracker - should be very accurate and quite fast.
   testPrecisionTracker3D(track_manager, gt_folder);
 
+  // Testing our precision tracker with heights in a 2D grid - should be
+  // almost as fast as 2D and closer to the accuracy of 3D.
+  testPrecisionTracker25D(track_manager, gt_folder);
+
   // Testing our precision tracker with color - should be even more accurate
   // but slow.
   testPrecisionTrackerColor(track_manager, gt_folder);
 
+  // Testing our precision tracker with color cached in a density grid -
+  // should be fast.
+  testPrecisionTrackerColorGrid(track_manager, gt_folder);
+
+  // Testing the optional speed-ups of our precision tracker with color -
+  // should be about as accurate as color and faster.
+  testPrecisionTrackerColorOptions(track_manager, gt_folder);
+
+  if (!trace_file.empty()) {
+    printf("Writing trace to: %s\n", trace_file.c_str());
+    precision_tracking::TraceRecorder::writeChromeTrace(trace_file);
+  }
+
   return 0;
 }
 